@@ -0,0 +1,603 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_hash.h"
+#include "ra_thread.h"
+#include "ra_cache.h"
+
+#define T1 0
+#define T2 1
+#define B1 2
+#define B2 3
+
+struct ra_cache {
+	uint64_t c;
+	uint64_t p;
+	uint64_t mask;
+	uint64_t block;
+	uint64_t frames_n;
+	uint64_t *frames;
+	char *memory;
+	void *memory_;
+	ra_mutex_t mutex;
+	ra_device_t device;
+	struct ra_cache_stats stats;
+	struct entry {
+		int list;
+		int dirty;
+		uint64_t off;
+		uint64_t frame;
+		struct entry *prev;
+		struct entry *next;
+		struct entry *chain;
+	} *entries, *unused, **buckets;
+	struct list {
+		uint64_t size;
+		struct entry *head; /* MRU */
+		struct entry *tail; /* LRU */
+	} lists[4];
+};
+
+static char *
+frame(const struct ra_cache *cache, const struct entry *entry)
+{
+	return cache->memory + entry->frame * cache->block;
+}
+
+static uint64_t
+bucket(const struct ra_cache *cache, uint64_t off)
+{
+	return ra_hash(&off, sizeof (off)) & cache->mask;
+}
+
+static struct entry *
+lookup(const struct ra_cache *cache, uint64_t off)
+{
+	struct entry *entry;
+
+	entry = cache->buckets[bucket(cache, off)];
+	while (entry && (entry->off != off)) {
+		entry = entry->chain;
+	}
+	return entry;
+}
+
+static void
+unlink_(struct ra_cache *cache, struct entry *entry)
+{
+	struct list *list;
+
+	list = &cache->lists[entry->list];
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	}
+	else {
+		list->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	}
+	else {
+		list->tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+	--list->size;
+}
+
+static void
+link_(struct ra_cache *cache, struct entry *entry, int list_)
+{
+	struct list *list;
+
+	list = &cache->lists[list_];
+	entry->list = list_;
+	entry->prev = NULL;
+	entry->next = list->head;
+	if (list->head) {
+		list->head->prev = entry;
+	}
+	else {
+		list->tail = entry;
+	}
+	list->head = entry;
+	++list->size;
+}
+
+static void
+move(struct ra_cache *cache, struct entry *entry, int list)
+{
+	unlink_(cache, entry);
+	link_(cache, entry, list);
+}
+
+static struct entry *
+create(struct ra_cache *cache, uint64_t off)
+{
+	struct entry *entry;
+	uint64_t i;
+
+	entry = cache->unused;
+	cache->unused = entry->chain;
+	memset(entry, 0, sizeof (struct entry));
+	entry->off = off;
+	i = bucket(cache, off);
+	entry->chain = cache->buckets[i];
+	cache->buckets[i] = entry;
+	return entry;
+}
+
+static void
+destroy(struct ra_cache *cache, struct entry *entry)
+{
+	struct entry **p;
+
+	unlink_(cache, entry);
+	p = &cache->buckets[bucket(cache, entry->off)];
+	while ((*p) != entry) {
+		p = &(*p)->chain;
+	}
+	(*p) = entry->chain;
+	entry->chain = cache->unused;
+	cache->unused = entry;
+}
+
+static int
+writeback(struct ra_cache *cache, struct entry *entry)
+{
+	if (entry->dirty) {
+		if (ra_device_write(cache->device,
+				    frame(cache, entry),
+				    entry->off,
+				    cache->block)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		entry->dirty = 0;
+		++cache->stats.writebacks;
+	}
+	return 0;
+}
+
+static int
+evict(struct ra_cache *cache, struct entry *entry)
+{
+	if (writeback(cache, entry)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	cache->frames[cache->frames_n++] = entry->frame;
+	++cache->stats.evictions;
+	return 0;
+}
+
+/**
+ * REPLACE(x, p) of ARC: demote the LRU page of T1 or T2 to its ghost list
+ * and recycle its frame, unless a free frame is still available.
+ */
+
+static int
+replace(struct ra_cache *cache, int b2)
+{
+	struct entry *entry;
+	uint64_t t1;
+
+	if (cache->frames_n) {
+		return 0;
+	}
+	t1 = cache->lists[T1].size;
+	if (t1 && ((b2 && (t1 == cache->p)) || (t1 > cache->p))) {
+		entry = cache->lists[T1].tail;
+		if (evict(cache, entry)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		move(cache, entry, B1);
+	}
+	else {
+		entry = cache->lists[T2].tail;
+		if (evict(cache, entry)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		move(cache, entry, B2);
+	}
+	return 0;
+}
+
+static struct entry *
+fetch(struct ra_cache *cache, uint64_t off, int fill)
+{
+	struct entry *entry;
+	uint64_t b1, b2, t1, n;
+
+	t1 = cache->lists[T1].size;
+	b1 = cache->lists[B1].size;
+	b2 = cache->lists[B2].size;
+	if ((entry = lookup(cache, off))) {
+		if ((T1 == entry->list) || (T2 == entry->list)) {
+			++cache->stats.hits;
+			move(cache, entry, T2);
+			return entry;
+		}
+	}
+	++cache->stats.misses;
+	if (entry && (B1 == entry->list)) {
+		cache->p = RA_MIN(cache->c, cache->p + RA_MAX(b2 / b1, 1));
+		if (replace(cache, 0)) {
+			RA_TRACE("^");
+			return NULL;
+		}
+		move(cache, entry, T2);
+	}
+	else if (entry && (B2 == entry->list)) {
+		n = RA_MAX(b1 / b2, 1);
+		cache->p = (cache->p > n) ? (cache->p - n) : 0;
+		if (replace(cache, 1)) {
+			RA_TRACE("^");
+			return NULL;
+		}
+		move(cache, entry, T2);
+	}
+	else {
+		n = t1 + b1 + cache->lists[T2].size + b2;
+		if ((t1 + b1) == cache->c) {
+			if (t1 < cache->c) {
+				destroy(cache, cache->lists[B1].tail);
+				if (replace(cache, 0)) {
+					RA_TRACE("^");
+					return NULL;
+				}
+			}
+			else {
+				entry = cache->lists[T1].tail;
+				if (evict(cache, entry)) {
+					RA_TRACE("^");
+					return NULL;
+				}
+				destroy(cache, entry);
+			}
+		}
+		else if (n >= cache->c) {
+			if (n == (2 * cache->c)) {
+				destroy(cache, cache->lists[B2].tail);
+			}
+			if (replace(cache, 0)) {
+				RA_TRACE("^");
+				return NULL;
+			}
+		}
+		entry = create(cache, off);
+		link_(cache, entry, T1);
+	}
+	entry->frame = cache->frames[--cache->frames_n];
+	if (fill && ra_device_read(cache->device,
+				   frame(cache, entry),
+				   off,
+				   cache->block)) {
+		cache->frames[cache->frames_n++] = entry->frame;
+		destroy(cache, entry);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return entry;
+}
+
+ra_cache_t
+ra_cache_open(ra_device_t device, uint64_t memory)
+{
+	struct ra_cache *cache;
+	uint64_t i, n;
+
+	assert( device );
+	assert( memory >= ra_device_block(device) );
+
+	/* initialize */
+
+	if (!(cache = malloc(sizeof (struct ra_cache)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(cache, 0, sizeof (struct ra_cache));
+	cache->device = device;
+	cache->block = ra_device_block(device);
+	cache->c = memory / cache->block;
+
+	/* index */
+
+	n = 1;
+	while (n < (2 * cache->c)) {
+		n *= 2;
+	}
+	cache->mask = n - 1;
+	if (!(cache->mutex = ra_mutex_open()) ||
+	    !(cache->buckets = malloc(n * sizeof (cache->buckets[0]))) ||
+	    !(cache->entries = malloc(2 * cache->c *
+				      sizeof (cache->entries[0]))) ||
+	    !(cache->frames = malloc(cache->c * sizeof (cache->frames[0])))) {
+		ra_cache_close(cache);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(cache->buckets, 0, n * sizeof (cache->buckets[0]));
+	memset(cache->entries, 0, 2 * cache->c * sizeof (cache->entries[0]));
+	for (i=0; i<(2 * cache->c); ++i) {
+		cache->entries[i].chain = cache->unused;
+		cache->unused = &cache->entries[i];
+	}
+
+	/* frames (O_DIRECT needs aligned buffers) */
+
+	if (!(cache->memory_ = malloc(cache->c * cache->block + ra_page()))) {
+		ra_cache_close(cache);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	cache->memory = ra_align(cache->memory_, ra_page());
+	for (i=0; i<cache->c; ++i) {
+		cache->frames[cache->frames_n++] = cache->c - 1 - i;
+	}
+	return cache;
+}
+
+void
+ra_cache_close(ra_cache_t cache)
+{
+	if (cache) {
+		if (cache->memory && ra_cache_flush(cache)) {
+			RA_TRACE("^ (ignored)");
+		}
+		ra_mutex_close(cache->mutex);
+		RA_FREE(cache->memory_);
+		RA_FREE(cache->frames);
+		RA_FREE(cache->entries);
+		RA_FREE(cache->buckets);
+		memset(cache, 0, sizeof (struct ra_cache));
+		RA_FREE(cache);
+	}
+}
+
+int
+ra_cache_read(ra_cache_t cache, void *buf_, uint64_t off, uint64_t len)
+{
+	char *buf = (char *)buf_;
+	struct entry *entry;
+	uint64_t o, n;
+
+	assert( cache );
+	assert( !len || buf );
+
+	ra_mutex_lock(cache->mutex);
+	while (len) {
+		o = off % cache->block;
+		n = RA_MIN(cache->block - o, len);
+		if (!(entry = fetch(cache, off - o, 1))) {
+			ra_mutex_unlock(cache->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+		memcpy(buf, frame(cache, entry) + o, n);
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	ra_mutex_unlock(cache->mutex);
+	return 0;
+}
+
+int
+ra_cache_write(ra_cache_t cache,
+	       const void *buf_,
+	       uint64_t off,
+	       uint64_t len)
+{
+	const char *buf = (const char *)buf_;
+	struct entry *entry;
+	uint64_t o, n;
+
+	assert( cache );
+	assert( !len || buf );
+
+	ra_mutex_lock(cache->mutex);
+	while (len) {
+		o = off % cache->block;
+		n = RA_MIN(cache->block - o, len);
+		if (!(entry = fetch(cache, off - o, n < cache->block))) {
+			ra_mutex_unlock(cache->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+		memcpy(frame(cache, entry) + o, buf, n);
+		entry->dirty = 1;
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	ra_mutex_unlock(cache->mutex);
+	return 0;
+}
+
+int
+ra_cache_flush(ra_cache_t cache)
+{
+	struct entry *entry;
+	int i;
+
+	assert( cache );
+
+	ra_mutex_lock(cache->mutex);
+	for (i=T1; i<=T2; ++i) {
+		entry = cache->lists[i].head;
+		while (entry) {
+			if (writeback(cache, entry)) {
+				ra_mutex_unlock(cache->mutex);
+				RA_TRACE("^");
+				return -1;
+			}
+			entry = entry->next;
+		}
+	}
+	ra_mutex_unlock(cache->mutex);
+	return 0;
+}
+
+void
+ra_cache_stats(ra_cache_t cache, struct ra_cache_stats *stats)
+{
+	assert( cache && stats );
+
+	ra_mutex_lock(cache->mutex);
+	(*stats) = cache->stats;
+	ra_mutex_unlock(cache->mutex);
+}
+
+static int
+expect(ra_cache_t cache, uint64_t hits, uint64_t misses)
+{
+	struct ra_cache_stats stats;
+
+	ra_cache_stats(cache, &stats);
+	return ((hits == stats.hits) && (misses == stats.misses)) ? 0 : -1;
+}
+
+int
+ra_cache_test(void)
+{
+	const uint64_t SIZE = 1024 * 1024;
+	const uint64_t BLOCK = 512;
+	const uint64_t C = 64; /* frames */
+	struct ra_cache_stats stats, stats_;
+	ra_device_t device;
+	ra_cache_t cache;
+	char *shadow, *buf;
+	uint64_t i, off, len;
+	int e;
+
+	/* initialize */
+
+	e = 0;
+	shadow = malloc(SIZE);
+	buf = malloc(SIZE);
+	if (!shadow || !buf ||
+	    !(device = ra_device_open_memory(SIZE, BLOCK, 0))) {
+		RA_FREE(shadow);
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (i=0; i<SIZE; ++i) {
+		shadow[i] = (char)rand();
+	}
+	if (ra_device_write(device, shadow, 0, SIZE) ||
+	    !(cache = ra_cache_open(device, C * BLOCK))) {
+		ra_device_close(device);
+		RA_FREE(shadow);
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* hits and misses, a read straddling three blocks */
+
+	if (ra_cache_read(cache, buf, 0, 1) ||
+	    ra_cache_read(cache, buf, 0, 1) ||
+	    expect(cache, 1, 1) ||
+	    ra_cache_read(cache, buf, 100, 1200) ||
+	    expect(cache, 2, 3) ||
+	    memcmp(buf, shadow + 100, 1200)) {
+		e = -1;
+	}
+
+	/* a hot set referenced twice survives a one-time scan */
+
+	for (i=0; i<2 * (C / 2); ++i) {
+		off = (100 + i % (C / 2)) * BLOCK;
+		if (ra_cache_read(cache, buf, off, BLOCK)) {
+			e = -1;
+		}
+	}
+	for (i=0; i<16 * C; ++i) {
+		if (ra_cache_read(cache, buf, (200 + i) * BLOCK, BLOCK)) {
+			e = -1;
+		}
+	}
+	ra_cache_stats(cache, &stats);
+	for (i=0; i<C / 2; ++i) {
+		if (ra_cache_read(cache, buf, (100 + i) * BLOCK, BLOCK)) {
+			e = -1;
+		}
+	}
+	if (expect(cache, stats.hits + C / 2, stats.misses)) {
+		e = -1;
+	}
+
+	/* dirty blocks stay cached until flushed, then reach the device */
+
+	memset(shadow + 5 * BLOCK, 'f', BLOCK);
+	memset(shadow + 6 * BLOCK + 7, 'p', 10);
+	if (ra_cache_write(cache, shadow + 5 * BLOCK, 5 * BLOCK, BLOCK) ||
+	    ra_cache_write(cache, shadow + 6 * BLOCK + 7, 6 * BLOCK + 7, 10) ||
+	    ra_device_read(device, buf, 5 * BLOCK, 2 * BLOCK) ||
+	    !memcmp(buf, shadow + 5 * BLOCK, BLOCK) ||
+	    ra_cache_flush(cache) ||
+	    ra_device_read(device, buf, 5 * BLOCK, 2 * BLOCK) ||
+	    memcmp(buf, shadow + 5 * BLOCK, 2 * BLOCK)) {
+		e = -1;
+	}
+
+	/* ... or when evicted */
+
+	ra_cache_stats(cache, &stats);
+	memset(shadow + 7 * BLOCK, 'e', BLOCK);
+	if (ra_cache_write(cache, shadow + 7 * BLOCK, 7 * BLOCK, BLOCK)) {
+		e = -1;
+	}
+	for (i=0; i<4 * C; ++i) {
+		if (ra_cache_read(cache, buf, (1000 + i) * BLOCK, BLOCK)) {
+			e = -1;
+		}
+	}
+	ra_cache_stats(cache, &stats_);
+	if ((stats.writebacks == stats_.writebacks) ||
+	    ra_device_read(device, buf, 7 * BLOCK, BLOCK) ||
+	    memcmp(buf, shadow + 7 * BLOCK, BLOCK)) {
+		e = -1;
+	}
+
+	/* random traffic against a shadow copy */
+
+	for (i=0; i<20000; ++i) {
+		off = (uint64_t)rand() % (SIZE - 3 * BLOCK);
+		len = 1 + (uint64_t)rand() % (3 * BLOCK);
+		if (rand() % 3) {
+			if (ra_cache_read(cache, buf, off, len) ||
+			    memcmp(buf, shadow + off, len)) {
+				e = -1;
+			}
+		}
+		else {
+			memset(shadow + off, (char)rand(), len);
+			if (ra_cache_write(cache, shadow + off, off, len)) {
+				e = -1;
+			}
+		}
+	}
+	ra_cache_stats(cache, &stats);
+	if (!stats.evictions || !stats.writebacks) {
+		e = -1;
+	}
+
+	/* close writes back what is still dirty */
+
+	ra_cache_close(cache);
+	if (ra_device_read(device, buf, 0, SIZE) ||
+	    memcmp(buf, shadow, SIZE)) {
+		e = -1;
+	}
+	ra_device_close(device);
+	RA_FREE(shadow);
+	RA_FREE(buf);
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,41 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_CACHE_H__
+#define __RA_CACHE_H__
+
+#include "ra_device.h"
+
+typedef struct ra_cache *ra_cache_t;
+
+struct ra_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;
+};
+
+/**
+ * Write-back block cache over a device using ARC replacement. The memory
+ * budget (in bytes) is divided into device-block sized frames. Reads and
+ * writes may be at any offset and length; dirty blocks reach the device
+ * on eviction, ra_cache_flush() or ra_cache_close().
+ */
+
+ra_cache_t ra_cache_open(ra_device_t device, uint64_t memory);
+
+void ra_cache_close(ra_cache_t cache);
+
+int ra_cache_read(ra_cache_t cache, void *buf, uint64_t off, uint64_t len);
+
+int ra_cache_write(ra_cache_t cache,
+		   const void *buf,
+		   uint64_t off,
+		   uint64_t len);
+
+int ra_cache_flush(ra_cache_t cache);
+
+void ra_cache_stats(ra_cache_t cache, struct ra_cache_stats *stats);
+
+int ra_cache_test(void);
+
+#endif /* __RA_CACHE_H__ */
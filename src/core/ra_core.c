@@ -36,15 +36,42 @@ ra_core_test(void)
 	TEST(ra_base64_test, "base64");
 	TEST(ra_bigint_test, "bigint");
 	TEST(ra_bitset_test, "bitset");
+	TEST(ra_cache_test, "cache");
 	TEST(ra_csv_test, "csv");
+	TEST(ra_device_test, "device");
 	TEST(ra_ec_test, "ec");
 	TEST(ra_fft_test, "fft");
+	TEST(ra_fiber_test, "fiber");
 	TEST(ra_file_test, "file");
 	TEST(ra_hash_test, "hash");
 	TEST(ra_jitc_test, "jitc");
 	TEST(ra_json_test, "json");
 	TEST(ra_map_test, "map");
+	TEST(ra_merkle_test, "merkle");
 	TEST(ra_mlp_test, "mlp");
+	TEST(ra_network_test, "network");
+	TEST(ra_queue_test, "queue");
+	TEST(ra_raid_test, "raid");
+	TEST(ra_rebuild_test, "rebuild");
+	TEST(ra_rpc_test, "rpc");
 	TEST(ra_sha3_test, "sha3");
+	TEST(ra_thread_test, "thread");
+	TEST(ra_timer_test, "timer");
+	TEST(ra_wal_test, "wal");
+	return e;
+}
+
+int
+ra_core_bench(void)
+{
+	int e;
+
+	e = 0;
+	TEST(ra_hash_bench, "hash");
+	TEST(ra_merkle_bench, "merkle");
+	TEST(ra_network_bench, "network");
+	TEST(ra_queue_bench, "queue");
+	TEST(ra_sha3_bench, "sha3");
+	TEST(ra_thread_bench, "thread");
 	return e;
 }
@@ -7,23 +7,34 @@
 #include "ra_base64.h"
 #include "ra_bigint.h"
 #include "ra_bitset.h"
+#include "ra_cache.h"
 #include "ra_csv.h"
 #include "ra_device.h"
 #include "ra_ec.h"
 #include "ra_fft.h"
+#include "ra_fiber.h"
 #include "ra_file.h"
 #include "ra_hash.h"
 #include "ra_jitc.h"
 #include "ra_json.h"
 #include "ra_kernel.h"
+#include "ra_merkle.h"
 #include "ra_mlp.h"
 #include "ra_network.h"
+#include "ra_queue.h"
+#include "ra_raid.h"
+#include "ra_rebuild.h"
+#include "ra_rpc.h"
 #include "ra_sha3.h"
 #include "ra_thread.h"
+#include "ra_timer.h"
 #include "ra_vector.h"
+#include "ra_wal.h"
 
 void ra_core_init(void);
 
 int ra_core_test(void);
 
+int ra_core_bench(void);
+
 #endif /* __RA_CORE_H__ */
@@ -23,6 +23,8 @@ struct ra_device {
 	int fd;
 	uint64_t size;
 	uint64_t block;
+	uint64_t latency;
+	char *memory;
 };
 
 ra_device_t
@@ -46,7 +48,10 @@ ra_device_open(const char *pathname)
 	device->fd = -1;
 
 #if defined(__linux__)
-	if (0 > (device->fd = open(pathname, O_RDWR | O_DIRECT))) {
+	/* file systems without O_DIRECT support (e.g., tmpfs) fall back */
+	if ((0 > (device->fd = open(pathname, O_RDWR | O_DIRECT))) &&
+	    ((EINVAL != errno) ||
+	     (0 > (device->fd = open(pathname, O_RDWR))))) {
 		ra_device_close(device);
 		RA_TRACE("unable to open device");
 		return NULL;
@@ -85,11 +90,25 @@ ra_device_open(const char *pathname)
 		return NULL;
 	}
 
+	/* file? */
+
+	if (S_ISREG(st.st_mode)) {
+		device->block = RA_MAX(512, (uint64_t)st.st_blksize);
+		device->size = (uint64_t)st.st_size;
+		device->size -= device->size % device->block;
+		if (!device->size) {
+			ra_device_close(device);
+			RA_TRACE("empty device file");
+			return NULL;
+		}
+		return device;
+	}
+
 	/* block? */
 
 	if (!S_ISBLK(st.st_mode)) {
 		ra_device_close(device);
-		RA_TRACE("not a block device");
+		RA_TRACE("not a block device or regular file");
 		return NULL;
 	}
 
@@ -118,6 +137,80 @@ ra_device_open(const char *pathname)
 	return device;
 }
 
+ra_device_t
+ra_device_open_memory(uint64_t size, uint64_t block, uint64_t latency)
+{
+	struct ra_device *device;
+
+	assert( block && (0 == (block & (block - 1))) );
+	assert( size && (0 == (size % block)) );
+
+	if (!(device = malloc(sizeof (struct ra_device)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(device, 0, sizeof (struct ra_device));
+	device->fd = -1;
+	device->size = size;
+	device->block = block;
+	device->latency = latency;
+	if (!(device->memory = malloc((size_t)size))) {
+		ra_device_close(device);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(device->memory, 0, (size_t)size);
+	return device;
+}
+
+int
+ra_device_create(const char *pathname, uint64_t size)
+{
+	int fd;
+
+	assert( pathname && (*pathname) );
+	assert( size );
+
+	if (0 > (fd = open(pathname, O_RDWR | O_CREAT, 0644))) {
+		RA_TRACE("unable to create device file");
+		return -1;
+	}
+
+#if defined(__linux__)
+	/* fallocate() never shrinks an existing, larger file */
+
+	if ((fallocate(fd, 0, 0, (off_t)size) && (EOPNOTSUPP != errno)) ||
+	    ftruncate(fd, (off_t)size)) {
+		close(fd);
+		RA_TRACE("unable to allocate device file");
+		return -1;
+	}
+#endif /* __linux__ */
+
+#if defined(__APPLE__)
+	{
+		fstore_t store;
+
+		memset(&store, 0, sizeof (store));
+		store.fst_flags = F_ALLOCATEALL;
+		store.fst_posmode = F_PEOFPOSMODE;
+		store.fst_length = (off_t)size;
+		if ((-1 == fcntl(fd, F_PREALLOCATE, &store)) ||
+		    ftruncate(fd, (off_t)size)) {
+			close(fd);
+			RA_TRACE("unable to allocate device file");
+			return -1;
+		}
+	}
+#endif /* __APPLE__ */
+
+	if (close(fd)) {
+		RA_TRACE("unable to create device file");
+		return -1;
+	}
+	return 0;
+}
+
 void
 ra_device_close(ra_device_t device)
 {
@@ -125,6 +218,7 @@ ra_device_close(ra_device_t device)
 		if (0 <= device->fd) {
 			close(device->fd);
 		}
+		RA_FREE(device->memory);
 		memset(device, 0, sizeof (struct ra_device));
 		RA_FREE(device);
 	}
@@ -137,7 +231,15 @@ ra_device_read(ra_device_t device, void *buf, uint64_t off, uint64_t len)
 	assert( !len || buf );
 	assert( 0 == (off % device->block) );
 	assert( 0 == (len % device->block) );
+	assert( device->size >= (off + len) );
 
+	if (device->memory) {
+		if (device->latency) {
+			ra_sleep(device->latency);
+		}
+		memcpy(buf, device->memory + off, (size_t)len);
+		return 0;
+	}
 	if (len != (uint64_t)pread(device->fd, buf, (size_t)len, (off_t)off)) {
 		RA_TRACE("unable to read device");
 		return -1;
@@ -155,7 +257,15 @@ ra_device_write(ra_device_t device,
 	assert( !len || buf );
 	assert( 0 == (off % device->block) );
 	assert( 0 == (len % device->block) );
+	assert( device->size >= (off + len) );
 
+	if (device->memory) {
+		if (device->latency) {
+			ra_sleep(device->latency);
+		}
+		memcpy(device->memory + off, buf, (size_t)len);
+		return 0;
+	}
 	if (len != (uint64_t)pwrite(device->fd,
 				    buf,
 				    (size_t)len,
@@ -166,6 +276,31 @@ ra_device_write(ra_device_t device,
 	return 0;
 }
 
+int
+ra_device_sync(ra_device_t device)
+{
+	assert( device );
+
+	if (device->memory) {
+		return 0;
+	}
+
+#if defined(__APPLE__)
+	/* fsync() alone leaves the data in the drive's cache */
+	if (fcntl(device->fd, F_FULLFSYNC) && fsync(device->fd)) {
+		RA_TRACE("unable to sync device");
+		return -1;
+	}
+#else
+	if (fdatasync(device->fd)) {
+		RA_TRACE("unable to sync device");
+		return -1;
+	}
+#endif /* __APPLE__ */
+
+	return 0;
+}
+
 uint64_t
 ra_device_size(ra_device_t device)
 {
@@ -181,3 +316,98 @@ ra_device_block(ra_device_t device)
 
 	return device->block;
 }
+
+int
+ra_device_fd(ra_device_t device)
+{
+	assert( device );
+
+	return device->memory ? -1 : device->fd;
+}
+
+static int
+roundtrip(ra_device_t device)
+{
+	const int N = 1000;
+	uint64_t block, off, len;
+	char *buf1, *buf2;
+	void *buf_;
+	int i;
+
+	block = ra_device_block(device);
+	len = RA_MIN(8 * block, ra_device_size(device));
+	if (!(buf_ = malloc(2 * len + ra_page()))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	buf1 = ra_align(buf_, ra_page());
+	buf2 = buf1 + len;
+	for (i=0; i<N; ++i) {
+		off = (uint64_t)rand() % (ra_device_size(device) / block);
+		off = RA_MIN(off * block, ra_device_size(device) - len);
+		memset(buf1, rand(), len);
+		if (ra_device_write(device, buf1, off, len) ||
+		    ra_device_read(device, buf2, off, len) ||
+		    memcmp(buf1, buf2, len)) {
+			RA_FREE(buf_);
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
+	}
+	RA_FREE(buf_);
+	return 0;
+}
+
+int
+ra_device_test(void)
+{
+	const uint64_t SIZE = 4 * 1024 * 1024;
+	const char *pathname;
+	ra_device_t device;
+
+	/* memory */
+
+	if (!(device = ra_device_open_memory(SIZE, 512, 0))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if ((SIZE != ra_device_size(device)) ||
+	    (512 != ra_device_block(device)) ||
+	    roundtrip(device) ||
+	    ra_device_sync(device)) {
+		ra_device_close(device);
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	ra_device_close(device);
+
+	/* file, re-created smaller over a larger one */
+
+	if (!(pathname = ra_pathname(".dev")) ||
+	    ra_device_create(pathname, 2 * SIZE) ||
+	    ra_device_create(pathname, SIZE)) {
+		ra_unlink(pathname);
+		RA_FREE(pathname);
+		RA_TRACE("^");
+		return -1;
+	}
+	if (!(device = ra_device_open(pathname))) {
+		ra_unlink(pathname);
+		RA_FREE(pathname);
+		RA_TRACE("^");
+		return -1;
+	}
+	if ((SIZE != ra_device_size(device)) ||
+	    roundtrip(device) ||
+	    ra_device_sync(device)) {
+		ra_device_close(device);
+		ra_unlink(pathname);
+		RA_FREE(pathname);
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	ra_device_close(device);
+	ra_unlink(pathname);
+	RA_FREE(pathname);
+	return 0;
+}
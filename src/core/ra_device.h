@@ -7,8 +7,19 @@
 
 typedef struct ra_device *ra_device_t;
 
+/**
+ * A device is a block device, a regular file (see ra_device_create) or an
+ * in-memory stand-in that injects latency (in microseconds) on every I/O.
+ */
+
 ra_device_t ra_device_open(const char *pathname);
 
+ra_device_t ra_device_open_memory(uint64_t size,
+				  uint64_t block,
+				  uint64_t latency);
+
+int ra_device_create(const char *pathname, uint64_t size);
+
 void ra_device_close(ra_device_t device);
 
 int ra_device_read(ra_device_t device, void *buf, uint64_t off, uint64_t len);
@@ -18,8 +29,25 @@ int ra_device_write(ra_device_t device,
 		    uint64_t off,
 		    uint64_t len);
 
+/**
+ * Makes completed writes durable: with O_DIRECT, writes bypass the page
+ * cache but may still sit in the drive's cache; regular files without
+ * O_DIRECT hold them in the page cache. A no-op for in-memory devices.
+ */
+
+int ra_device_sync(ra_device_t device);
+
 uint64_t ra_device_size(ra_device_t device);
 
 uint64_t ra_device_block(ra_device_t device);
 
+/**
+ * The underlying file descriptor (e.g., for sendfile), or -1 for an
+ * in-memory device.
+ */
+
+int ra_device_fd(ra_device_t device);
+
+int ra_device_test(void);
+
 #endif /* __RA_DEVICE_H__ */
@@ -1,5 +1,6 @@
 /* Copyright (c) Tony Givargis, 2024-2026 */
 
+#include "ra_thread.h"
 #include "ra_ec.h"
 
 static uint8_t G_H[256][16];
@@ -11,6 +12,21 @@ static uint8_t B_L[256][256][16];
 
 #define U64(x) ( (uint64_t)(x) )
 
+/* columns (words) per parallel task, roughly 64 KiB of data */
+
+#define GRAIN(k) ( (uint64_t)RA_MAX(128, 8192 / (k)) )
+
+struct ec {
+	int k;
+	int n;
+	int x;
+	int y;
+	void *buf;
+	uint64_t *p;
+	uint64_t *q;
+	const uint64_t *d;
+};
+
 static uint8_t
 mul(uint8_t a, uint8_t b)
 {
@@ -100,23 +116,21 @@ ra_ec_init(void)
 	}
 }
 
-void
-ra_ec_encode_pq(void *buf, int k, int n)
+static void
+_pq_(void *ctx, uint64_t begin, uint64_t end)
 {
-	uint64_t d, *p, *q;
-	int i, j;
-
-	assert( buf );
-	assert( 0 == (n % 8) );
-	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
-	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n;
+	uint64_t i, d, *p, *q;
+	int j;
 
 	p = RA_EC_P(buf, k, n);
 	q = RA_EC_Q(buf, k, n);
-	memset(p, 0, n);
-	memset(q, 0, n);
+	memset(p + begin, 0, (end - begin) * 8);
+	memset(q + begin, 0, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
-		for (i=0; i<(n/8); ++i) {
+		for (i=begin; i<end; ++i) {
 			d = RA_EC_D(buf, j, n)[i];
 			p[i] ^= d;
 			q[i] ^= ((U64(G_H[j][d >> 60 & 15]) << 56 |
@@ -140,40 +154,70 @@ ra_ec_encode_pq(void *buf, int k, int n)
 }
 
 void
-ra_ec_encode_p(void *buf, int k, int n)
+ra_ec_encode_pq(void *buf, int k, int n)
 {
-	uint64_t *p;
-	int i, j;
+	struct ec ec;
 
 	assert( buf );
 	assert( 0 == (n % 8) );
 	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
 	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
 
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ra_parallel_for(0, n / 8, GRAIN(k), _pq_, &ec);
+}
+
+static void
+_p_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n;
+	uint64_t i, *p;
+	int j;
+
 	p = RA_EC_P(buf, k, n);
-	memset(p, 0, n);
+	memset(p + begin, 0, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
-		for (i=0; i<(n/8); ++i) {
+		for (i=begin; i<end; ++i) {
 			p[i] ^= RA_EC_D(buf, j, n)[i];
 		}
 	}
 }
 
 void
-ra_ec_encode_q(void *buf, int k, int n)
+ra_ec_encode_p(void *buf, int k, int n)
 {
-	uint64_t d, *q;
-	int i, j;
+	struct ec ec;
 
 	assert( buf );
 	assert( 0 == (n % 8) );
 	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
 	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
 
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ra_parallel_for(0, n / 8, GRAIN(k), _p_, &ec);
+}
+
+static void
+_q_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n;
+	uint64_t i, d, *q;
+	int j;
+
 	q = RA_EC_Q(buf, k, n);
-	memset(q, 0, n);
+	memset(q + begin, 0, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
-		for (i=0; i<(n/8); ++i) {
+		for (i=begin; i<end; ++i) {
 			d = RA_EC_D(buf, j, n)[i];
 			q[i] ^= ((U64(G_H[j][d >> 60 & 15]) << 56 |
 				  U64(G_H[j][d >> 52 & 15]) << 48 |
@@ -196,23 +240,37 @@ ra_ec_encode_q(void *buf, int k, int n)
 }
 
 void
-ra_ec_encode_dp(void *buf, int k, int n, int x_)
+ra_ec_encode_q(void *buf, int k, int n)
 {
-	uint64_t *d, *p;
-	int i, j;
+	struct ec ec;
 
 	assert( buf );
 	assert( 0 == (n % 8) );
 	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
 	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
-	assert( (0 <= x_) && (k > x_) );
+
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ra_parallel_for(0, n / 8, GRAIN(k), _q_, &ec);
+}
+
+static void
+_dp_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n, x_ = ec->x;
+	uint64_t i, *d, *p;
+	int j;
 
 	p = RA_EC_P(buf, k, n);
 	d = RA_EC_D(buf, x_, n);
-	memcpy(d, p, n);
+	memcpy(d + begin, p + begin, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
 		if (j != x_) {
-			for (i=0; i<(n/8); ++i) {
+			for (i=begin; i<end; ++i) {
 				d[i] ^= RA_EC_D(buf, j, n)[i];
 			}
 		}
@@ -220,25 +278,39 @@ ra_ec_encode_dp(void *buf, int k, int n, int x_)
 }
 
 void
-ra_ec_encode_dq(void *buf, int k, int n, int x_)
+ra_ec_encode_dp(void *buf, int k, int n, int x_)
 {
-	uint64_t d, *q, *x;
-	int i, j;
+	struct ec ec;
 
 	assert( buf );
 	assert( 0 == (n % 8) );
-	assert( (0 < k) && (256 > k) );
-	assert( (0 < n) && (0 == (n % 8)) );
 	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
 	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
 	assert( (0 <= x_) && (k > x_) );
 
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ec.x = x_;
+	ra_parallel_for(0, n / 8, GRAIN(k), _dp_, &ec);
+}
+
+static void
+_dq_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n, x_ = ec->x;
+	uint64_t i, d, *q, *x;
+	int j;
+
 	q = RA_EC_Q(buf, k, n);
 	x = RA_EC_D(buf, x_, n);
-	memcpy(x, q, n);
+	memcpy(x + begin, q + begin, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
 		if (j != x_) {
-			for (i=0; i<(n/8); ++i) {
+			for (i=begin; i<end; ++i) {
 				d = RA_EC_D(buf, j, n)[i];
 				x[i] ^= ((U64(G_H[j][d >> 60 & 15]) << 56 |
 					  U64(G_H[j][d >> 52 & 15]) << 48 |
@@ -260,7 +332,7 @@ ra_ec_encode_dq(void *buf, int k, int n, int x_)
 		}
 	}
 	x_ = 255 - x_;
-	for (i=0; i<(n/8); ++i) {
+	for (i=begin; i<end; ++i) {
 		d = x[i];
 		x[i] = ((U64(G_H[x_][d >> 60 & 15]) << 56 |
 			 U64(G_H[x_][d >> 52 & 15]) << 48 |
@@ -282,28 +354,44 @@ ra_ec_encode_dq(void *buf, int k, int n, int x_)
 }
 
 void
-ra_ec_encode_dd(void *buf, int k, int n, int x_, int y_)
+ra_ec_encode_dq(void *buf, int k, int n, int x_)
 {
-	uint64_t d, d1, d2, *p, *q, *x, *y;
-	int i, j;
+	struct ec ec;
 
 	assert( buf );
 	assert( 0 == (n % 8) );
+	assert( (0 < k) && (256 > k) );
+	assert( (0 < n) && (0 == (n % 8)) );
 	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
 	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
-	assert( x_ < y_ );
 	assert( (0 <= x_) && (k > x_) );
-	assert( (0 <= y_) && (k > y_) );
+
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ec.x = x_;
+	ra_parallel_for(0, n / 8, GRAIN(k), _dq_, &ec);
+}
+
+static void
+_dd_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	void *buf = ec->buf;
+	int k = ec->k, n = ec->n, x_ = ec->x, y_ = ec->y;
+	uint64_t i, d, d1, d2, *p, *q, *x, *y;
+	int j;
 
 	p = RA_EC_P(buf, k, n);
 	q = RA_EC_Q(buf, k, n);
 	x = RA_EC_D(buf, x_, n);
 	y = RA_EC_D(buf, y_, n);
-	memcpy(x, q, n);
-	memcpy(y, p, n);
+	memcpy(x + begin, q + begin, (end - begin) * 8);
+	memcpy(y + begin, p + begin, (end - begin) * 8);
 	for (j=0; j<k; ++j) {
 		if ((j != x_) && (j != y_)) {
-			for (i=0; i<(n/8); ++i) {
+			for (i=begin; i<end; ++i) {
 				d = RA_EC_D(buf, j, n)[i];
 				y[i] ^= d;
 				x[i] ^= ((U64(G_H[j][d >> 60 & 15]) << 56 |
@@ -325,7 +413,7 @@ ra_ec_encode_dd(void *buf, int k, int n, int x_, int y_)
 			}
 		}
 	}
-	for (i=0; i<(n/8); ++i) {
+	for (i=begin; i<end; ++i) {
 		d1 = x[i];
 		d2 = y[i];
 		x[i] = ((U64(A_H[y_ - x_][d2 >> 60 & 15]) << 56 |
@@ -364,6 +452,77 @@ ra_ec_encode_dd(void *buf, int k, int n, int x_, int y_)
 	}
 }
 
+void
+ra_ec_encode_dd(void *buf, int k, int n, int x_, int y_)
+{
+	struct ec ec;
+
+	assert( buf );
+	assert( 0 == (n % 8) );
+	assert( (RA_EC_MIN_K <= k) && (RA_EC_MAX_K >= k) );
+	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
+	assert( x_ < y_ );
+	assert( (0 <= x_) && (k > x_) );
+	assert( (0 <= y_) && (k > y_) );
+
+	memset(&ec, 0, sizeof (struct ec));
+	ec.buf = buf;
+	ec.k = k;
+	ec.n = n;
+	ec.x = x_;
+	ec.y = y_;
+	ra_parallel_for(0, n / 8, GRAIN(k), _dd_, &ec);
+}
+
+static void
+_delta_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct ec *ec = (const struct ec *)ctx;
+	const uint64_t *d_x = ec->d;
+	uint64_t *p = ec->p, *q = ec->q;
+	uint64_t i, d;
+	int x = ec->x;
+
+	for (i=begin; i<end; ++i) {
+		d = d_x[i];
+		p[i] ^= d;
+		q[i] ^= ((U64(G_H[x][d >> 60 & 15]) << 56 |
+			  U64(G_H[x][d >> 52 & 15]) << 48 |
+			  U64(G_H[x][d >> 44 & 15]) << 40 |
+			  U64(G_H[x][d >> 36 & 15]) << 32 |
+			  U64(G_H[x][d >> 28 & 15]) << 24 |
+			  U64(G_H[x][d >> 20 & 15]) << 16 |
+			  U64(G_H[x][d >> 12 & 15]) <<  8 |
+			  U64(G_H[x][d >>  4 & 15])) ^
+			 (U64(G_L[x][d >> 56 & 15]) << 56 |
+			  U64(G_L[x][d >> 48 & 15]) << 48 |
+			  U64(G_L[x][d >> 40 & 15]) << 40 |
+			  U64(G_L[x][d >> 32 & 15]) << 32 |
+			  U64(G_L[x][d >> 24 & 15]) << 24 |
+			  U64(G_L[x][d >> 16 & 15]) << 16 |
+			  U64(G_L[x][d >>  8 & 15]) <<  8 |
+			  U64(G_L[x][d >>  0 & 15])));
+	}
+}
+
+void
+ra_ec_encode_delta(void *p, void *q, const void *d, int n, int x)
+{
+	struct ec ec;
+
+	assert( p && q && d );
+	assert( 0 == (n % 8) );
+	assert( (RA_EC_MIN_N <= n) && (RA_EC_MAX_N >= n) );
+	assert( (0 <= x) && (RA_EC_MAX_K > x) );
+
+	memset(&ec, 0, sizeof (struct ec));
+	ec.p = (uint64_t *)p;
+	ec.q = (uint64_t *)q;
+	ec.d = (const uint64_t *)d;
+	ec.x = x;
+	ra_parallel_for(0, n / 8, GRAIN(1), _delta_, &ec);
+}
+
 int
 ra_ec_test(void)
 {
@@ -459,6 +618,28 @@ ra_ec_test(void)
 		}
 	}
 
+	/* delta P/Q update */
+
+	for (j=0; j<K; j+=13) {
+		memset(RA_EC_D(buf2, K, N), rand(), N);
+		for (i=0; i<(N/8); ++i) {
+			RA_EC_D(buf1, j, N)[i] ^= RA_EC_D(buf2, K, N)[i];
+		}
+		ra_ec_encode_delta(RA_EC_P(buf1, K, N),
+				   RA_EC_Q(buf1, K, N),
+				   RA_EC_D(buf2, K, N),
+				   N,
+				   j);
+	}
+	memcpy(buf2, buf1, K * N);
+	ra_ec_encode_pq(buf2, K, N);
+	if (memcmp(buf1, buf2, (K + 2) * N)) {
+		RA_FREE(buf1);
+		RA_FREE(buf2);
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+
 	/* sanity check data blocks */
 
 	for (j=0; j<K; ++j) {
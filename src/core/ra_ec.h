@@ -35,6 +35,13 @@ void ra_ec_encode_dq(void *buf, int k, int n, int x);
 
 void ra_ec_encode_dd(void *buf, int k, int n, int x, int y);
 
+/**
+ * P ^= D, Q ^= {02}^x * D, where D is the difference (old ^ new) of data
+ * block x and p, q, d each point to n bytes of the same column range.
+ */
+
+void ra_ec_encode_delta(void *p, void *q, const void *d, int n, int x);
+
 int ra_ec_test(void);
 
 #endif /* __RA_EC_H__ */
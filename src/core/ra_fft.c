@@ -1,9 +1,19 @@
 /* Copyright (c) Tony Givargis, 2024-2026 */
 
+#include "ra_thread.h"
 #include "ra_fft.h"
 
 #define PI 3.14159265358979323846264338327950288
 
+/* points per parallel task */
+
+#define WORK 16384
+
+struct batch {
+	int n;
+	struct ra_fft_complex *signals;
+};
+
 static void
 fft(struct ra_fft_complex *v, struct ra_fft_complex *t, int n)
 {
@@ -84,12 +94,64 @@ ra_fft_inverse(struct ra_fft_complex *signal, int n)
 	}
 }
 
+static void
+_forward_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct batch *batch = (const struct batch *)ctx;
+	uint64_t j;
+
+	for (j=begin; j<end; ++j) {
+		ra_fft_forward(batch->signals + 2 * batch->n * j, batch->n);
+	}
+}
+
+static void
+_inverse_(void *ctx, uint64_t begin, uint64_t end)
+{
+	const struct batch *batch = (const struct batch *)ctx;
+	uint64_t j;
+
+	for (j=begin; j<end; ++j) {
+		ra_fft_inverse(batch->signals + 2 * batch->n * j, batch->n);
+	}
+}
+
+void
+ra_fft_forward_batch(struct ra_fft_complex *signals, int n, int m)
+{
+	struct batch batch;
+
+	assert( signals );
+	assert( n && (0 == (n & (n - 1))) );
+	assert( 0 <= m );
+
+	batch.n = n;
+	batch.signals = signals;
+	ra_parallel_for(0, m, RA_DUP(WORK, n), _forward_, &batch);
+}
+
+void
+ra_fft_inverse_batch(struct ra_fft_complex *signals, int n, int m)
+{
+	struct batch batch;
+
+	assert( signals );
+	assert( n && (0 == (n & (n - 1))) );
+	assert( 0 <= m );
+
+	batch.n = n;
+	batch.signals = signals;
+	ra_parallel_for(0, m, RA_DUP(WORK, n), _inverse_, &batch);
+}
+
 int
 ra_fft_test(void)
 {
 	struct ra_fft_complex signal[8192 * 2];
 	struct ra_fft_complex signal_[8192 * 2];
-	int i, n;
+	struct ra_fft_complex *signals;
+	const int N = 256, M = 64;
+	int i, j, n;
 
 	n = RA_ARRAY_SIZE(signal) / 2;
 	for (i=0; i<n; ++i) {
@@ -106,5 +168,40 @@ ra_fft_test(void)
 			return -1;
 		}
 	}
+
+	/* batch, against the single-signal transform */
+
+	if (!(signals = malloc(2 * N * M * sizeof (signals[0])))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<(2 * N * M); ++i) {
+		signals[i].r = .5 - (rand() / (double)RAND_MAX) * 1.0;
+		signals[i].i = 0.0;
+	}
+	memcpy(signal_, signals + 2 * N * (M - 1), N * sizeof (signal_[0]));
+	ra_fft_forward(signal_, N);
+	ra_fft_forward_batch(signals, N, M);
+	for (i=0; i<N; ++i) {
+		j = 2 * N * (M - 1) + i;
+		if ((1e-6 < fabs(signals[j].r - signal_[i].r)) ||
+		    (1e-6 < fabs(signals[j].i - signal_[i].i))) {
+			RA_FREE(signals);
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
+	}
+	ra_fft_inverse_batch(signals, N, M);
+	ra_fft_inverse(signal_, N);
+	for (i=0; i<N; ++i) {
+		j = 2 * N * (M - 1) + i;
+		if ((1e-6 < fabs(signals[j].r - signal_[i].r)) ||
+		    (1e-6 < fabs(signals[j].i - signal_[i].i))) {
+			RA_FREE(signals);
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
+	}
+	RA_FREE(signals);
 	return 0;
 }
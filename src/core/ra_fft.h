@@ -14,6 +14,16 @@ void ra_fft_forward(struct ra_fft_complex *signal, int n);
 
 void ra_fft_inverse(struct ra_fft_complex *signal, int n);
 
+/**
+ * m independent signals of n points each, transformed in parallel. Like
+ * the single-signal calls, every signal is followed by n points of scratch
+ * space, i.e., signal j starts at signals + 2 * n * j.
+ */
+
+void ra_fft_forward_batch(struct ra_fft_complex *signals, int n, int m);
+
+void ra_fft_inverse_batch(struct ra_fft_complex *signals, int n, int m);
+
 int ra_fft_test(void);
 
 #endif /* __RA_FFT_H__ */
@@ -0,0 +1,862 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif /* __linux__ */
+
+#include "ra_timer.h"
+#include "ra_fiber.h"
+
+#define TICK 1000 /* us, deadline resolution */
+#define STACK (64 * 1024)
+#define STACK_MIN (16 * 1024)
+#define STACKS 256 /* pooled per carrier */
+#define EVENTS 64
+
+struct fiber {
+	int fd;
+	int done;
+	int expired;
+#if !defined(__linux__)
+	int index; /* in waiting */
+	short events;
+#endif /* __linux__ */
+	void *ctx;
+	char *stack;
+	ucontext_t context;
+	ra_thread_fnc_t fnc;
+	struct fiber *link;
+	struct ra_timeout timeout;
+};
+
+struct ra_scheduler {
+	int n;
+	volatile int stop;
+	size_t page;
+	size_t stack;
+	uint64_t next;
+	struct carrier {
+		int pipe[2];
+		int stacks_n;
+#if defined(__linux__)
+		int epfd; /* the pipe, and the fds of parked fibers */
+#else
+		int waiting_n;
+		int waiting_m;
+		struct fiber **waiting;
+		struct pollfd *pollfds;
+#endif /* __linux__ */
+		volatile int live; /* fibers assigned, not finished */
+		char *stacks[STACKS];
+		struct fiber *head; /* ready */
+		struct fiber *tail;
+		struct fiber *inbox; /* under mutex, newest first */
+		struct fiber *current;
+		ra_timer_t timer; /* deadlines of waiting fibers */
+		ucontext_t context;
+		ra_mutex_t mutex;
+		ra_thread_t thread;
+		struct ra_scheduler *scheduler;
+	} *carriers;
+};
+
+static int key_;
+static pthread_key_t carrier_;
+static pthread_once_t once_ = PTHREAD_ONCE_INIT;
+
+static void
+_key_(void)
+{
+	key_ = !pthread_key_create(&carrier_, NULL);
+}
+
+static struct carrier *
+self(void)
+{
+	pthread_once(&once_, _key_);
+	return key_ ? (struct carrier *)pthread_getspecific(carrier_) : NULL;
+}
+
+static char *
+stack_get(struct carrier *carrier)
+{
+	struct ra_scheduler *scheduler;
+	char *stack;
+
+	scheduler = carrier->scheduler;
+	if (carrier->stacks_n) {
+		return carrier->stacks[--carrier->stacks_n];
+	}
+	stack = mmap(NULL,
+		     scheduler->page + scheduler->stack,
+		     PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS,
+		     -1,
+		     0);
+	if (MAP_FAILED == stack) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+
+	/* guard page below the stack */
+
+	if (mprotect(stack, scheduler->page, PROT_NONE)) {
+		munmap(stack, scheduler->page + scheduler->stack);
+		RA_TRACE("system failure detected");
+		return NULL;
+	}
+	return stack;
+}
+
+static void
+stack_put(struct carrier *carrier, char *stack)
+{
+	struct ra_scheduler *scheduler;
+
+	scheduler = carrier->scheduler;
+	if (STACKS > carrier->stacks_n) {
+		carrier->stacks[carrier->stacks_n++] = stack;
+		return;
+	}
+	munmap(stack, scheduler->page + scheduler->stack);
+}
+
+static void
+ready(struct carrier *carrier, struct fiber *fiber)
+{
+	fiber->link = NULL;
+	if (carrier->tail) {
+		carrier->tail->link = fiber;
+	}
+	else {
+		carrier->head = fiber;
+	}
+	carrier->tail = fiber;
+}
+
+static void
+_entry_(void)
+{
+	struct carrier *carrier;
+	struct fiber *fiber;
+
+	carrier = self();
+	fiber = carrier->current;
+	fiber->fnc(fiber->ctx);
+	fiber->done = 1;
+	setcontext(&carrier->context);
+}
+
+static int
+prepare(struct carrier *carrier, struct fiber *fiber)
+{
+	struct ra_scheduler *scheduler;
+
+	scheduler = carrier->scheduler;
+	if (!(fiber->stack = stack_get(carrier))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (getcontext(&fiber->context)) {
+		stack_put(carrier, fiber->stack);
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	fiber->context.uc_stack.ss_sp = fiber->stack + scheduler->page;
+	fiber->context.uc_stack.ss_size = scheduler->stack;
+	fiber->context.uc_link = NULL;
+	makecontext(&fiber->context, _entry_, 0);
+	return 0;
+}
+
+static void
+finish(struct carrier *carrier, struct fiber *fiber)
+{
+	if (fiber->stack) {
+		stack_put(carrier, fiber->stack);
+	}
+	memset(fiber, 0, sizeof (struct fiber));
+	RA_FREE(fiber);
+	__sync_fetch_and_sub(&carrier->live, 1);
+}
+
+static void
+admit(struct carrier *carrier)
+{
+	struct fiber *fiber, *list;
+
+	ra_mutex_lock(carrier->mutex);
+	fiber = carrier->inbox;
+	carrier->inbox = NULL;
+	ra_mutex_unlock(carrier->mutex);
+	list = NULL;
+	while (fiber) {
+		carrier->inbox = fiber->link;
+		fiber->link = list;
+		list = fiber;
+		fiber = carrier->inbox;
+	}
+	while ((fiber = list)) {
+		list = fiber->link;
+		if (prepare(carrier, fiber)) {
+			finish(carrier, fiber);
+			RA_TRACE("^ (ignored)");
+			continue;
+		}
+		ready(carrier, fiber);
+	}
+}
+
+#if defined(__linux__)
+
+/*
+ * A parked fiber's fd is in its carrier's epoll set only while it waits,
+ * so a round costs what is ready, not what is open.
+ */
+
+static int
+watch(struct carrier *carrier, struct fiber *fiber, int write)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof (struct epoll_event));
+	event.events = write ? EPOLLOUT : EPOLLIN;
+	event.data.ptr = fiber;
+	if (epoll_ctl(carrier->epfd, EPOLL_CTL_ADD, fiber->fd, &event)) {
+		return -1; /* e.g., a regular file, or already watched */
+	}
+	return 0;
+}
+
+static void
+unwatch(struct carrier *carrier, struct fiber *fiber)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof (struct epoll_event));
+	epoll_ctl(carrier->epfd, EPOLL_CTL_DEL, fiber->fd, &event);
+	ready(carrier, fiber);
+}
+
+#else
+
+static int
+watch(struct carrier *carrier, struct fiber *fiber, int write)
+{
+	void *p, *q;
+	int m;
+
+	if (carrier->waiting_n == carrier->waiting_m) {
+		m = carrier->waiting_m * 2;
+		p = realloc(carrier->waiting, m * sizeof (carrier->waiting[0]));
+		if (p) {
+			carrier->waiting = p;
+		}
+		q = realloc(carrier->pollfds,
+			    (m + 1) * sizeof (carrier->pollfds[0]));
+		if (q) {
+			carrier->pollfds = q;
+		}
+		if (!p || !q) {
+			return -1;
+		}
+		carrier->waiting_m = m;
+	}
+	fiber->events = write ? POLLOUT : POLLIN;
+	fiber->index = carrier->waiting_n;
+	carrier->waiting[carrier->waiting_n++] = fiber;
+	return 0;
+}
+
+static void
+unwatch(struct carrier *carrier, struct fiber *fiber)
+{
+	struct fiber **waiting;
+
+	waiting = carrier->waiting;
+	waiting[fiber->index] = waiting[--carrier->waiting_n];
+	waiting[fiber->index]->index = fiber->index;
+	ready(carrier, fiber);
+}
+
+#endif /* __linux__ */
+
+static void
+_expire_(void *ctx)
+{
+	struct fiber *fiber;
+
+	fiber = (struct fiber *)ctx;
+	fiber->expired = 1;
+	unwatch(self(), fiber);
+}
+
+static int
+ms(uint64_t deadline)
+{
+	uint64_t now;
+
+	if (!deadline) {
+		return -1; /* forever */
+	}
+	now = ra_time();
+	if (deadline <= now) {
+		return 0;
+	}
+	return (int)RA_MIN((deadline - now + 999) / 1000, 1000000);
+}
+
+#if defined(__linux__)
+
+static void
+poll_(struct carrier *carrier)
+{
+	struct epoll_event events[EVENTS];
+	struct fiber *fiber;
+	char buf[64];
+	int i, n;
+
+	n = epoll_wait(carrier->epfd,
+		       events,
+		       EVENTS,
+		       carrier->head ? 0 : ms(ra_timer_next(carrier->timer)));
+	for (i=0; i<n; ++i) {
+		if (!(fiber = (struct fiber *)events[i].data.ptr)) {
+			while (0 < read(carrier->pipe[0], buf, sizeof (buf)));
+			continue;
+		}
+		ra_timer_cancel(carrier->timer, &fiber->timeout);
+		unwatch(carrier, fiber);
+	}
+
+	/* wake fibers whose deadline passed */
+
+	if (ra_timer_pending(carrier->timer)) {
+		ra_timer_advance(carrier->timer, ra_time());
+	}
+}
+
+#else
+
+static void
+poll_(struct carrier *carrier)
+{
+	struct pollfd *pollfds;
+	struct fiber **waiting;
+	char buf[64];
+	int i, n;
+
+	pollfds = carrier->pollfds;
+	pollfds[0].fd = carrier->pipe[0];
+	pollfds[0].events = POLLIN;
+	pollfds[0].revents = 0;
+	for (i=0; i<carrier->waiting_n; ++i) {
+		pollfds[i + 1].fd = carrier->waiting[i]->fd;
+		pollfds[i + 1].events = carrier->waiting[i]->events;
+		pollfds[i + 1].revents = 0;
+	}
+	n = poll(pollfds,
+		 (nfds_t)(carrier->waiting_n + 1),
+		 carrier->head ? 0 : ms(ra_timer_next(carrier->timer)));
+	if (0 < n) {
+		if (pollfds[0].revents) {
+			while (0 < read(carrier->pipe[0], buf, sizeof (buf)));
+		}
+		waiting = carrier->waiting;
+		for (i=carrier->waiting_n-1; 0<=i; --i) {
+			if (pollfds[i + 1].revents) {
+				ra_timer_cancel(carrier->timer,
+						&waiting[i]->timeout);
+				unwatch(carrier, waiting[i]);
+			}
+		}
+	}
+
+	/* wake fibers whose deadline passed */
+
+	if (ra_timer_pending(carrier->timer)) {
+		ra_timer_advance(carrier->timer, ra_time());
+	}
+}
+
+#endif /* __linux__ */
+
+static void
+_carrier_(void *ctx)
+{
+	struct carrier *carrier;
+	struct fiber *fiber;
+	int n;
+
+	carrier = (struct carrier *)ctx;
+	pthread_setspecific(carrier_, carrier);
+	for (;;) {
+		admit(carrier);
+
+		/* one round over the fibers that are ready now */
+
+		n = 0;
+		for (fiber=carrier->head; fiber; fiber=fiber->link) {
+			++n;
+		}
+		while (n--) {
+			fiber = carrier->head;
+			if (!(carrier->head = fiber->link)) {
+				carrier->tail = NULL;
+			}
+			carrier->current = fiber;
+			swapcontext(&carrier->context, &fiber->context);
+			carrier->current = NULL;
+			if (fiber->done) {
+				finish(carrier, fiber);
+			}
+		}
+		if (carrier->scheduler->stop && !carrier->live) {
+			break;
+		}
+		poll_(carrier);
+	}
+}
+
+static void
+wake(struct carrier *carrier)
+{
+	const char c = 0;
+
+	if (0 > write(carrier->pipe[1], &c, 1)) {
+		/* full pipe: a wakeup is already pending */
+	}
+}
+
+static void
+park(struct carrier *carrier)
+{
+	struct fiber *fiber;
+
+	fiber = carrier->current;
+	swapcontext(&fiber->context, &carrier->context);
+}
+
+ra_scheduler_t
+ra_scheduler_open(int n, size_t stack)
+{
+	struct ra_scheduler *scheduler;
+	struct carrier *carrier;
+#if defined(__linux__)
+	struct epoll_event event;
+#endif /* __linux__ */
+	int i;
+
+	assert( 0 <= n );
+
+	/* initialize */
+
+	if (!self() && !key_) {
+		RA_TRACE("system failure detected");
+		return NULL;
+	}
+	if (!(scheduler = malloc(sizeof (struct ra_scheduler)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(scheduler, 0, sizeof (struct ra_scheduler));
+	scheduler->n = n ? n : ra_cores();
+	scheduler->page = ra_page();
+	scheduler->stack = RA_MAX(STACK_MIN, stack ? stack : STACK);
+	scheduler->stack = RA_DUP(scheduler->stack, scheduler->page);
+	scheduler->stack *= scheduler->page;
+	if (!(scheduler->carriers = malloc(scheduler->n *
+					   sizeof (struct carrier)))) {
+		ra_scheduler_close(scheduler);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(scheduler->carriers, 0, scheduler->n * sizeof (struct carrier));
+	for (i=0; i<scheduler->n; ++i) {
+		carrier = &scheduler->carriers[i];
+		carrier->pipe[0] = carrier->pipe[1] = -1;
+#if defined(__linux__)
+		carrier->epfd = -1;
+#endif /* __linux__ */
+		carrier->scheduler = scheduler;
+	}
+	for (i=0; i<scheduler->n; ++i) {
+		carrier = &scheduler->carriers[i];
+		if (pipe(carrier->pipe) ||
+		    (0 > fcntl(carrier->pipe[0], F_SETFL, O_NONBLOCK)) ||
+		    (0 > fcntl(carrier->pipe[1], F_SETFL, O_NONBLOCK))) {
+			ra_scheduler_close(scheduler);
+			RA_TRACE("system failure detected");
+			return NULL;
+		}
+#if defined(__linux__)
+		memset(&event, 0, sizeof (struct epoll_event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL; /* the pipe */
+		if ((0 > (carrier->epfd = epoll_create1(0))) ||
+		    epoll_ctl(carrier->epfd,
+			      EPOLL_CTL_ADD,
+			      carrier->pipe[0],
+			      &event)) {
+			ra_scheduler_close(scheduler);
+			RA_TRACE("system failure detected");
+			return NULL;
+		}
+#else
+		carrier->waiting_m = 64;
+		if (!(carrier->waiting = malloc(carrier->waiting_m *
+						sizeof (struct fiber *))) ||
+		    !(carrier->pollfds = malloc((carrier->waiting_m + 1) *
+						sizeof (struct pollfd)))) {
+			ra_scheduler_close(scheduler);
+			RA_TRACE("out of memory");
+			return NULL;
+		}
+#endif /* __linux__ */
+		if (!(carrier->mutex = ra_mutex_open()) ||
+		    !(carrier->timer = ra_timer_open(TICK))) {
+			ra_scheduler_close(scheduler);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+
+	/* start */
+
+	for (i=0; i<scheduler->n; ++i) {
+		carrier = &scheduler->carriers[i];
+		if (!(carrier->thread = ra_thread_open(_carrier_, carrier))) {
+			ra_scheduler_close(scheduler);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+	return scheduler;
+}
+
+void
+ra_scheduler_close(ra_scheduler_t scheduler)
+{
+	struct carrier *carrier;
+	int i;
+
+	if (scheduler) {
+		scheduler->stop = 1;
+		__sync_synchronize();
+		for (i=0; scheduler->carriers && (i<scheduler->n); ++i) {
+			carrier = &scheduler->carriers[i];
+			if (0 <= carrier->pipe[1]) {
+				wake(carrier);
+			}
+		}
+		for (i=0; scheduler->carriers && (i<scheduler->n); ++i) {
+			carrier = &scheduler->carriers[i];
+			ra_thread_close(carrier->thread);
+			while (carrier->stacks_n) {
+				munmap(carrier->stacks[--carrier->stacks_n],
+				       scheduler->page + scheduler->stack);
+			}
+			if (0 <= carrier->pipe[0]) {
+				close(carrier->pipe[0]);
+				close(carrier->pipe[1]);
+			}
+			ra_mutex_close(carrier->mutex);
+			ra_timer_close(carrier->timer);
+#if defined(__linux__)
+			if (0 <= carrier->epfd) {
+				close(carrier->epfd);
+			}
+#else
+			RA_FREE(carrier->waiting);
+			RA_FREE(carrier->pollfds);
+#endif /* __linux__ */
+		}
+		RA_FREE(scheduler->carriers);
+		memset(scheduler, 0, sizeof (struct ra_scheduler));
+		RA_FREE(scheduler);
+	}
+}
+
+int
+ra_fiber_spawn(ra_scheduler_t scheduler, ra_thread_fnc_t fnc, void *ctx)
+{
+	struct carrier *carrier;
+	struct fiber *fiber;
+	uint64_t i;
+
+	assert( scheduler && fnc );
+
+	if (!(fiber = malloc(sizeof (struct fiber)))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(fiber, 0, sizeof (struct fiber));
+	fiber->fnc = fnc;
+	fiber->ctx = ctx;
+	i = __sync_fetch_and_add(&scheduler->next, 1);
+	carrier = &scheduler->carriers[i % (uint64_t)scheduler->n];
+	__sync_fetch_and_add(&carrier->live, 1);
+	ra_mutex_lock(carrier->mutex);
+	fiber->link = carrier->inbox;
+	carrier->inbox = fiber;
+	ra_mutex_unlock(carrier->mutex);
+	if (carrier != self()) {
+		wake(carrier);
+	}
+	return 0;
+}
+
+int
+ra_fiber_wait(int fd, int write)
+{
+	return ra_fiber_wait_until(fd, write, 0);
+}
+
+int
+ra_fiber_wait_until(int fd, int write, uint64_t deadline)
+{
+	struct carrier *carrier;
+	struct pollfd pollfd;
+	struct fiber *fiber;
+	int r;
+
+	assert( 0 <= fd );
+
+	/* plain thread: block */
+
+	if (!(carrier = self()) || !carrier->current) {
+		pollfd.fd = fd;
+		pollfd.events = write ? POLLOUT : POLLIN;
+		do {
+			pollfd.revents = 0;
+			r = poll(&pollfd, 1, ms(deadline));
+			if ((0 > r) && (EINTR != errno)) {
+				RA_TRACE("system failure detected");
+				return -1;
+			}
+		} while ((0 > r) || (!r && (ra_time() < deadline)));
+		if (!r) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		return 0;
+	}
+
+	/* fiber: park until the carrier reports fd or time runs out */
+
+	fiber = carrier->current;
+	fiber->fd = fd;
+	if (watch(carrier, fiber, write)) {
+		ready(carrier, fiber); /* retry on the next round */
+		park(carrier);
+		return 0;
+	}
+	if (deadline) {
+		ra_timer_schedule(carrier->timer,
+				  &fiber->timeout,
+				  deadline,
+				  _expire_,
+				  fiber);
+	}
+	park(carrier);
+	if (fiber->expired) {
+		fiber->expired = 0;
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+void
+ra_fiber_yield(void)
+{
+	struct carrier *carrier;
+
+	if (!(carrier = self()) || !carrier->current) {
+		sched_yield();
+		return;
+	}
+	ready(carrier, carrier->current);
+	park(carrier);
+}
+
+int /* BOOL */
+ra_fiber_active(void)
+{
+	struct carrier *carrier;
+
+	return (carrier = self()) && carrier->current;
+}
+
+struct pair {
+	int fd[2];
+	int ok;
+	uint64_t *count;
+};
+
+static void
+_reader_(void *ctx)
+{
+	struct pair *pair;
+	char buf[100];
+	size_t n;
+	ssize_t r;
+	int i;
+
+	pair = (struct pair *)ctx;
+	for (i=0; i<100; ++i) {
+		n = 0;
+		while (n < sizeof (buf)) {
+			r = read(pair->fd[0], buf + n, sizeof (buf) - n);
+			if (0 > r) {
+				if (EAGAIN != errno) {
+					return;
+				}
+				ra_fiber_wait(pair->fd[0], 0);
+				continue;
+			}
+			n += (size_t)r;
+		}
+		if ((buf[0] != (char)i) || (buf[99] != (char)i)) {
+			return;
+		}
+	}
+	pair->ok = 1;
+}
+
+static void
+_writer_(void *ctx)
+{
+	struct pair *pair;
+	char buf[100];
+	int i;
+
+	pair = (struct pair *)ctx;
+	for (i=0; i<100; ++i) {
+		memset(buf, i, sizeof (buf));
+		while (0 > write(pair->fd[1], buf, sizeof (buf))) {
+			if (EAGAIN != errno) {
+				return;
+			}
+			ra_fiber_wait(pair->fd[1], 1);
+		}
+		if (!(i % 10)) {
+			ra_fiber_yield();
+		}
+	}
+}
+
+static void
+_late_(void *ctx)
+{
+	struct pair *pair;
+
+	pair = (struct pair *)ctx;
+	if (ra_fiber_wait_until(pair->fd[0], 0, ra_time() + 20000) &&
+	    (ETIMEDOUT == errno)) {
+		pair->ok = 1;
+	}
+}
+
+static void
+_count_(void *ctx)
+{
+	int i;
+
+	for (i=0; i<10; ++i) {
+		__sync_fetch_and_add((uint64_t *)ctx, 1);
+		ra_fiber_yield();
+	}
+}
+
+int
+ra_fiber_test(void)
+{
+	const int N = 200, M = 5000;
+	ra_scheduler_t scheduler;
+	struct pair *pairs, late;
+	uint64_t count;
+	int i, e;
+
+	/* initialize */
+
+	e = 0;
+	count = 0;
+	if (!(pairs = malloc(N * sizeof (pairs[0])))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(pairs, 0, N * sizeof (pairs[0]));
+	memset(&late, 0, sizeof (late));
+	if (pipe(late.fd)) {
+		late.fd[0] = late.fd[1] = -1;
+		e = -1;
+	}
+	for (i=0; i<N; ++i) {
+		pairs[i].fd[0] = pairs[i].fd[1] = -1;
+		if (pipe(pairs[i].fd) ||
+		    (0 > fcntl(pairs[i].fd[0], F_SETFL, O_NONBLOCK)) ||
+		    (0 > fcntl(pairs[i].fd[1], F_SETFL, O_NONBLOCK))) {
+			e = -1;
+		}
+	}
+	if (e || !(scheduler = ra_scheduler_open(2, 0))) {
+		e = -1;
+		scheduler = NULL;
+	}
+
+	/* blocking-style pipe I/O, yields, a deadline, many short fibers */
+
+	if (!e && ra_fiber_spawn(scheduler, _late_, &late)) {
+		e = -1;
+	}
+	for (i=0; !e && (i<N); ++i) {
+		if (ra_fiber_spawn(scheduler, _reader_, &pairs[i]) ||
+		    ra_fiber_spawn(scheduler, _writer_, &pairs[i])) {
+			e = -1;
+		}
+	}
+	for (i=0; !e && (i<M); ++i) {
+		if (ra_fiber_spawn(scheduler, _count_, &count)) {
+			e = -1;
+		}
+	}
+	ra_scheduler_close(scheduler);
+	if (!late.ok) {
+		e = -1;
+	}
+	if (0 <= late.fd[0]) {
+		late.ok = 0;
+		_late_(&late); /* outside of a fiber */
+		close(late.fd[0]);
+		close(late.fd[1]);
+	}
+	if (!late.ok) {
+		e = -1;
+	}
+	for (i=0; i<N; ++i) {
+		if (!pairs[i].ok) {
+			e = -1;
+		}
+		if (0 <= pairs[i].fd[0]) {
+			close(pairs[i].fd[0]);
+			close(pairs[i].fd[1]);
+		}
+	}
+	RA_FREE(pairs);
+	if (e || ((uint64_t)M * 10 != count)) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_FIBER_H__
+#define __RA_FIBER_H__
+
+#include "ra_thread.h"
+
+typedef struct ra_scheduler *ra_scheduler_t;
+
+/**
+ * User-space fibers multiplexed over n carrier threads (0: ra_cores()).
+ * Each fiber runs on its own pooled stack of stack bytes (0: 64 KiB) and
+ * stays on the carrier it was spawned on. A fiber blocks only itself:
+ * ra_fiber_wait() parks it until fd is readable (or writable) while the
+ * carrier runs other fibers; on Linux, each carrier watches the fds of its
+ * parked fibers with epoll, so only fibers whose fd is ready are resumed.
+ * A wait epoll cannot watch (a regular file, or an fd another fiber of
+ * the carrier already waits on) yields instead. ra_scheduler_close()
+ * returns once all fibers have finished.
+ *
+ * ra_fiber_wait() and ra_fiber_yield() also work outside of a fiber, where
+ * they block or yield the calling thread.
+ *
+ * ra_fiber_wait_until() gives up at deadline (ra_time() microseconds, 0:
+ * never), failing with errno ETIMEDOUT.
+ */
+
+ra_scheduler_t ra_scheduler_open(int n, size_t stack);
+
+void ra_scheduler_close(ra_scheduler_t scheduler);
+
+int ra_fiber_spawn(ra_scheduler_t scheduler, ra_thread_fnc_t fnc, void *ctx);
+
+int ra_fiber_wait(int fd, int write);
+
+int ra_fiber_wait_until(int fd, int write, uint64_t deadline);
+
+void ra_fiber_yield(void);
+
+int /* BOOL */ ra_fiber_active(void);
+
+int ra_fiber_test(void);
+
+#endif /* __RA_FIBER_H__ */
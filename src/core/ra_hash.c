@@ -3,6 +3,19 @@
 #include "ra_hash.h"
 
 #define ROT64(x, y) ( ((x) << (y)) | ((x) >> (64 - (y))) )
+#define X0 865713035574157
+#define Y0 593570735219531
+#define LANES 8
+#define STRIPE (LANES * 8)
+#define BATCH 8 /* keys in flight */
+#define CHUNK 256 /* keys bucketed at a time */
+#define SHORT 64 /* longest key bucketed by length */
+#define STEPS (SHORT / 8 + 1)
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define AVX2
+typedef uint64_t v4_t __attribute__ ((vector_size (32)));
+#endif
 
 static void
 shuffle(uint64_t *x, uint64_t *y, uint64_t z)
@@ -15,21 +28,19 @@ shuffle(uint64_t *x, uint64_t *y, uint64_t z)
 	(*x) = ROT64(*x, 34) ^ z; (*y) += (*x);
 }
 
-uint64_t
-ra_hash(const void *buf_, size_t len)
+/*
+ * Continues a chain over len more bytes of a stream that is total bytes
+ * long in all and returns its digest.
+ */
+
+static uint64_t
+finish(uint64_t x, uint64_t y, const char *buf, size_t len, size_t total)
 {
-	const char *buf = (const char *)buf_;
-	uint64_t x, y, z;
+	uint64_t z;
 	size_t i, q, r;
 
-	assert( !len || buf );
-
-	/* initialize */
-
 	q = len / 8;
 	r = len % 8;
-	x = 865713035574157;
-	y = 593570735219531;
 
 	/* q's */
 
@@ -49,39 +60,593 @@ ra_hash(const void *buf_, size_t len)
 
 	/* finalize */
 
-	shuffle(&x, &y, (uint64_t)len);
+	shuffle(&x, &y, (uint64_t)total);
 	return x + y;
 }
 
+uint64_t
+ra_hash(const void *buf, size_t len)
+{
+	assert( !len || buf );
+
+	return finish(X0, Y0, (const char *)buf, len, len);
+}
+
+/*
+ * BATCH keys of q words each, in lockstep: independent chains overlap
+ * in the pipeline (or in vector registers).
+ */
+
+static void
+fixed(const char * const *keys, uint64_t *out, size_t q)
+{
+	uint64_t x[BATCH], y[BATCH], z;
+	size_t i;
+	int j;
+
+	for (j=0; j<BATCH; ++j) {
+		x[j] = X0;
+		y[j] = Y0;
+	}
+	for (i=0; i<q; ++i) {
+		for (j=0; j<BATCH; ++j) {
+			memcpy(&z, keys[j] + i * 8, 8);
+			shuffle(&x[j], &y[j], z);
+		}
+	}
+	for (j=0; j<BATCH; ++j) {
+		shuffle(&x[j], &y[j], (uint64_t)(q * 8));
+		out[j] = x[j] + y[j];
+	}
+}
+
+/* the r (1 to 7) bytes at p as a word, without a variable-length copy */
+
+static uint64_t
+tail(const char *p, size_t r)
+{
+	uint32_t lo, hi;
+	uint64_t z;
+
+	if (4 <= r) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + r - 4, 4);
+		return (uint64_t)lo | ((uint64_t)hi << ((r - 4) * 8));
+	}
+	z = (uint8_t)p[0];
+	z |= (uint64_t)(uint8_t)p[r / 2] << (r / 2 * 8);
+	z |= (uint64_t)(uint8_t)p[r - 1] << ((r - 1) * 8);
+	return z;
+}
+
+/* the last, possibly partial, word of a key of len (at least 1) bytes */
+
+static uint64_t
+last(const char *p, size_t len)
+{
+	uint64_t z;
+
+	if (8 <= len) {
+		memcpy(&z, p + len - 8, 8);
+		return z >> ((8 - len % 8) % 8 * 8);
+	}
+	return tail(p, len);
+}
+
+/*
+ * Up to BATCH keys (keys[idx[j]]) taking the same s steps of finish(),
+ * i.e., the same number of words, in lockstep: independent chains overlap
+ * in the pipeline.
+ */
+
+static void
+lockstep(const char * const *keys,
+	 const size_t *lens,
+	 const uint16_t *idx,
+	 int m,
+	 size_t s,
+	 uint64_t *out)
+{
+	uint64_t x[BATCH], y[BATCH], z;
+	size_t i;
+	int j;
+
+	for (j=0; j<m; ++j) {
+		x[j] = X0;
+		y[j] = Y0;
+	}
+	for (i=0; (i + 2)<s; ++i) {
+		for (j=0; j<m; ++j) {
+			memcpy(&z, keys[idx[j]] + i * 8, 8);
+			shuffle(&x[j], &y[j], z);
+		}
+	}
+	if (2 <= s) {
+		for (j=0; j<m; ++j) {
+			z = last(keys[idx[j]], lens[idx[j]]);
+			shuffle(&x[j], &y[j], z);
+		}
+	}
+	for (j=0; j<m; ++j) {
+		shuffle(&x[j], &y[j], (uint64_t)lens[idx[j]]);
+		out[idx[j]] = x[j] + y[j];
+	}
+}
+
+/* up to BATCH long keys in lockstep over their common whole words */
+
+static void
+mixed(const char * const *keys,
+      const size_t *lens,
+      const uint16_t *idx,
+      int m,
+      uint64_t *out)
+{
+	uint64_t x[BATCH], y[BATCH], z;
+	size_t i, q, len;
+	int j;
+
+	q = lens[idx[0]] / 8;
+	for (j=0; j<m; ++j) {
+		x[j] = X0;
+		y[j] = Y0;
+		q = RA_MIN(q, lens[idx[j]] / 8);
+	}
+	for (i=0; i<q; ++i) {
+		for (j=0; j<m; ++j) {
+			memcpy(&z, keys[idx[j]] + i * 8, 8);
+			shuffle(&x[j], &y[j], z);
+		}
+	}
+	for (j=0; j<m; ++j) {
+		len = lens[idx[j]];
+		out[idx[j]] = finish(x[j],
+				     y[j],
+				     keys[idx[j]] + q * 8,
+				     len - q * 8,
+				     len);
+	}
+}
+
+/*
+ * Keys are bucketed, CHUNK at a time, by their number of words so that
+ * every lockstep group runs each of its lanes to the end, with no lane
+ * idle; longer keys than SHORT share only their common words.
+ */
+
+void
+ra_hash_batch(const void * const *keys_,
+	      const size_t *lens,
+	      uint64_t *out,
+	      size_t n)
+{
+	const char * const *keys = (const char * const *)keys_;
+	uint16_t idx[STEPS + 1][CHUNK];
+	int counts[STEPS + 1], j, k;
+	size_t i, m, s, len;
+
+	assert( !n || (keys && lens && out) );
+
+	for (i=0; i<n; i+=m) {
+		m = RA_MIN(n - i, CHUNK);
+
+		/* whole groups of 8, 16 or 32 byte keys */
+
+		len = lens[i];
+		for (j=1; (j<(int)m) && (lens[i + j] == len); ++j);
+		if ((0 == m % BATCH) && ((int)m == j) &&
+		    ((8 == len) || (16 == len) || (32 == len))) {
+			for (j=0; j<(int)m; j+=BATCH) {
+				switch (len) {
+				case 8:
+					fixed(keys + i + j, out + i + j, 1);
+					break;
+				case 16:
+					fixed(keys + i + j, out + i + j, 2);
+					break;
+				default:
+					fixed(keys + i + j, out + i + j, 4);
+					break;
+				}
+			}
+			continue;
+		}
+
+		/* the rest by word count */
+
+		memset(counts, 0, sizeof (counts));
+		for (j=0; j<(int)m; ++j) {
+			s = 0;
+			if (SHORT >= lens[i + j]) {
+				s = RA_DUP(lens[i + j], 8) + 1;
+			}
+			idx[s][counts[s]++] = (uint16_t)j;
+		}
+		for (j=0; j<counts[0]; j+=BATCH) {
+			k = RA_MIN(counts[0] - j, BATCH);
+			mixed(keys + i, lens + i, idx[0] + j, k, out + i);
+		}
+		for (s=1; s<=STEPS; ++s) {
+			for (j=0; j<counts[s]; j+=BATCH) {
+				k = RA_MIN(counts[s] - j, BATCH);
+				lockstep(keys + i,
+					 lens + i,
+					 idx[s] + j,
+					 k,
+					 s,
+					 out + i);
+			}
+		}
+	}
+}
+
+void
+ra_hash_init(struct ra_hash_state *state)
+{
+	assert( state );
+
+	memset(state, 0, sizeof (struct ra_hash_state));
+	state->x = X0;
+	state->y = Y0;
+}
+
+void
+ra_hash_update(struct ra_hash_state *state, const void *buf_, size_t len)
+{
+	const char *buf = (const char *)buf_;
+	uint64_t z;
+	size_t k;
+
+	assert( state );
+	assert( !len || buf );
+
+	state->len += len;
+
+	/* complete a partial word */
+
+	if (state->n) {
+		k = RA_MIN(len, 8 - state->n);
+		memcpy(state->tail + state->n, buf, k);
+		state->n += k;
+		buf += k;
+		len -= k;
+		if (8 > state->n) {
+			return;
+		}
+		memcpy(&z, state->tail, 8);
+		shuffle(&state->x, &state->y, z);
+		state->n = 0;
+	}
+
+	/* whole words, straight from buf */
+
+	while (8 <= len) {
+		memcpy(&z, buf, 8);
+		shuffle(&state->x, &state->y, z);
+		buf += 8;
+		len -= 8;
+	}
+	memcpy(state->tail, buf, len);
+	state->n = len;
+}
+
+uint64_t
+ra_hash_final(struct ra_hash_state *state)
+{
+	uint64_t z;
+
+	assert( state );
+
+	if (state->n) {
+		z = 0;
+		memcpy(&z, state->tail, state->n);
+		shuffle(&state->x, &state->y, z);
+	}
+	shuffle(&state->x, &state->y, state->len);
+	return state->x + state->y;
+}
+
+static void
+stripes(uint64_t *x, uint64_t *y, const char *buf, size_t n)
+{
+	uint64_t z;
+	size_t i;
+	int j;
+
+	for (i=0; i<n; ++i) {
+		for (j=0; j<LANES; ++j) {
+			memcpy(&z, buf + j * 8, 8);
+			shuffle(&x[j], &y[j], z);
+		}
+		buf += STRIPE;
+	}
+}
+
+#ifdef AVX2
+
+#define VROT64(x, y) ( ((x) << (y)) | ((x) >> (64 - (y))) )
+
+/* stripes() with lanes 0-3 and 4-7 in two vectors */
+
+__attribute__ ((target ("avx2"))) static void
+stripes_avx2(uint64_t *x_, uint64_t *y_, const char *buf, size_t n)
+{
+	const v4_t k = {
+		11400714819323198485UL,
+		11400714819323198485UL,
+		11400714819323198485UL,
+		11400714819323198485UL
+	};
+	v4_t x[2], y[2], z;
+	size_t i;
+	int j;
+
+	memcpy(x, x_, sizeof (x));
+	memcpy(y, y_, sizeof (y));
+	for (i=0; i<n; ++i) {
+		for (j=0; j<2; ++j) {
+			memcpy(&z, buf + j * 32, 32);
+			x[j] *= k;
+			x[j] = VROT64(x[j], 14) ^ z; y[j] += x[j];
+			x[j] = VROT64(x[j], 25) ^ z; y[j] += x[j];
+			x[j] = VROT64(x[j], 21) ^ z; y[j] += x[j];
+			x[j] = VROT64(x[j], 61) ^ z; y[j] += x[j];
+			x[j] = VROT64(x[j], 34) ^ z; y[j] += x[j];
+		}
+		buf += STRIPE;
+	}
+	memcpy(x_, x, sizeof (x));
+	memcpy(y_, y, sizeof (y));
+}
+
+#endif /* AVX2 */
+
+static uint64_t
+wide(const void *buf_, size_t len, int /* BOOL */ simd)
+{
+	const char *buf = (const char *)buf_;
+	uint64_t x[LANES], y[LANES], z;
+	size_t i, q;
+	int j;
+
+	assert( !len || buf );
+
+	/* initialize */
+
+	for (j=0; j<LANES; ++j) {
+		x[j] = X0 + (uint64_t)j;
+		y[j] = Y0;
+	}
+
+	/* stripes */
+
+	q = len / STRIPE;
+#ifdef AVX2
+	if (simd && __builtin_cpu_supports("avx2")) {
+		stripes_avx2(x, y, buf, q);
+	}
+	else {
+		stripes(x, y, buf, q);
+	}
+#else
+	(void)simd;
+	stripes(x, y, buf, q);
+#endif /* AVX2 */
+	buf += q * STRIPE;
+
+	/* fold lanes, then the tail as ra_hash() would */
+
+	for (j=1; j<LANES; ++j) {
+		shuffle(&x[0], &y[0], x[j] + y[j]);
+	}
+	q = (len % STRIPE) / 8;
+	for (i=0; i<q; ++i) {
+		memcpy(&z, buf, 8);
+		shuffle(&x[0], &y[0], z);
+		buf += 8;
+	}
+	if (len % 8) {
+		z = 0;
+		memcpy(&z, buf, len % 8);
+		shuffle(&x[0], &y[0], z);
+	}
+	shuffle(&x[0], &y[0], (uint64_t)len);
+	return x[0] + y[0];
+}
+
+uint64_t
+ra_hash_wide(const void *buf, size_t len)
+{
+	return wide(buf, len, 1);
+}
+
 int
 ra_hash_test(void)
 {
 	const int N = 100000;
-	double stats[64];
-	char buf[128];
+	const void *keys[100];
+	struct ra_hash_state state;
+	uint64_t outs[100];
+	size_t lens[100];
+	double stats[64], wides[64];
+	char buf[128], big[1024];
 	uint64_t hash;
-	size_t len;
+	size_t len, k, n;
 	int i, j;
 
 	memset(stats, 0, sizeof (stats));
+	memset(wides, 0, sizeof (wides));
+	for (i=0; i<(int)RA_ARRAY_SIZE(big); ++i) {
+		big[i] = (char)rand();
+	}
 	for (i=0; i<N; ++i) {
 		for (j=0; j<(int)RA_ARRAY_SIZE(buf); ++j) {
 			buf[j] = (char)rand();
 		}
 		len = rand() % (sizeof (buf));
 		hash = ra_hash(buf, len);
+
+		/* the same bytes in random pieces */
+
+		ra_hash_init(&state);
+		for (k=0; k<len; k+=n) {
+			n = (size_t)(rand() % 20);
+			n = RA_MIN(len - k, n);
+			ra_hash_update(&state, buf + k, n);
+		}
+		if (hash != ra_hash_final(&state)) {
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
 		for (j=0; j<64; ++j) {
 			if (hash & ((uint64_t)1 << j)) {
 				stats[j] += 1.0;
 			}
 		}
+
+		/* wide: scalar and vector lanes agree */
+
+		big[rand() % sizeof (big)] = (char)rand();
+		len = rand() % (sizeof (big));
+		hash = ra_hash_wide(big, len);
+		if (hash != wide(big, len, 0)) {
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
+		for (j=0; j<64; ++j) {
+			if (hash & ((uint64_t)1 << j)) {
+				wides[j] += 1.0;
+			}
+		}
 	}
 	for (i=0; i<64; ++i) {
 		stats[i] /= N;
-		if ((0.55 < stats[i]) || (0.45 > stats[i])) {
+		wides[i] /= N;
+		if ((0.55 < stats[i]) || (0.45 > stats[i]) ||
+		    (0.55 < wides[i]) || (0.45 > wides[i])) {
 			RA_TRACE("integrity failure detected");
 			return -1;
 		}
 	}
+
+	/* batches: fixed-length groups, mixed lengths, a partial group */
+
+	for (i=0; i<1000; ++i) {
+		for (j=0; j<(int)RA_ARRAY_SIZE(keys); ++j) {
+			lens[j] = (i % 2) ? (size_t)(8 << (j / 8 % 3)) :
+				(size_t)(rand() % 100);
+			keys[j] = big + rand() % (sizeof (big) - 100);
+		}
+		ra_hash_batch(keys, lens, outs, (size_t)(i % 101));
+		for (j=0; j<i%101; ++j) {
+			if (outs[j] != ra_hash(keys[j], lens[j])) {
+				RA_TRACE("integrity failure detected");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+keys(const char *buf, size_t len, size_t size)
+{
+	const size_t N = 1000000;
+	const void **keys;
+	uint64_t t[2], *outs;
+	size_t *lens, i;
+	char label[8];
+
+	keys = malloc(N * sizeof (keys[0]));
+	lens = malloc(N * sizeof (lens[0]));
+	outs = malloc(N * sizeof (outs[0]));
+	if (!keys || !lens || !outs) {
+		RA_FREE(keys);
+		RA_FREE(lens);
+		RA_FREE(outs);
+		RA_TRACE("out of memory");
+		return -1;
+	}
+
+	/* cache-resident keys, size 0: 1 to 32 bytes at random */
+
+	for (i=0; i<N; ++i) {
+		lens[i] = size ? size : (size_t)(1 + rand() % 32);
+		keys[i] = buf + (size_t)rand() % (RA_MIN(len, 65536) - 32);
+	}
+	ra_sprintf(label, sizeof (label), "%4u", (unsigned)size);
+	memset(outs, 0, N * sizeof (outs[0]));
+	t[0] = ra_time();
+	for (i=0; i<N; ++i) {
+		outs[i] = ra_hash(keys[i], lens[i]);
+	}
+	t[0] = ra_time() - t[0];
+	t[1] = ra_time();
+	ra_hash_batch(keys, lens, outs, N);
+	t[1] = ra_time() - t[1];
+	ra_printf(RA_COLOR_GRAY,
+		  "hash %s B keys: ra_hash %6.1f  ra_hash_batch %6.1f"
+		  " Mkeys/s\n",
+		  size ? label : "1-32",
+		  (double)N / RA_MAX(1, t[0]),
+		  (double)N / RA_MAX(1, t[1]));
+	RA_FREE(keys);
+	RA_FREE(lens);
+	RA_FREE(outs);
+	return 0;
+}
+
+int
+ra_hash_bench(void)
+{
+	const size_t KEYS[] = { 8, 16, 32, 0 };
+	const size_t LEN = 16 * 1024 * 1024;
+	const int R = 10;
+	uint64_t t[3], hash;
+	char *buf;
+	size_t i;
+	int r;
+
+	if (!(buf = malloc(LEN))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<LEN; ++i) {
+		buf[i] = (char)i;
+	}
+	hash = 0;
+	t[0] = ra_time();
+	for (r=0; r<R; ++r) {
+		buf[r] ^= 1; /* not loop-invariant */
+		hash += ra_hash(buf, LEN);
+	}
+	t[0] = ra_time() - t[0];
+	t[1] = ra_time();
+	for (r=0; r<R; ++r) {
+		buf[r] ^= 1; /* not loop-invariant */
+		hash += wide(buf, LEN, 0);
+	}
+	t[1] = ra_time() - t[1];
+	t[2] = ra_time();
+	for (r=0; r<R; ++r) {
+		buf[r] ^= 1; /* not loop-invariant */
+		hash += ra_hash_wide(buf, LEN);
+	}
+	t[2] = ra_time() - t[2];
+	ra_printf(RA_COLOR_GRAY,
+		  "hash 16 MiB: serial %6.2f  wide scalar %6.2f  wide %6.2f"
+		  " GB/s (%x)\n",
+		  (double)R * LEN / 1e3 / RA_MAX(1, t[0]),
+		  (double)R * LEN / 1e3 / RA_MAX(1, t[1]),
+		  (double)R * LEN / 1e3 / RA_MAX(1, t[2]),
+		  (unsigned)(hash & 0xf));
+	for (i=0; i<RA_ARRAY_SIZE(KEYS); ++i) {
+		if (keys(buf, LEN, KEYS[i])) {
+			RA_FREE(buf);
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	RA_FREE(buf);
 	return 0;
 }
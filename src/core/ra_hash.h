@@ -7,6 +7,50 @@
 
 uint64_t ra_hash(const void *buf, size_t len);
 
+/**
+ * Incremental ra_hash(): any split of the same byte stream over
+ * ra_hash_update() calls yields the ra_hash() of the whole. The state is
+ * the caller's; nothing is allocated or copied beyond a partial word.
+ */
+
+struct ra_hash_state {
+	uint64_t x;
+	uint64_t y;
+	uint64_t len;
+	size_t n; /* bytes in tail */
+	char tail[8];
+};
+
+void ra_hash_init(struct ra_hash_state *state);
+
+void ra_hash_update(struct ra_hash_state *state, const void *buf, size_t len);
+
+uint64_t ra_hash_final(struct ra_hash_state *state);
+
+/**
+ * Throughput variant for large buffers (a different function from
+ * ra_hash()): 64-byte stripes feed eight independent lanes, one word
+ * each, which are folded together with the tail and length at the end.
+ * Lanes run in AVX2 registers where the CPU has them; the digest does
+ * not depend on it.
+ */
+
+uint64_t ra_hash_wide(const void *buf, size_t len);
+
+/**
+ * out[i] = ra_hash(keys[i], lens[i]) for n keys, computed eight at a time
+ * in lockstep so that their chains overlap. Keys of up to 64 bytes are
+ * grouped by word count, so mixed lengths overlap as well as equal ones;
+ * runs of equal 8, 16 or 32 byte keys take a fixed-length path.
+ */
+
+void ra_hash_batch(const void * const *keys,
+		   const size_t *lens,
+		   uint64_t *out,
+		   size_t n);
+
 int ra_hash_test(void);
 
+int ra_hash_bench(void);
+
 #endif /* __RA_HASH_H__ */
@@ -46,10 +46,13 @@ void
 ra_printf(ra_color_t color, const char *format, ...)
 {
 	va_list ap;
-	int term;
+	int term, e;
 
 	assert( format );
 
+	/* traces follow failures; keep their errno for the caller */
+
+	e = errno;
 	term = ra_color_enabled ? isatty(STDOUT_FILENO) : 0;
 	if (term) {
 		printf("\033[%dm", color / 2 + 30);
@@ -65,6 +68,7 @@ ra_printf(ra_color_t color, const char *format, ...)
 		printf("\033[0m");
 		fflush(stdout);
 	}
+	errno = e;
 }
 
 void
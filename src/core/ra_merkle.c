@@ -0,0 +1,522 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_sha3.h"
+#include "ra_thread.h"
+#include "ra_merkle.h"
+
+#define LEVELS 64
+#define BATCH 8 /* leaves per read and per ra_sha3_batch() */
+#define GRAIN (1024 * 1024) /* bytes hashed per task, at least */
+
+struct ra_merkle {
+	int e;
+	int levels;
+	uint64_t off;
+	uint64_t len;
+	uint64_t leaf;
+	const char *buf;
+	ra_device_t device;
+	uint64_t counts[LEVELS];
+	uint8_t *nodes[LEVELS];
+	uint8_t root[RA_SHA3_LEN];
+};
+
+struct level {
+	int level;
+	struct ra_merkle *merkle;
+};
+
+static void
+_leaves_(void *ctx, uint64_t begin, uint64_t end)
+{
+	struct ra_merkle *merkle = (struct ra_merkle *)ctx;
+	const void *bufs[BATCH];
+	size_t lens[BATCH];
+	uint64_t i, off, len, k;
+	const char *base;
+	char *buf, *buf_;
+	int j, n;
+
+	/* device leaves are read BATCH at a time into an aligned buffer */
+
+	buf = buf_ = NULL;
+	if (merkle->device) {
+		if (!(buf_ = malloc(BATCH * merkle->leaf + ra_page()))) {
+			merkle->e = -1;
+			RA_TRACE("out of memory");
+			return;
+		}
+		buf = (char *)ra_align(buf_, ra_page());
+	}
+	for (i=begin; i<end; i+=n) {
+		n = (int)RA_MIN(end - i, BATCH);
+		off = i * merkle->leaf;
+		len = RA_MIN(n * merkle->leaf, merkle->len - off);
+		base = merkle->buf + off;
+		if (merkle->device) {
+			if (ra_device_read(merkle->device,
+					   buf,
+					   merkle->off + off,
+					   len)) {
+				merkle->e = -1;
+				RA_TRACE("^");
+				break;
+			}
+			base = buf;
+		}
+		for (j=0; j<n; ++j) {
+			k = j * merkle->leaf;
+			bufs[j] = base + k;
+			lens[j] = (size_t)RA_MIN(merkle->leaf, len - k);
+		}
+		ra_sha3_batch(bufs,
+			      lens,
+			      merkle->nodes[0] + i * RA_SHA3_LEN,
+			      n);
+	}
+	RA_FREE(buf_);
+}
+
+static void
+_parents_(void *ctx, uint64_t begin, uint64_t end)
+{
+	struct level *level = (struct level *)ctx;
+	struct ra_merkle *merkle = level->merkle;
+	const uint8_t *children;
+	const void *bufs[BATCH];
+	size_t lens[BATCH];
+	uint64_t i, k, count;
+	int j, n;
+
+	/* sibling digests are adjacent, so each pair is one message */
+
+	children = merkle->nodes[level->level - 1];
+	count = merkle->counts[level->level - 1];
+	for (i=begin; i<end; i+=n) {
+		n = (int)RA_MIN(end - i, BATCH);
+		for (j=0; j<n; ++j) {
+			k = 2 * (i + j);
+			bufs[j] = children + k * RA_SHA3_LEN;
+			lens[j] = (size_t)RA_MIN(2, count - k) * RA_SHA3_LEN;
+		}
+		ra_sha3_batch(bufs,
+			      lens,
+			      merkle->nodes[level->level] + i * RA_SHA3_LEN,
+			      n);
+	}
+}
+
+static int
+rehash(struct ra_merkle *merkle, uint64_t first, uint64_t last)
+{
+	struct ra_sha3_state state;
+	struct level level;
+	uint8_t le[16];
+	int i;
+
+	/* leaves [first, last), then their ancestors level by level */
+
+	merkle->e = 0;
+	ra_parallel_for(first,
+			last,
+			RA_MAX(BATCH, GRAIN / merkle->leaf),
+			_leaves_,
+			merkle);
+	if (merkle->e) {
+		RA_TRACE("^");
+		return -1;
+	}
+	level.merkle = merkle;
+	for (i=1; i<merkle->levels; ++i) {
+		first = first / 2;
+		last = (last + 1) / 2;
+		level.level = i;
+		ra_parallel_for(first,
+				last,
+				GRAIN / (2 * RA_SHA3_LEN),
+				_parents_,
+				&level);
+	}
+
+	/* root */
+
+	for (i=0; i<8; ++i) {
+		le[i + 0] = (uint8_t)(merkle->len >> (i * 8));
+		le[i + 8] = (uint8_t)(merkle->leaf >> (i * 8));
+	}
+	ra_sha3_init(&state);
+	ra_sha3_update(&state,
+		       merkle->nodes[merkle->levels - 1],
+		       RA_SHA3_LEN);
+	ra_sha3_update(&state, le, sizeof (le));
+	ra_sha3_final(&state, merkle->root);
+	return 0;
+}
+
+static ra_merkle_t
+open_(const void *buf,
+      ra_device_t device,
+      uint64_t off,
+      uint64_t len,
+      uint64_t leaf)
+{
+	struct ra_merkle *merkle;
+	uint64_t n, total;
+
+	assert( leaf );
+
+	/* initialize */
+
+	if (!(merkle = malloc(sizeof (struct ra_merkle)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(merkle, 0, sizeof (struct ra_merkle));
+	merkle->buf = (const char *)buf;
+	merkle->device = device;
+	merkle->off = off;
+	merkle->len = len;
+	merkle->leaf = leaf;
+
+	/* levels, from at least one (possibly empty) leaf up to the top */
+
+	total = 0;
+	n = RA_MAX(1, (len + leaf - 1) / leaf);
+	while (1) {
+		merkle->counts[merkle->levels++] = n;
+		total += n;
+		if (1 == n) {
+			break;
+		}
+		n = (n + 1) / 2;
+	}
+	if (!(merkle->nodes[0] = malloc((size_t)total * RA_SHA3_LEN))) {
+		ra_merkle_close(merkle);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	for (n=1; n<(uint64_t)merkle->levels; ++n) {
+		merkle->nodes[n] = merkle->nodes[n - 1];
+		merkle->nodes[n] += merkle->counts[n - 1] * RA_SHA3_LEN;
+	}
+	if (rehash(merkle, 0, merkle->counts[0])) {
+		ra_merkle_close(merkle);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return merkle;
+}
+
+ra_merkle_t
+ra_merkle_open(const void *buf, uint64_t len, uint64_t leaf)
+{
+	assert( !len || buf );
+	assert( leaf );
+
+	return open_(buf, NULL, 0, len, leaf);
+}
+
+ra_merkle_t
+ra_merkle_open_device(ra_device_t device,
+		      uint64_t off,
+		      uint64_t len,
+		      uint64_t leaf)
+{
+	assert( device );
+	assert( 0 == (off % ra_device_block(device)) );
+	assert( 0 == (len % ra_device_block(device)) );
+	assert( leaf && (0 == (leaf % ra_device_block(device))) );
+	assert( ra_device_size(device) >= (off + len) );
+
+	return open_(NULL, device, off, len, leaf);
+}
+
+void
+ra_merkle_close(ra_merkle_t merkle)
+{
+	if (merkle) {
+		RA_FREE(merkle->nodes[0]);
+		memset(merkle, 0, sizeof (struct ra_merkle));
+		RA_FREE(merkle);
+	}
+}
+
+int
+ra_merkle_update(ra_merkle_t merkle, uint64_t off, uint64_t len)
+{
+	assert( merkle );
+	assert( merkle->len >= (off + len) );
+
+	if (len && rehash(merkle,
+			  off / merkle->leaf,
+			  (off + len - 1) / merkle->leaf + 1)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+const void *
+ra_merkle_root(ra_merkle_t merkle)
+{
+	assert( merkle );
+
+	return merkle->root;
+}
+
+uint64_t
+ra_merkle_count(ra_merkle_t merkle, int level)
+{
+	assert( merkle && (0 <= level) );
+
+	return (level < merkle->levels) ? merkle->counts[level] : 0;
+}
+
+const void *
+ra_merkle_node(ra_merkle_t merkle, int level, uint64_t i)
+{
+	assert( merkle && (0 <= level) && (level < merkle->levels) );
+	assert( i < merkle->counts[level] );
+
+	return merkle->nodes[level] + i * RA_SHA3_LEN;
+}
+
+/* the tree rebuilt one ra_sha3() at a time */
+
+static int
+reference(const char *buf, uint64_t len, uint64_t leaf, uint8_t *root)
+{
+	struct ra_sha3_state state;
+	uint64_t i, n, k;
+	uint8_t *nodes;
+	uint8_t le[16];
+
+	n = RA_MAX(1, (len + leaf - 1) / leaf);
+	if (!(nodes = malloc(n * RA_SHA3_LEN))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<n; ++i) {
+		ra_sha3(buf + i * leaf,
+			(size_t)RA_MIN(leaf, len - RA_MIN(len, i * leaf)),
+			nodes + i * RA_SHA3_LEN);
+	}
+	while (1 < n) {
+		for (i=0; i<n; i+=2) {
+			k = RA_MIN(2, n - i);
+			ra_sha3(nodes + i * RA_SHA3_LEN,
+				(size_t)k * RA_SHA3_LEN,
+				nodes + i / 2 * RA_SHA3_LEN);
+		}
+		n = (n + 1) / 2;
+	}
+	for (i=0; i<8; ++i) {
+		le[i + 0] = (uint8_t)(len >> (i * 8));
+		le[i + 8] = (uint8_t)(leaf >> (i * 8));
+	}
+	ra_sha3_init(&state);
+	ra_sha3_update(&state, nodes, RA_SHA3_LEN);
+	ra_sha3_update(&state, le, sizeof (le));
+	ra_sha3_final(&state, root);
+	RA_FREE(nodes);
+	return 0;
+}
+
+int
+ra_merkle_test(void)
+{
+	const uint64_t LENS[] = { 0, 1, 4096, 4097, 40000, 1000000 };
+	const uint64_t LEAVES[] = { 512, 4096, 65536 };
+	const uint64_t BLOCK = 512;
+	const uint64_t SIZE = 1024 * 1024;
+	ra_merkle_t merkle, merkle_;
+	ra_device_t device;
+	uint8_t root[RA_SHA3_LEN], *before;
+	uint64_t i, j, off, n;
+	char *buf;
+	int level, k, e;
+
+	/* initialize */
+
+	e = 0;
+	if (!(buf = malloc(SIZE)) || !(before = malloc(SIZE))) {
+		RA_FREE(buf);
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<SIZE; ++i) {
+		buf[i] = (char)rand();
+	}
+
+	/* against the serial reference, shapes from one empty leaf up */
+
+	for (i=0; i<RA_ARRAY_SIZE(LENS); ++i) {
+		for (j=0; j<RA_ARRAY_SIZE(LEAVES); ++j) {
+			merkle = ra_merkle_open(buf, LENS[i], LEAVES[j]);
+			if (!merkle ||
+			    reference(buf, LENS[i], LEAVES[j], root)) {
+				ra_merkle_close(merkle);
+				RA_FREE(buf);
+				RA_FREE(before);
+				RA_TRACE("^");
+				return -1;
+			}
+			if (memcmp(root, ra_merkle_root(merkle), RA_SHA3_LEN) ||
+			    ra_merkle_count(merkle, 0) !=
+			    RA_MAX(1, (LENS[i] + LEAVES[j] - 1) / LEAVES[j])) {
+				e = -1;
+			}
+			ra_merkle_close(merkle);
+		}
+	}
+
+	/* a changed byte moves exactly one node per level */
+
+	if (!(merkle = ra_merkle_open(buf, SIZE - 100, 4096))) {
+		RA_FREE(buf);
+		RA_FREE(before);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (k=0; k<100; ++k) {
+		n = 0;
+		for (level=0; ra_merkle_count(merkle, level); ++level) {
+			memcpy(before + n * RA_SHA3_LEN,
+			       ra_merkle_node(merkle, level, 0),
+			       ra_merkle_count(merkle, level) * RA_SHA3_LEN);
+			n += ra_merkle_count(merkle, level);
+		}
+		off = (uint64_t)rand() % (SIZE - 100);
+		buf[off] ^= 1 + rand() % 255;
+		if (ra_merkle_update(merkle, off, 1)) {
+			ra_merkle_close(merkle);
+			RA_FREE(buf);
+			RA_FREE(before);
+			RA_TRACE("^");
+			return -1;
+		}
+		n = 0;
+		for (level=0; ra_merkle_count(merkle, level); ++level) {
+			j = 0;
+			for (i=0; i<ra_merkle_count(merkle, level); ++i) {
+				if (memcmp(before + (n + i) * RA_SHA3_LEN,
+					   ra_merkle_node(merkle, level, i),
+					   RA_SHA3_LEN)) {
+					++j;
+				}
+			}
+			if (1 != j) {
+				e = -1;
+			}
+			n += ra_merkle_count(merkle, level);
+		}
+		if (reference(buf, SIZE - 100, 4096, root) ||
+		    memcmp(root, ra_merkle_root(merkle), RA_SHA3_LEN)) {
+			e = -1;
+		}
+	}
+	ra_merkle_close(merkle);
+
+	/* a device region matches the same bytes in memory */
+
+	if (!(device = ra_device_open_memory(SIZE, BLOCK, 0)) ||
+	    ra_device_write(device, buf, 0, SIZE)) {
+		ra_device_close(device);
+		RA_FREE(buf);
+		RA_FREE(before);
+		RA_TRACE("^");
+		return -1;
+	}
+	off = 3 * BLOCK;
+	n = 300 * BLOCK;
+	merkle = ra_merkle_open_device(device, off, n, 8 * BLOCK);
+	merkle_ = ra_merkle_open(buf + off, n, 8 * BLOCK);
+	if (!merkle || !merkle_) {
+		ra_merkle_close(merkle);
+		ra_merkle_close(merkle_);
+		ra_device_close(device);
+		RA_FREE(buf);
+		RA_FREE(before);
+		RA_TRACE("^");
+		return -1;
+	}
+	if (memcmp(ra_merkle_root(merkle),
+		   ra_merkle_root(merkle_),
+		   RA_SHA3_LEN)) {
+		e = -1;
+	}
+	i = 100 * BLOCK;
+	memset(buf + off + i, 0, BLOCK);
+	if (ra_device_write(device, buf + off + i, off + i, BLOCK) ||
+	    ra_merkle_update(merkle, i, BLOCK) ||
+	    ra_merkle_update(merkle_, i, BLOCK) ||
+	    memcmp(ra_merkle_root(merkle),
+		   ra_merkle_root(merkle_),
+		   RA_SHA3_LEN)) {
+		e = -1;
+	}
+	ra_merkle_close(merkle);
+	ra_merkle_close(merkle_);
+	ra_device_close(device);
+	RA_FREE(buf);
+	RA_FREE(before);
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_merkle_bench(void)
+{
+	const uint64_t LEN = 64 * 1024 * 1024;
+	const uint64_t LEAF = 64 * 1024;
+	uint8_t root[RA_SHA3_LEN];
+	ra_merkle_t merkle;
+	uint64_t t[3], i;
+	char *buf;
+	int k;
+
+	if (!(buf = malloc(LEN))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	for (i=0; i<LEN; ++i) {
+		buf[i] = (char)i;
+	}
+	t[0] = ra_time();
+	ra_sha3(buf, LEN, root);
+	t[0] = ra_time() - t[0];
+	t[1] = ra_time();
+	if (!(merkle = ra_merkle_open(buf, LEN, LEAF))) {
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+	t[1] = ra_time() - t[1];
+
+	/* one 4 KiB block rewritten */
+
+	t[2] = ra_time();
+	for (k=0; k<1000; ++k) {
+		i = (uint64_t)rand() % (LEN / 4096) * 4096;
+		buf[i] ^= 1;
+		if (ra_merkle_update(merkle, i, 4096)) {
+			ra_merkle_close(merkle);
+			RA_FREE(buf);
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	t[2] = ra_time() - t[2];
+	ra_printf(RA_COLOR_GRAY,
+		  "merkle 64 MiB, 64 KiB leaves: ra_sha3 %6.1f  tree %6.1f"
+		  " MB/s  update %6.1f us\n",
+		  (double)LEN / RA_MAX(1, t[0]),
+		  (double)LEN / RA_MAX(1, t[1]),
+		  (double)t[2] / 1000);
+	ra_merkle_close(merkle);
+	RA_FREE(buf);
+	return 0;
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_MERKLE_H__
+#define __RA_MERKLE_H__
+
+#include "ra_device.h"
+
+typedef struct ra_merkle *ra_merkle_t;
+
+/**
+ * SHA3-256 hash tree over len bytes in leaves of leaf bytes (the last one
+ * may be shorter). Leaves are hashed in parallel on the default pool,
+ * four at a time with ra_sha3_batch(); each parent is the ra_sha3() of
+ * its two children (or of a lone last child), and the root binds the top
+ * node to len and leaf. Every level is kept in memory.
+ *
+ * The source is buf, which must outlive the tree, or the region [off, off
+ * + len) of device, with off, len and leaf multiples of its block. Not
+ * thread-safe.
+ */
+
+ra_merkle_t ra_merkle_open(const void *buf, uint64_t len, uint64_t leaf);
+
+ra_merkle_t ra_merkle_open_device(ra_device_t device,
+				  uint64_t off,
+				  uint64_t len,
+				  uint64_t leaf);
+
+void ra_merkle_close(ra_merkle_t merkle);
+
+/**
+ * Bytes [off, off + len) of the source have changed: rehashes the leaves
+ * that cover them and their paths to the root only.
+ */
+
+int ra_merkle_update(ra_merkle_t merkle, uint64_t off, uint64_t len);
+
+const void *ra_merkle_root(ra_merkle_t merkle); /* RA_SHA3_LEN bytes */
+
+/**
+ * Nodes on level (0: the leaves), 0 above the top; node i of a level is
+ * RA_SHA3_LEN bytes.
+ */
+
+uint64_t ra_merkle_count(ra_merkle_t merkle, int level);
+
+const void *ra_merkle_node(ra_merkle_t merkle, int level, uint64_t i);
+
+int ra_merkle_test(void);
+
+int ra_merkle_bench(void);
+
+#endif /* __RA_MERKLE_H__ */
@@ -2,8 +2,20 @@
 
 #include "ra_file.h"
 #include "ra_base64.h"
+#include "ra_thread.h"
 #include "ra_mlp.h"
 
+/* multiply-adds per parallel task */
+
+#define WORK 16384
+
+struct mac {
+	int m;
+	float *z;
+	const float *a;
+	const float *b;
+};
+
 struct ra_mlp {
 	int input;
 	int output;
@@ -34,11 +46,15 @@ argmax(const float *a, int n)
 }
 
 static void
-mac1(float *z, const float *a, const float *b, int n, int m)
+_mac1_(void *ctx, uint64_t begin, uint64_t end)
 {
-	int i, j;
+	const struct mac *mac = (const struct mac *)ctx;
+	const float *a = mac->a, *b = mac->b;
+	float *z = mac->z;
+	int i, j, m;
 
-	for (i=0; i<n; ++i) {
+	m = mac->m;
+	for (i=(int)begin; i<(int)end; ++i) {
 		z[i] = 0.0;
 		for (j=0; j<m; ++j) {
 			z[i] += a[i * m + j] * b[j];
@@ -46,6 +62,18 @@ mac1(float *z, const float *a, const float *b, int n, int m)
 	}
 }
 
+static void
+mac1(float *z, const float *a, const float *b, int n, int m)
+{
+	struct mac mac;
+
+	mac.m = m;
+	mac.z = z;
+	mac.a = a;
+	mac.b = b;
+	ra_parallel_for(0, n, RA_DUP(WORK, m), _mac1_, &mac);
+}
+
 static void
 mac2(float *z, const float *a, const float *b, int n, int m)
 {
@@ -60,17 +88,33 @@ mac2(float *z, const float *a, const float *b, int n, int m)
 }
 
 static void
-mac3(float *za, const float *b, const float *c, int n, int m)
+_mac3_(void *ctx, uint64_t begin, uint64_t end)
 {
-	int i, j;
+	const struct mac *mac = (const struct mac *)ctx;
+	const float *b = mac->a, *c = mac->b;
+	float *za = mac->z;
+	int i, j, m;
 
-	for (i=0; i<n; ++i) {
+	m = mac->m;
+	for (i=(int)begin; i<(int)end; ++i) {
 		for (j=0; j<m; ++j) {
 			za[i * m + j] += b[i] * c[j];
 		}
 	}
 }
 
+static void
+mac3(float *za, const float *b, const float *c, int n, int m)
+{
+	struct mac mac;
+
+	mac.m = m;
+	mac.z = za;
+	mac.a = b;
+	mac.b = c;
+	ra_parallel_for(0, n, RA_DUP(WORK, m), _mac3_, &mac);
+}
+
 static void
 mac4(float *za, const float *b, float s, int n)
 {
@@ -5,42 +5,230 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
-#include "ra_thread.h"
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#endif /* __linux__ */
+
+#include "ra_fiber.h"
+#include "ra_queue.h"
+#include "ra_timer.h"
+#include "ra_map.h"
 #include "ra_network.h"
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
 #define WRITEV_MAX_N 4
+#define EVENTS 64
+#define CHUNK 16384 /* read-ahead */
+#define READ_MAX (1024 * 1024) /* reactor: input buffered per connection */
+#define BUFFER 65536 /* write coalescing */
+#define SLOTS 1024 /* pooled client slots per acceptor */
+#define COPY 262144 /* sendfile fallback chunk */
+#define SENDFILE_MAX 1073741824
+#define ADDRESSES 4 /* cached per peer */
+#define FDS 8 /* received, not yet taken */
+#define LOCAL "unix:"
+#define RESOLVE_TTL 60000000 /* us */
+#define TICK 1000 /* us, deadline resolution */
+
+/*
+ * Reactor epoll events point at a connection or at a listening server;
+ * both structs begin with the listener flag that tells them apart.
+ */
 
 struct ra_network {
+	int listener; /* 0 */
 	int fd;
+	int e; /* reactor: connection failed or done */
+	int more; /* reactor: input left in the socket at READ_MAX */
+	int local; /* AF_UNIX */
+	int fds_n;
+	int fds[FDS];
+	void *user;
+	uint64_t idle; /* us, 0: none */
+	uint64_t read;
+	uint64_t write;
+	uint64_t deadline; /* of the read or write under way */
+	uint64_t active; /* reactor: last traffic */
+	uint64_t started; /* reactor: oldest unconsumed input */
+	uint64_t queued; /* reactor: oldest undrained output */
+	struct ra_timeout timeout; /* reactor */
+	struct buffer {
+		char *buf;
+		size_t off;
+		size_t len;
+		size_t cap;
+	} in, out;
+	struct reactor *reactor;
+	struct ra_network *prev;
+	struct ra_network *next;
+	struct peer *peer; /* pooled */
+	/*-*/
+	int reactors_n;
+	struct reactor {
+		int epfd;
+		int efd; /* eventfd: stop */
+		void *ctx;
+		ra_timer_t timer; /* connection deadlines */
+		ra_thread_t thread;
+		ra_network_event_fnc_t fnc;
+		struct ra_network *parent;
+		struct ra_network *connections;
+	} *reactors;
+	ra_scheduler_t scheduler;
 	struct server {
+		int listener; /* 1 */
 		int fd;
+		int local;
+		char *path; /* AF_UNIX, unlinked on close */
+		int shard; /* SO_REUSEPORT socket shard of shards */
+		int shards;
+		ra_queue_t slots; /* free client slots */
 		ra_thread_t thread;
 		struct server *link;
-		struct client {
-			int fd;
-			ra_thread_t thread;
-			struct client *link;
-			/*-*/
-			void *ctx;
-			ra_network_fnc_t fnc;
-		} *clients;
 		/*-*/
 		void *ctx;
 		ra_network_fnc_t fnc;
+		ra_scheduler_t scheduler;
 	} *servers;
 };
 
-static int _flag_;
+struct client {
+	int fd;
+	struct server *server;
+};
+
+struct address {
+	int family;
+	int socktype;
+	int protocol;
+	socklen_t len;
+	struct sockaddr_storage addr;
+};
+
+struct ra_network_pool {
+	int idle_max;
+	uint64_t timeout;
+	ra_map_t peers;
+	ra_mutex_t mutex;
+};
+
+struct peer {
+	int n;
+	int idle_n;
+	uint64_t resolved;
+	struct address addresses[ADDRESSES];
+	struct idle {
+		uint64_t time;
+		struct ra_network *network;
+	} idle[1]; /* idle_max, most recent last */
+};
+
+static int _stop_; /* generation, bumped by SIGINT or ra_network_stop() */
+static int _waiters_;
+static int _event_ = -1; /* eventfd semaphore, one token per waiter */
+static int _listeners_; /* running, setting up included; under _mutex_ */
+static int _latch_; /* a stop that found no listener, for the next one */
+static pthread_mutex_t _mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+wakeup(void)
+{
+	uint64_t n;
+
+	n = (uint64_t)__sync_fetch_and_add(&_waiters_, 0);
+	if (n &&
+	    (0 <= _event_) &&
+	    (0 > write(_event_, &n, sizeof (n)))) {
+		/* already signaled */
+	}
+}
 
 static void
 sigint(int signum)
 {
 	if (SIGINT == signum) {
-		_flag_ = 1;
+		__sync_fetch_and_add(&_stop_, 1);
+		wakeup();
+	}
+}
+
+/*
+ * A listener enters before it sets up: it takes the stop generation to
+ * wait out, or ends at once on a latched stop (returns 1). The first one
+ * in routes the signals to sigint(), the last one out restores them.
+ */
+
+static int
+enter(int *stop)
+{
+	int fd;
+
+	pthread_mutex_lock(&_mutex_);
+	if (_latch_) {
+		_latch_ = 0;
+		pthread_mutex_unlock(&_mutex_);
+		return 1;
+	}
+#if defined(__linux__)
+	if ((0 > _event_) && (0 <= (fd = eventfd(0, EFD_SEMAPHORE)))) {
+		_event_ = fd;
+	}
+#else
+	(void)fd;
+#endif /* __linux__ */
+	if (!_listeners_ &&
+	    ((SIG_ERR == signal(SIGHUP, sigint)) ||
+	     (SIG_ERR == signal(SIGPIPE, sigint)) ||
+	     (SIG_ERR == signal(SIGINT, sigint)))) {
+		pthread_mutex_unlock(&_mutex_);
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	++_listeners_;
+	(*stop) = __sync_fetch_and_add(&_stop_, 0);
+	pthread_mutex_unlock(&_mutex_);
+	return 0;
+}
+
+static void
+leave(void)
+{
+	pthread_mutex_lock(&_mutex_);
+	if (!--_listeners_) {
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
 	}
+	pthread_mutex_unlock(&_mutex_);
+}
+
+static void
+block(int stop)
+{
+	uint64_t value;
+
+	__sync_fetch_and_add(&_waiters_, 1);
+	while (stop == __sync_fetch_and_add(&_stop_, 0)) {
+		if ((0 > _event_) ||
+		    (0 > read(_event_, &value, sizeof (value)))) {
+			sleep(1);
+		}
+	}
+	__sync_fetch_and_sub(&_waiters_, 1);
 }
 
 static void
@@ -60,11 +248,12 @@ osocket(int domain, int type, int protocol)
 	int fd;
 
 	if ((0 >= (fd = socket(domain, type, protocol))) ||
-	    (0 > setsockopt(fd,
-			    IPPROTO_TCP,
-			    TCP_NODELAY,
-			    (const void *)&NODELAY,
-			    sizeof (NODELAY))) ||
+	    ((AF_UNIX != domain) &&
+	     (0 > setsockopt(fd,
+			     IPPROTO_TCP,
+			     TCP_NODELAY,
+			     (const void *)&NODELAY,
+			     sizeof (NODELAY)))) ||
 	    (0 > setsockopt(fd,
 			    SOL_SOCKET,
 			    SO_REUSEADDR,
@@ -76,6 +265,202 @@ osocket(int domain, int type, int protocol)
 	return fd;
 }
 
+static int
+reuseport(int fd)
+{
+#if defined(SO_REUSEPORT)
+	const int OPTVAL = 1;
+
+	if (0 > setsockopt(fd,
+			   SOL_SOCKET,
+			   SO_REUSEPORT,
+			   (const void *)&OPTVAL,
+			   sizeof (OPTVAL))) {
+		return -1;
+	}
+	return 0;
+#else
+	(void)fd;
+	return -1;
+#endif /* SO_REUSEPORT */
+}
+
+static int
+resolve(const char *hostname,
+	const char *servname,
+	struct address *addresses,
+	int /* BOOL */ passive)
+{
+	struct addrinfo hints, *res, *p;
+	struct sockaddr_un *un;
+	int n;
+
+	/* unix:/path */
+
+	if (!strncmp(hostname, LOCAL, strlen(LOCAL))) {
+		hostname += strlen(LOCAL);
+		memset(&addresses[0], 0, sizeof (struct address));
+		un = (struct sockaddr_un *)&addresses[0].addr;
+		if (!(*hostname) ||
+		    (sizeof (un->sun_path) <= strlen(hostname))) {
+			RA_TRACE("invalid network address");
+			return -1;
+		}
+		un->sun_family = AF_UNIX;
+		memcpy(un->sun_path, hostname, strlen(hostname) + 1);
+		addresses[0].family = AF_UNIX;
+		addresses[0].socktype = SOCK_STREAM;
+		addresses[0].len = sizeof (struct sockaddr_un);
+		return 1;
+	}
+
+	/* host and service */
+
+	memset(&hints, 0, sizeof (struct addrinfo));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if (!servname || getaddrinfo(hostname, servname, &hints, &res)) {
+		RA_TRACE("invalid network address");
+		return -1;
+	}
+	n = 0;
+	for (p=res; p && (ADDRESSES > n); p=p->ai_next) {
+		if (sizeof (struct sockaddr_storage) < p->ai_addrlen) {
+			continue;
+		}
+		addresses[n].family = p->ai_family;
+		addresses[n].socktype = p->ai_socktype;
+		addresses[n].protocol = p->ai_protocol;
+		addresses[n].len = p->ai_addrlen;
+		memcpy(&addresses[n].addr, p->ai_addr, p->ai_addrlen);
+		++n;
+	}
+	freeaddrinfo(res);
+	return n;
+}
+
+/*
+ * A unix: address may be taken over only from a socket file that nobody
+ * listens on any more, left behind by an earlier run.
+ */
+
+static int
+stale(const struct address *address)
+{
+	const struct sockaddr_un *un;
+	struct stat st;
+	int fd, e;
+
+	un = (const struct sockaddr_un *)&address->addr;
+	if (lstat(un->sun_path, &st)) {
+		return 0; /* free */
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		RA_TRACE("address in use (not a socket)");
+		return -1;
+	}
+	if (!(fd = osocket(AF_UNIX, SOCK_STREAM, 0)) ||
+	    (0 > fcntl(fd, F_SETFL, O_NONBLOCK))) {
+		sclose(fd);
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	e = connect(fd, (const struct sockaddr *)&address->addr, address->len);
+	e = e && (ECONNREFUSED == errno);
+	sclose(fd);
+	if (!e) {
+		RA_TRACE("address in use");
+		return -1;
+	}
+	unlink(un->sun_path);
+	return 0;
+}
+
+static int
+listeners(struct ra_network *network,
+	  const char *hostname,
+	  const char *servname,
+	  int n,
+	  int /* BOOL */ nonblock)
+{
+	struct address addresses[ADDRESSES];
+	const struct sockaddr_un *un;
+	struct address *address;
+	struct server *server;
+	int i, j, m, fd;
+	size_t len;
+
+	/* address */
+
+	if (0 > (m = resolve(hostname, servname, addresses, 1))) {
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* listen: up to n sockets per address, balanced by the kernel */
+
+	for (j=0; j<m; ++j) {
+		address = &addresses[j];
+		un = (const struct sockaddr_un *)&address->addr;
+		if (AF_UNIX == address->family) {
+			n = 1;
+			if (stale(address)) {
+				RA_TRACE("^");
+				return -1;
+			}
+		}
+		for (i=0; i<n; ++i) {
+			if (!(fd = osocket(address->family,
+					   address->socktype,
+					   address->protocol)) ||
+			    ((1 < n) && reuseport(fd) && i) ||
+			    (nonblock &&
+			     (0 > fcntl(fd, F_SETFL, O_NONBLOCK))) ||
+			    (0 > bind(fd,
+				      (const struct sockaddr *)&address->addr,
+				      address->len)) ||
+			    (0 > listen(fd, SOMAXCONN))) {
+				sclose(fd);
+				break;
+			}
+			if (!(server = malloc(sizeof (struct server)))) {
+				sclose(fd);
+				RA_TRACE("out of memory");
+				return -1;
+			}
+			memset(server, 0, sizeof (struct server));
+			server->listener = 1;
+			server->fd = fd;
+			server->shard = i;
+			server->link = network->servers;
+			network->servers = server;
+			if (AF_UNIX == address->family) {
+				len = strlen(un->sun_path) + 1;
+				if (!(server->path = malloc(len))) {
+					RA_TRACE("out of memory");
+					return -1;
+				}
+				memcpy(server->path, un->sun_path, len);
+				server->local = 1;
+			}
+		}
+		server = network->servers;
+		while (server && !server->shards) {
+			server->shards = i;
+			server = server->link;
+		}
+	}
+
+	/* listening? */
+
+	if (!network->servers) {
+		RA_TRACE("no network interface found");
+		return -1;
+	}
+	return 0;
+}
+
 static void
 _client_(void *ctx)
 {
@@ -85,11 +470,21 @@ _client_(void *ctx)
 	client = (struct client *)ctx;
 	memset(&network, 0, sizeof (struct ra_network));
 	network.fd = client->fd;
-	client->fnc(client->ctx, &network);
+	network.local = client->server->local;
+	client->server->fnc(client->server->ctx, &network);
+	if (network.out.len && ra_network_flush(&network)) {
+		RA_TRACE("^ (ignored)");
+	}
+	RA_FREE(network.in.buf);
+	RA_FREE(network.out.buf);
+	while (network.fds_n) {
+		close(network.fds[--network.fds_n]); /* received, never taken */
+	}
 	sclose(network.fd);
-	client->fd = 0;
-	client->ctx = NULL;
-	client->fnc = NULL;
+	if (ra_queue_push(client->server->slots, client)) {
+		memset(client, 0, sizeof (struct client));
+		RA_FREE(client);
+	}
 }
 
 static void
@@ -104,47 +499,35 @@ _server_(void *ctx)
 		if (0 >= (fd = accept(server->fd, NULL, NULL))) {
 			continue;
 		}
-		client = server->clients;
-		while (client && ra_thread_good(client->thread)) {
-			client = client->link;
-		}
-		if (!client) {
-			if (!(client = malloc(sizeof (struct client)))) {
-				sclose(fd);
-				RA_TRACE("out of memory (ignored)");
-				continue;
-			}
-			memset(client, 0, sizeof (struct client));
-			client->link = server->clients;
-			server->clients = client;
+
+		/* one fiber per connection; would-block I/O parks it */
+
+		if (!(client = ra_queue_pop(server->slots)) &&
+		    !(client = malloc(sizeof (struct client)))) {
+			sclose(fd);
+			RA_TRACE("out of memory (ignored)");
+			continue;
 		}
 		client->fd = fd;
-		client->ctx = server->ctx;
-		client->fnc = server->fnc;
-		if (!(client->thread = ra_thread_open(_client_, client))) {
+		client->server = server;
+		if ((0 > fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) ||
+		    ra_fiber_spawn(server->scheduler, _client_, client)) {
 			sclose(fd);
-			client->fd = 0;
-			client->ctx = NULL;
-			client->fnc = NULL;
+			RA_FREE(client);
 			RA_TRACE("^ (ignored)");
 		}
 	}
 }
 
-int
-ra_network_listen(const char *hostname,
-		  const char *servname,
-		  ra_network_fnc_t fnc,
-		  void *ctx)
+static int
+listen_(const char *hostname,
+	const char *servname,
+	ra_network_fnc_t fnc,
+	void *ctx,
+	int stop)
 {
-	struct addrinfo hints, *res, *p;
 	struct ra_network *network;
 	struct server *server;
-	int fd;
-
-	assert( hostname && (*hostname) );
-	assert( hostname && (*servname) );
-	assert( fnc );
 
 	/* initialize */
 
@@ -153,220 +536,2554 @@ ra_network_listen(const char *hostname,
 		return -1;
 	}
 	memset(network, 0, sizeof (struct ra_network));
-
-	/* address */
-
-	memset(&hints, 0, sizeof (struct addrinfo));
-	hints.ai_family = PF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
-	if (getaddrinfo(hostname, servname, &hints, &res)) {
+	if (!(network->scheduler = ra_scheduler_open(0, 0))) {
 		ra_network_close(network);
-		RA_TRACE("invalid network address");
+		RA_TRACE("^");
 		return -1;
 	}
 
-	/* listen */
+	/* listen: one acceptor per core */
 
-	fd = 0;
-	p = res;
-	while (p) {
-		if (!(fd = osocket(p->ai_family,
-				   p->ai_socktype,
-				   p->ai_protocol)) ||
-		    (0 > bind(fd, p->ai_addr, p->ai_addrlen)) ||
-		    (0 > listen(fd, SOMAXCONN))) {
-			sclose(fd);
-			p = p->ai_next;
-			continue;
-		}
-		if (!(server = malloc(sizeof (struct server)))) {
-			sclose(fd);
-			ra_network_close(network);
-			RA_TRACE("out of memory");
-			return -1;
-		}
-		memset(server, 0, sizeof (struct server));
-		server->fd = fd;
+	if (listeners(network, hostname, servname, ra_cores(), 0)) {
+		ra_network_close(network);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (server=network->servers; server; server=server->link) {
 		server->ctx = ctx;
 		server->fnc = fnc;
-		if (!(server->thread = ra_thread_open(_server_, server))) {
-			sclose(fd);
-			RA_FREE(server);
+		server->scheduler = network->scheduler;
+		if (!(server->slots = ra_queue_open(SLOTS)) ||
+		    !(server->thread = ra_thread_open(_server_, server))) {
 			ra_network_close(network);
 			RA_TRACE("^");
 			return -1;
 		}
-		server->link = network->servers;
-		network->servers = server;
-		p = p->ai_next;
 	}
-	freeaddrinfo(res);
-	p = res = NULL;
 
-	/* listening? */
+	/* wait */
 
-	if (!network->servers) {
-		ra_network_close(network);
-		RA_TRACE("no network interface found");
-		return -1;
-	}
+	block(stop);
+	ra_network_close(network);
+	return 0;
+}
 
-	/* wait */
+int
+ra_network_listen(const char *hostname,
+		  const char *servname,
+		  ra_network_fnc_t fnc,
+		  void *ctx)
+{
+	int e, stop;
 
-	_flag_ = 0;
-	if ((SIG_ERR == signal(SIGHUP, sigint)) ||
-	    (SIG_ERR == signal(SIGPIPE, sigint)) ||
-	    (SIG_ERR == signal(SIGINT, sigint))) {
-		ra_network_close(network);
-		RA_TRACE("system failure detected");
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+	assert( fnc );
+
+	if (0 > (e = enter(&stop))) {
+		RA_TRACE("^");
 		return -1;
 	}
-	while (!__sync_fetch_and_add(&_flag_, 0)) {
-		sleep(1);
+	if (e) {
+		return 0; /* stopped before it started */
 	}
-	signal(SIGHUP, SIG_DFL);
-	signal(SIGPIPE, SIG_DFL);
-	signal(SIGINT, SIG_DFL);
-	ra_network_close(network);
+	if (listen_(hostname, servname, fnc, ctx, stop)) {
+		leave();
+		RA_TRACE("^");
+		return -1;
+	}
+	leave();
 	return 0;
 }
 
-ra_network_t
-ra_network_connect(const char *hostname, const char *servname)
+static uint64_t
+after(uint64_t timeout)
 {
-	struct addrinfo hints, *res, *p;
-	struct ra_network *network;
-	int fd;
+	return timeout ? (ra_time() + timeout) : 0;
+}
 
-	assert( hostname && (*hostname) );
-	assert( hostname && (*servname) );
+static uint64_t
+sooner(uint64_t a, uint64_t b)
+{
+	return (!a || (b && (b < a))) ? b : a;
+}
 
-	/* initialize */
+static int
+reserve(struct buffer *buffer, size_t n)
+{
+	size_t cap;
+	char *buf;
 
-	if (!(network = malloc(sizeof (struct ra_network)))) {
-		RA_TRACE("out of memory");
-		return NULL;
+	if (buffer->off && ((buffer->cap - buffer->off - buffer->len) < n)) {
+		memmove(buffer->buf, buffer->buf + buffer->off, buffer->len);
+		buffer->off = 0;
 	}
-	memset(network, 0, sizeof (struct ra_network));
-
-	/* address */
-
-	memset(&hints, 0, sizeof (struct addrinfo));
-	hints.ai_family = PF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	if (getaddrinfo(hostname, servname, &hints, &res)) {
-		ra_network_close(network);
-		RA_TRACE("invalid network address");
-		return NULL;
+	if ((buffer->cap - buffer->len) < n) {
+		cap = RA_MAX(CHUNK, buffer->cap);
+		while ((cap - buffer->len) < n) {
+			cap *= 2;
+		}
+		if (!(buf = realloc(buffer->buf, cap))) {
+			RA_TRACE("out of memory");
+			return -1;
+		}
+		buffer->buf = buf;
+		buffer->cap = cap;
 	}
+	return 0;
+}
 
-	/* open */
+#if defined(__linux__)
 
-	fd = 0;
-	p = res;
-	while (p) {
-		if (!(fd = osocket(p->ai_family,
-				   p->ai_socktype,
-				   p->ai_protocol)) ||
-		    (0 > connect(fd, p->ai_addr, p->ai_addrlen))) {
-			sclose(fd);
-			p = p->ai_next;
+static int
+fill(struct ra_network *network)
+{
+	struct buffer *buffer;
+	int /* BOOL */ more;
+	ssize_t n;
+
+	more = 0;
+	network->more = 0;
+	buffer = &network->in;
+	for (;;) {
+		if (READ_MAX <= buffer->len) {
+			network->more = 1; /* edge seen: no new event for it */
+			break;
+		}
+		if (reserve(buffer, RA_MIN(CHUNK, READ_MAX - buffer->len))) {
+			network->e = -1;
+			break;
+		}
+		n = read(network->fd,
+			 buffer->buf + buffer->off + buffer->len,
+			 RA_MIN(buffer->cap - buffer->off - buffer->len,
+				READ_MAX - buffer->len));
+		if (0 < n) {
+			buffer->len += (size_t)n;
+			more = 1;
 			continue;
 		}
+		if ((0 > n) && (EINTR == errno)) {
+			continue;
+		}
+		if (!n || (EAGAIN != errno)) {
+			network->e = -1; /* peer closed or failed */
+		}
 		break;
 	}
-	freeaddrinfo(res);
-	p = res = NULL;
+	return more;
+}
 
-	/* connected? */
+/*
+ * Reads and hands input to fnc. Past READ_MAX the rest stays in the
+ * socket until fnc consumes some; fnc consuming none of a full buffer
+ * would stall the connection, which is closed instead.
+ */
 
-	if (!fd) {
-		ra_network_close(network);
-		RA_TRACE("unable to connect to network");
-		return NULL;
+static void
+readable(struct reactor *reactor, struct ra_network *network)
+{
+	size_t len;
+
+	while (!network->e && fill(network)) {
+		len = network->in.len;
+		if (reactor->fnc(reactor->ctx, network, RA_NETWORK_READABLE)) {
+			network->e = -1;
+			break;
+		}
+		if (!network->more) {
+			break;
+		}
+		if (network->in.len >= len) {
+			network->e = -1;
+			break;
+		}
 	}
-	network->fd = fd;
-	return network;
 }
 
-void
-ra_network_close(ra_network_t network)
+static int
+drain(struct ra_network *network)
 {
-	struct server *server, *server_;
-	struct client *client, *client_;
+	struct buffer *buffer;
+	ssize_t n;
 
-	if (network) {
-		sclose(network->fd);
-		server = network->servers;
-		while (server) {
-			server_ = server;
-			server = server->link;
-			sclose(server_->fd);
-			ra_thread_close(server_->thread);
-			client = server_->clients;
-			while (client) {
-				client_ = client;
-				client = client->link;
-				ra_thread_close(client_->thread);
-				memset(client_, 0, sizeof (struct client));
-				RA_FREE(client_);
+	buffer = &network->out;
+	while (buffer->len) {
+		n = write(network->fd, buffer->buf + buffer->off, buffer->len);
+		if (0 < n) {
+			buffer->off += (size_t)n;
+			buffer->len -= (size_t)n;
+			continue;
+		}
+		if ((0 > n) && (EINTR == errno)) {
+			continue;
+		}
+		if ((0 > n) && (EAGAIN == errno)) {
+			return 0;
+		}
+		network->e = -1;
+		return -1;
+	}
+	buffer->off = 0;
+	return 0;
+}
+
+static void
+drop(struct reactor *reactor, struct ra_network *network)
+{
+	drain(network); /* best effort */
+	ra_timer_cancel(reactor->timer, &network->timeout);
+	if (network->prev) {
+		network->prev->next = network->next;
+	}
+	else {
+		reactor->connections = network->next;
+	}
+	if (network->next) {
+		network->next->prev = network->prev;
+	}
+	reactor->fnc(reactor->ctx, network, RA_NETWORK_CLOSE);
+	ra_network_close(network);
+}
+
+static void
+_expire_(void *ctx)
+{
+	struct ra_network *network;
+
+	network = (struct ra_network *)ctx;
+	network->e = -1;
+	drop(network->reactor, network);
+}
+
+/*
+ * Rearms the connection's single timeout for the soonest of its idle,
+ * read (input left unconsumed) and write (output left undrained)
+ * deadlines.
+ */
+
+static void
+arm(struct reactor *reactor, struct ra_network *network, uint64_t now)
+{
+	uint64_t deadline;
+
+	if (!network->idle && !network->read && !network->write) {
+		ra_timer_cancel(reactor->timer, &network->timeout);
+		return;
+	}
+	network->active = now;
+	network->started = network->in.len ? (network->started ?
+					      network->started : now) : 0;
+	network->queued = network->out.len ? (network->queued ?
+					      network->queued : now) : 0;
+	deadline = network->idle ? (network->active + network->idle) : 0;
+	if (network->read && network->started) {
+		deadline = sooner(deadline, network->started + network->read);
+	}
+	if (network->write && network->queued) {
+		deadline = sooner(deadline, network->queued + network->write);
+	}
+	if (!deadline) {
+		ra_timer_cancel(reactor->timer, &network->timeout);
+		return;
+	}
+	ra_timer_schedule(reactor->timer,
+			  &network->timeout,
+			  deadline,
+			  _expire_,
+			  network);
+}
+
+static int
+timeout(struct reactor *reactor)
+{
+	uint64_t next, now;
+
+	if (!(next = ra_timer_next(reactor->timer))) {
+		return -1;
+	}
+	now = ra_time();
+	if (next <= now) {
+		return 0;
+	}
+	return (int)RA_MIN((next - now + 999) / 1000, 1000000);
+}
+
+static void
+accept_(struct reactor *reactor, struct server *server)
+{
+	struct ra_network *network;
+	struct epoll_event event;
+	int fd;
+
+	for (;;) {
+		fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK);
+		if (0 >= fd) {
+			if ((0 > fd) && (EINTR == errno)) {
+				continue;
 			}
-			memset(server_, 0, sizeof (struct server));
-			RA_FREE(server_);
+			break;
+		}
+		if (!(network = malloc(sizeof (struct ra_network)))) {
+			sclose(fd);
+			RA_TRACE("out of memory (ignored)");
+			continue;
 		}
 		memset(network, 0, sizeof (struct ra_network));
-		RA_FREE(network);
+		network->fd = fd;
+		network->reactor = reactor;
+		memset(&event, 0, sizeof (struct epoll_event));
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = network;
+		if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &event)) {
+			ra_network_close(network);
+			RA_TRACE("system failure detected (ignored)");
+			continue;
+		}
+		network->next = reactor->connections;
+		if (reactor->connections) {
+			reactor->connections->prev = network;
+		}
+		reactor->connections = network;
+		if (reactor->fnc(reactor->ctx, network, RA_NETWORK_OPEN)) {
+			drop(reactor, network);
+		}
 	}
 }
 
-int
-ra_network_read(ra_network_t network, void *buf_, size_t len)
+static void
+_reactor_(void *ctx)
 {
-	char *buf = (char *)buf_;
-	ssize_t n;
+	struct epoll_event events[EVENTS];
+	struct ra_network *network;
+	struct reactor *reactor;
+	struct server *server;
+	int i, n, stop;
+	size_t queued;
+	uint64_t now;
 
-	assert( network && (!len || buf) );
+	stop = 0;
+	reactor = (struct reactor *)ctx;
+	while (!stop) {
+		n = epoll_wait(reactor->epfd, events, EVENTS, timeout(reactor));
+		if (0 > n) {
+			if (EINTR == errno) {
+				continue;
+			}
+			RA_TRACE("system failure detected");
+			break;
+		}
+		now = ra_time();
+		for (i=0; i<n; ++i) {
+			if (!events[i].data.ptr) {
+				stop = 1;
+				continue;
+			}
+			if (*((const int *)events[i].data.ptr)) {
+				server = (struct server *)events[i].data.ptr;
+				accept_(reactor, server);
+				continue;
+			}
+			network = (struct ra_network *)events[i].data.ptr;
+			if (events[i].events & ~EPOLLOUT) {
+				readable(reactor, network);
+			}
+			if (!network->e && (events[i].events & EPOLLOUT)) {
+				queued = network->out.len;
+				if (!drain(network) &&
+				    queued &&
+				    !network->out.len &&
+				    reactor->fnc(reactor->ctx,
+						 network,
+						 RA_NETWORK_WRITABLE)) {
+					network->e = -1;
+				}
+			}
+			if (!network->e &&
+			    network->more &&
+			    (READ_MAX > network->in.len)) {
+				readable(reactor, network); /* consumed since */
+			}
+			if (network->e) {
+				drop(reactor, network);
+				continue;
+			}
+			arm(reactor, network, now);
+		}
+		if (ra_timer_pending(reactor->timer)) {
+			ra_timer_advance(reactor->timer, ra_time());
+		}
+	}
+	while (reactor->connections) {
+		drop(reactor, reactor->connections);
+	}
+}
 
-	while (len) {
-		if (0 >= (n = read(network->fd, buf, len))) {
-			RA_TRACE("network read failed");
+static int
+listen_events(const char *hostname,
+	      const char *servname,
+	      ra_network_event_fnc_t fnc,
+	      void *ctx,
+	      int stop)
+{
+	struct ra_network *network;
+	struct epoll_event event;
+	struct reactor *reactor;
+	struct server *server;
+	int i;
+
+	/* initialize */
+
+	if (!(network = malloc(sizeof (struct ra_network)))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(network, 0, sizeof (struct ra_network));
+
+	/* listen: one socket per reactor */
+
+	if (listeners(network, hostname, servname, ra_cores(), 1)) {
+		ra_network_close(network);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* reactors: each watches its own shard, or shares an unsharded one */
+
+	network->reactors_n = ra_cores();
+	if (!(network->reactors = malloc(network->reactors_n *
+					 sizeof (struct reactor)))) {
+		network->reactors_n = 0;
+		ra_network_close(network);
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(network->reactors,
+	       0,
+	       network->reactors_n * sizeof (struct reactor));
+	for (i=0; i<network->reactors_n; ++i) {
+		reactor = &network->reactors[i];
+		reactor->epfd = reactor->efd = -1;
+		reactor->ctx = ctx;
+		reactor->fnc = fnc;
+		reactor->parent = network;
+	}
+	for (i=0; i<network->reactors_n; ++i) {
+		reactor = &network->reactors[i];
+		if ((0 > (reactor->epfd = epoll_create1(0))) ||
+		    (0 > (reactor->efd = eventfd(0, EFD_NONBLOCK)))) {
+			ra_network_close(network);
+			RA_TRACE("system failure detected");
+			return -1;
+		}
+		if (!(reactor->timer = ra_timer_open(TICK))) {
+			ra_network_close(network);
+			RA_TRACE("^");
+			return -1;
+		}
+		memset(&event, 0, sizeof (struct epoll_event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		if (epoll_ctl(reactor->epfd,
+			      EPOLL_CTL_ADD,
+			      reactor->efd,
+			      &event)) {
+			ra_network_close(network);
+			RA_TRACE("system failure detected");
+			return -1;
+		}
+		for (server=network->servers; server; server=server->link) {
+			if ((server->shards == network->reactors_n) &&
+			    (server->shard != i)) {
+				continue;
+			}
+			event.events = EPOLLIN | EPOLLEXCLUSIVE;
+			event.data.ptr = server;
+			if (epoll_ctl(reactor->epfd,
+				      EPOLL_CTL_ADD,
+				      server->fd,
+				      &event)) {
+				ra_network_close(network);
+				RA_TRACE("system failure detected");
+				return -1;
+			}
+		}
+	}
+	for (i=0; i<network->reactors_n; ++i) {
+		reactor = &network->reactors[i];
+		if (!(reactor->thread = ra_thread_open(_reactor_, reactor))) {
+			ra_network_close(network);
+			RA_TRACE("^");
 			return -1;
 		}
-		buf += (size_t)n;
-		len -= (size_t)n;
 	}
+
+	/* wait */
+
+	block(stop);
+	ra_network_close(network);
 	return 0;
 }
 
 int
-ra_network_write(ra_network_t network, const void *buf_, size_t len)
+ra_network_listen_events(const char *hostname,
+			 const char *servname,
+			 ra_network_event_fnc_t fnc,
+			 void *ctx)
 {
-	const char *buf = (const char *)buf_;
-	ssize_t n;
+	int e, stop;
 
-	assert( network && (!len || buf) );
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+	assert( fnc );
 
-	while (len) {
-		if (0 >= (n = write(network->fd, buf, len))) {
-			RA_TRACE("network write failed");
-			return -1;
+	if (0 > (e = enter(&stop))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (e) {
+		return 0; /* stopped before it started */
+	}
+	if (listen_events(hostname, servname, fnc, ctx, stop)) {
+		leave();
+		RA_TRACE("^");
+		return -1;
+	}
+	leave();
+	return 0;
+}
+
+#else /* __linux__ */
+
+static int
+drain(struct ra_network *network)
+{
+	(void)network;
+	return 0;
+}
+
+static void
+arm(struct reactor *reactor, struct ra_network *network, uint64_t now)
+{
+	(void)reactor;
+	(void)network;
+	(void)now;
+}
+
+int
+ra_network_listen_events(const char *hostname,
+			 const char *servname,
+			 ra_network_event_fnc_t fnc,
+			 void *ctx)
+{
+	(void)hostname;
+	(void)servname;
+	(void)fnc;
+	(void)ctx;
+	RA_TRACE("event-driven server not supported");
+	return -1;
+}
+
+#endif /* __linux__ */
+
+void
+ra_network_stop(void)
+{
+	pthread_mutex_lock(&_mutex_);
+	if (!_listeners_) {
+		_latch_ = 1;
+	}
+	__sync_fetch_and_add(&_stop_, 1);
+	pthread_mutex_unlock(&_mutex_);
+	wakeup();
+}
+
+static struct ra_network *
+dial(const struct address *addresses, int n)
+{
+	struct ra_network *network;
+	int i, fd;
+
+	/* initialize */
+
+	if (!(network = malloc(sizeof (struct ra_network)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(network, 0, sizeof (struct ra_network));
+
+	/* open */
+
+	fd = 0;
+	for (i=0; i<n; ++i) {
+		if (!(fd = osocket(addresses[i].family,
+				   addresses[i].socktype,
+				   addresses[i].protocol)) ||
+		    (0 > connect(fd,
+				 (const struct sockaddr *)&addresses[i].addr,
+				 addresses[i].len))) {
+			sclose(fd);
+			fd = 0;
+			continue;
 		}
-		buf += (size_t)n;
-		len -= (size_t)n;
+		break;
+	}
+
+	/* connected? */
+
+	if (!fd) {
+		ra_network_close(network);
+		RA_TRACE("unable to connect to network");
+		return NULL;
+	}
+	network->fd = fd;
+	network->local = (AF_UNIX == addresses[i].family);
+	return network;
+}
+
+ra_network_t
+ra_network_connect(const char *hostname, const char *servname)
+{
+	struct address addresses[ADDRESSES];
+	struct ra_network *network;
+	int n;
+
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+
+	if ((0 >= (n = resolve(hostname, servname, addresses, 0))) ||
+	    !(network = dial(addresses, n))) {
+		RA_TRACE("^");
+		return NULL;
+	}
+	return network;
+}
+
+static void
+expire(struct peer *peer)
+{
+	while (peer->idle_n) {
+		--peer->idle_n;
+		ra_network_close(peer->idle[peer->idle_n].network);
 	}
+}
+
+static int
+_release_(void *ctx, const char *key, void *val)
+{
+	(void)ctx;
+	(void)key;
+	expire((struct peer *)val);
+	RA_FREE(val);
 	return 0;
 }
 
-int /* BOOL */
-ra_network_is_valid(const char *address)
+ra_network_pool_t
+ra_network_pool_open(int idle_max, uint64_t timeout)
 {
-	struct in6_addr ipv6;
-	struct in_addr ipv4;
+	struct ra_network_pool *pool;
 
-	if ((1 == inet_pton(AF_INET, address, &ipv4)) ||
-	    (1 == inet_pton(AF_INET6, address, &ipv6))) {
-		return 1;
+	assert( 0 < idle_max );
+
+	if (!(pool = malloc(sizeof (struct ra_network_pool)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(pool, 0, sizeof (struct ra_network_pool));
+	pool->idle_max = idle_max;
+	pool->timeout = timeout;
+	if (!(pool->peers = ra_map_open()) ||
+	    !(pool->mutex = ra_mutex_open())) {
+		ra_network_pool_close(pool);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return pool;
+}
+
+void
+ra_network_pool_close(ra_network_pool_t pool)
+{
+	if (pool) {
+		if (pool->peers) {
+			ra_map_iterate(pool->peers, _release_, NULL);
+			ra_map_close(pool->peers);
+		}
+		ra_mutex_close(pool->mutex);
+		memset(pool, 0, sizeof (struct ra_network_pool));
+		RA_FREE(pool);
+	}
+}
+
+static int /* BOOL */
+alive(struct ra_network *network)
+{
+	ssize_t n;
+	char c;
+
+	/* an idle connection must have nothing to read, not even EOF */
+
+	n = recv(network->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return (0 > n) && ((EAGAIN == errno) || (EWOULDBLOCK == errno));
+}
+
+ra_network_t
+ra_network_checkout(ra_network_pool_t pool,
+		    const char *hostname,
+		    const char *servname)
+{
+	const int KEEPALIVE = 1;
+	struct address addresses[ADDRESSES];
+	struct ra_network *network;
+	struct peer *peer;
+	uint64_t now;
+	char key[512];
+	int n;
+
+	assert( pool );
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+	assert( sizeof (key) > (strlen(hostname) +
+				(servname ? strlen(servname) : 0) +
+				1) );
+
+	ra_sprintf(key,
+		   sizeof (key),
+		   "%s:%s",
+		   hostname,
+		   servname ? servname : "");
+	for (;;) {
+
+		/* most recently used idle connection, else cached address */
+
+		network = NULL;
+		now = ra_time();
+		ra_mutex_lock(pool->mutex);
+		if (!(peer = ra_map_lookup(pool->peers, key))) {
+			if (!(peer = malloc(sizeof (struct peer) +
+					    (pool->idle_max - 1) *
+					    sizeof (struct idle)))) {
+				ra_mutex_unlock(pool->mutex);
+				RA_TRACE("out of memory");
+				return NULL;
+			}
+			memset(peer, 0, sizeof (struct peer));
+			if (ra_map_update(pool->peers, key, peer)) {
+				ra_mutex_unlock(pool->mutex);
+				RA_FREE(peer);
+				RA_TRACE("^");
+				return NULL;
+			}
+		}
+		if (peer->idle_n) {
+			--peer->idle_n;
+			network = peer->idle[peer->idle_n].network;
+			if ((now - peer->idle[peer->idle_n].time) >
+			    pool->timeout) {
+				ra_network_close(network);
+				network = NULL;
+				expire(peer); /* older still */
+			}
+		}
+		n = 0;
+		if ((now - peer->resolved) <= RESOLVE_TTL) {
+			n = peer->n;
+			memcpy(addresses, peer->addresses, sizeof (addresses));
+		}
+		ra_mutex_unlock(pool->mutex);
+		if (!network) {
+			break;
+		}
+		if (alive(network)) {
+			return network;
+		}
+		ra_network_close(network);
+	}
+
+	/* resolve outside the lock, then publish */
+
+	if (!n) {
+		if (0 >= (n = resolve(hostname, servname, addresses, 0))) {
+			RA_TRACE("^");
+			return NULL;
+		}
+		ra_mutex_lock(pool->mutex);
+		peer->n = n;
+		peer->resolved = now;
+		memcpy(peer->addresses, addresses, sizeof (addresses));
+		ra_mutex_unlock(pool->mutex);
+	}
+	if (!(network = dial(addresses, n))) {
+		ra_mutex_lock(pool->mutex);
+		peer->resolved = 0; /* stale? resolve again next time */
+		ra_mutex_unlock(pool->mutex);
+		RA_TRACE("^");
+		return NULL;
+	}
+	if (0 > setsockopt(network->fd,
+			   SOL_SOCKET,
+			   SO_KEEPALIVE,
+			   (const void *)&KEEPALIVE,
+			   sizeof (KEEPALIVE))) {
+		RA_TRACE("system failure detected (ignored)");
+	}
+	network->peer = peer;
+	return network;
+}
+
+void
+ra_network_checkin(ra_network_pool_t pool,
+		   ra_network_t network,
+		   int /* BOOL */ reuse)
+{
+	struct ra_network *evict;
+	struct peer *peer;
+
+	assert( pool );
+
+	if (!network) {
+		return;
+	}
+
+	/* only a clean connection goes back: nothing queued, nothing unread */
+
+	if (!reuse ||
+	    !network->peer ||
+	    network->in.len ||
+	    (network->out.len && ra_network_flush(network))) {
+		ra_network_close(network);
+		return;
+	}
+	evict = NULL;
+	peer = network->peer;
+	ra_mutex_lock(pool->mutex);
+	if (peer->idle_n == pool->idle_max) {
+		evict = peer->idle[0].network;
+		memmove(&peer->idle[0],
+			&peer->idle[1],
+			(peer->idle_n - 1) * sizeof (struct idle));
+		--peer->idle_n;
+	}
+	peer->idle[peer->idle_n].time = ra_time();
+	peer->idle[peer->idle_n].network = network;
+	++peer->idle_n;
+	ra_mutex_unlock(pool->mutex);
+	ra_network_close(evict);
+}
+
+void
+ra_network_close(ra_network_t network)
+{
+	const uint64_t one = 1;
+	struct server *server, *server_;
+	struct reactor *reactor;
+	struct client *client;
+	int i, fd;
+
+	if (network) {
+		for (i=0; i<network->reactors_n; ++i) {
+			reactor = &network->reactors[i];
+			if ((0 <= reactor->efd) &&
+			    (0 > write(reactor->efd, &one, sizeof (one)))) {
+				RA_TRACE("system failure detected (ignored)");
+			}
+		}
+		for (i=0; i<network->reactors_n; ++i) {
+			reactor = &network->reactors[i];
+			ra_thread_close(reactor->thread);
+			if (0 <= reactor->efd) {
+				close(reactor->efd);
+			}
+			if (0 <= reactor->epfd) {
+				close(reactor->epfd);
+			}
+			ra_timer_close(reactor->timer);
+		}
+		RA_FREE(network->reactors);
+		if (network->out.len && ra_network_flush(network)) {
+			RA_TRACE("^ (ignored)");
+		}
+		RA_FREE(network->in.buf);
+		RA_FREE(network->out.buf);
+		while (network->fds_n) {
+			close(network->fds[--network->fds_n]);
+		}
+		sclose(network->fd);
+		for (server=network->servers; server; server=server->link) {
+			fd = __sync_lock_test_and_set(&server->fd, 0);
+			sclose(fd);
+			ra_thread_close(server->thread);
+		}
+		ra_scheduler_close(network->scheduler); /* clients hold slots */
+		server = network->servers;
+		while (server) {
+			server_ = server;
+			server = server->link;
+			while (server_->slots &&
+			       (client = ra_queue_pop(server_->slots))) {
+				memset(client, 0, sizeof (struct client));
+				RA_FREE(client);
+			}
+			ra_queue_close(server_->slots);
+			if (server_->path) {
+				unlink(server_->path);
+				RA_FREE(server_->path);
+			}
+			memset(server_, 0, sizeof (struct server));
+			RA_FREE(server_);
+		}
+		memset(network, 0, sizeof (struct ra_network));
+		RA_FREE(network);
+	}
+}
+
+static ssize_t
+receive(struct ra_network *network, struct iovec *iov, int n)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(FDS * sizeof (int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	const int *fds;
+	ssize_t r;
+	size_t i, m;
+
+	/* keep descriptors that ride along, in order */
+
+	memset(&msg, 0, sizeof (struct msghdr));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+	if (0 >= (r = recvmsg(network->fd, &msg, 0))) {
+		return r;
+	}
+	for (cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg)) {
+		if ((SOL_SOCKET != cmsg->cmsg_level) ||
+		    (SCM_RIGHTS != cmsg->cmsg_type)) {
+			continue;
+		}
+		fds = (const int *)CMSG_DATA(cmsg);
+		m = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+		for (i=0; i<m; ++i) {
+			if (FDS > network->fds_n) {
+				network->fds[network->fds_n++] = fds[i];
+			}
+			else {
+				close(fds[i]);
+			}
+		}
+	}
+	return r;
+}
+
+/*
+ * Would-block I/O waits for the fd no longer than the deadline of the
+ * operation under way, nor than idle.
+ */
+
+static int
+wait_(struct ra_network *network, int write)
+{
+	return ra_fiber_wait_until(network->fd,
+				   write,
+				   sooner(network->deadline,
+					  after(network->idle)));
+}
+
+static ssize_t
+io(struct ra_network *network, struct iovec *iov, int n, int write)
+{
+	ssize_t r;
+
+	for (;;) {
+		r = write ?
+			writev(network->fd, iov, n) :
+			network->local ?
+			receive(network, iov, n) :
+			readv(network->fd, iov, n);
+		if (0 <= r) {
+			return r;
+		}
+		if ((EINTR != errno) &&
+		    ((EAGAIN != errno) || wait_(network, write))) {
+			return -1;
+		}
+	}
+}
+
+static int
+gather(struct ra_network *network, struct iovec *iov, int n)
+{
+	size_t k;
+	ssize_t r;
+
+	while (n) {
+		if (!iov->iov_len) {
+			++iov;
+			--n;
+			continue;
+		}
+		if (0 >= (r = io(network, iov, n, 1))) {
+			return -1;
+		}
+		while (n && ((size_t)r >= iov->iov_len)) {
+			r -= (ssize_t)iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (r) {
+			k = (size_t)r;
+			iov->iov_base = (char *)iov->iov_base + k;
+			iov->iov_len -= k;
+		}
+	}
+	return 0;
+}
+
+int
+ra_network_read(ra_network_t network, void *buf_, size_t len)
+{
+	char *buf = (char *)buf_;
+	struct buffer *buffer;
+	struct iovec iov[2];
+	size_t len_;
+	ssize_t n;
+
+	assert( network && (!len || buf) );
+
+	/* a reply cannot arrive before the request leaves */
+
+	if (network->out.len &&
+	    (network->in.len < len) &&
+	    ra_network_flush(network)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	buffer = &network->in;
+	network->deadline = after(network->read);
+	len_ = len;
+	n = (ssize_t)ra_network_recv(network, buf, len);
+	buf += (size_t)n;
+	len -= (size_t)n;
+
+	/* read the rest and the read-ahead in one call */
+
+	if (len && reserve(buffer, CHUNK)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	while (len) {
+		iov[0].iov_base = buf;
+		iov[0].iov_len = len;
+		iov[1].iov_base = buffer->buf;
+		iov[1].iov_len = buffer->cap;
+		if (!(n = io(network, iov, 2, 0)) && (len == len_)) {
+			errno = 0; /* closed at a message boundary */
+			return -1;
+		}
+		if (0 >= n) {
+			RA_TRACE("network read failed");
+			return -1;
+		}
+		if ((size_t)n > len) {
+			buffer->off = 0;
+			buffer->len = (size_t)n - len;
+			n = (ssize_t)len;
+		}
+		buf += (size_t)n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int
+ra_network_write(ra_network_t network, const void *buf, size_t len)
+{
+	assert( network && (!len || buf) );
+
+	if (ra_network_writev(network, 1, &buf, &len)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_writev(ra_network_t network,
+		  int n,
+		  const void * const *bufs,
+		  const size_t *lens)
+{
+	struct iovec iov[WRITEV_MAX_N];
+	struct buffer *buffer;
+	size_t len;
+	int i;
+
+	assert( network && (0 <= n) && (WRITEV_MAX_N > n) );
+	assert( !n || (bufs && lens) );
+
+	len = 0;
+	buffer = &network->out;
+	for (i=0; i<n; ++i) {
+		len += lens[i];
+	}
+
+	/* coalesce small writes */
+
+	if ((buffer->len + len) <= BUFFER) {
+		if (reserve(buffer, len)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		for (i=0; i<n; ++i) {
+			memcpy(buffer->buf + buffer->off + buffer->len,
+			       bufs[i],
+			       lens[i]);
+			buffer->len += lens[i];
+		}
+		return 0;
+	}
+
+	/* pending output and the new pieces in one call */
+
+	iov[0].iov_base = buffer->buf + buffer->off;
+	iov[0].iov_len = buffer->len;
+	for (i=0; i<n; ++i) {
+		iov[i + 1].iov_base = (void *)bufs[i];
+		iov[i + 1].iov_len = lens[i];
+	}
+	buffer->off = buffer->len = 0;
+	network->deadline = after(network->write);
+	if (gather(network, iov, n + 1)) {
+		RA_TRACE("network write failed");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_flush(ra_network_t network)
+{
+	struct buffer *buffer;
+	struct iovec iov[1];
+
+	assert( network );
+
+	buffer = &network->out;
+	if (network->reactor) {
+		return 0; /* the reactor drains */
+	}
+	iov[0].iov_base = buffer->buf + buffer->off;
+	iov[0].iov_len = buffer->len;
+	buffer->off = buffer->len = 0;
+	network->deadline = after(network->write);
+	if (gather(network, iov, 1)) {
+		RA_TRACE("network write failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The sendfile() to use is a parameter, so that the test can stand in one
+ * that fails as an unsupported source would (NULL where there is none).
+ */
+
+#if defined(__linux__)
+#define SENDFILE sendfile
+#else
+#define SENDFILE NULL
+#endif /* __linux__ */
+
+typedef ssize_t (*sendfile_t)(int, int, off_t *, size_t);
+
+static int
+zerocopy(struct ra_network *network,
+	 int fd,
+	 uint64_t *off,
+	 uint64_t *len,
+	 sendfile_t sendfile_)
+{
+	ssize_t n;
+	off_t o;
+
+	while (sendfile_ && (*len)) {
+		o = (off_t)(*off);
+		n = sendfile_(network->fd,
+			      fd,
+			      &o,
+			      (size_t)RA_MIN(*len, SENDFILE_MAX));
+		if (0 < n) {
+			(*off) += (uint64_t)n;
+			(*len) -= (uint64_t)n;
+			continue;
+		}
+		if (!n) {
+			RA_TRACE("unexpected end of file");
+			return -1;
+		}
+		if ((EINTR == errno) ||
+		    ((EAGAIN == errno) && !wait_(network, 1))) {
+			continue;
+		}
+		if ((EINVAL == errno) || (ENOSYS == errno)) {
+			return 0; /* unsupported source: copy the rest */
+		}
+		RA_TRACE("network write failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+copy(struct ra_network *network,
+     int fd,
+     ra_device_t device,
+     uint64_t off,
+     uint64_t len)
+{
+	struct iovec iov[1];
+	uint64_t n;
+	void *buf_;
+	char *buf;
+	ssize_t r;
+	int e;
+
+	if (!len) {
+		return 0;
+	}
+	if (!(buf_ = malloc(COPY + ra_page()))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	buf = ra_align(buf_, ra_page()); /* O_DIRECT devices */
+	e = 0;
+	while (!e && len) {
+		n = RA_MIN(len, COPY); /* COPY is a multiple of any block */
+		if (device) {
+			if (ra_device_read(device, buf, off, n)) {
+				e = -1;
+				break;
+			}
+		}
+		else {
+			if (0 >= (r = pread(fd, buf, (size_t)n, (off_t)off))) {
+				RA_TRACE("unable to read file");
+				e = -1;
+				break;
+			}
+			n = (uint64_t)r;
+		}
+		iov[0].iov_base = buf;
+		iov[0].iov_len = (size_t)n;
+		if (gather(network, iov, 1)) {
+			RA_TRACE("network write failed");
+			e = -1;
+		}
+		off += n;
+		len -= n;
+	}
+	RA_FREE(buf_);
+	return e;
+}
+
+static int
+file_(struct ra_network *network,
+      const char *pathname,
+      uint64_t off,
+      uint64_t len,
+      sendfile_t sendfile_)
+{
+	int fd;
+
+	if (ra_network_flush(network)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (0 > (fd = open(pathname, O_RDONLY))) {
+		RA_TRACE("unable to open file");
+		return -1;
+	}
+	network->deadline = after(network->write);
+	if (zerocopy(network, fd, &off, &len, sendfile_) ||
+	    copy(network, fd, NULL, off, len)) {
+		close(fd);
+		RA_TRACE("^");
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int
+device_(struct ra_network *network,
+	ra_device_t device,
+	uint64_t off,
+	uint64_t len,
+	sendfile_t sendfile_)
+{
+	if (ra_network_flush(network)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	network->deadline = after(network->write);
+	if ((0 <= ra_device_fd(device)) &&
+	    zerocopy(network, ra_device_fd(device), &off, &len, sendfile_)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (copy(network, -1, device, off, len)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_sendfile(ra_network_t network,
+		    const char *pathname,
+		    uint64_t off,
+		    uint64_t len)
+{
+	assert( network && !network->reactor );
+	assert( pathname && (*pathname) );
+
+	if (file_(network, pathname, off, len, SENDFILE)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_send_device(ra_network_t network,
+		       ra_device_t device,
+		       uint64_t off,
+		       uint64_t len)
+{
+	assert( network && !network->reactor );
+	assert( device );
+	assert( 0 == (off % ra_device_block(device)) );
+	assert( 0 == (len % ra_device_block(device)) );
+	assert( ra_device_size(device) >= (off + len) );
+
+	if (device_(network, device, off, len, SENDFILE)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_send_fd(ra_network_t network, int fd)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof (int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char c;
+
+	assert( network && network->local && !network->reactor );
+	assert( 0 <= fd );
+
+	if (ra_network_flush(network)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	network->deadline = after(network->write);
+	c = 0;
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	memset(&control, 0, sizeof (control));
+	memset(&msg, 0, sizeof (struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof (int));
+	while (0 >= sendmsg(network->fd, &msg, 0)) {
+		if ((EINTR != errno) &&
+		    ((EAGAIN != errno) || wait_(network, 1))) {
+			RA_TRACE("network write failed");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+ra_network_recv_fd(ra_network_t network)
+{
+	int i, fd;
+	char c;
+
+	assert( network && network->local && !network->reactor );
+
+	/* the marker byte is read in stream order; its descriptor came along */
+
+	if (ra_network_read(network, &c, 1)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (!network->fds_n) {
+		RA_TRACE("no file descriptor received");
+		return -1;
+	}
+	fd = network->fds[0];
+	for (i=1; i<network->fds_n; ++i) {
+		network->fds[i - 1] = network->fds[i];
+	}
+	--network->fds_n;
+	return fd;
+}
+
+size_t
+ra_network_recv(ra_network_t network, void *buf, size_t len)
+{
+	struct buffer *buffer;
+
+	assert( network && (!len || buf) );
+
+	buffer = &network->in;
+	if (!(len = RA_MIN(len, buffer->len))) {
+		return 0;
+	}
+	memcpy(buf, buffer->buf + buffer->off, len);
+	buffer->off += len;
+	buffer->len -= len;
+	if (!buffer->len) {
+		buffer->off = 0;
+	}
+	return len;
+}
+
+size_t
+ra_network_pending(ra_network_t network)
+{
+	assert( network );
+
+	return network->in.len;
+}
+
+int
+ra_network_send(ra_network_t network, const void *buf_, size_t len)
+{
+	const char *buf = (const char *)buf_;
+	struct buffer *buffer;
+
+	assert( network && (!len || buf) );
+
+	if (!network->reactor) {
+		if (ra_network_write(network, buf, len)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		return 0;
+	}
+	if (network->e) {
+		RA_TRACE("network write failed");
+		return -1;
+	}
+
+	/* queue behind pending output; the reactor drains on EPOLLOUT */
+
+	buffer = &network->out;
+	if (reserve(buffer, len)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	memcpy(buffer->buf + buffer->off + buffer->len, buf, len);
+	buffer->len += len;
+	if (drain(network)) {
+		RA_TRACE("network write failed");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_network_timeout(ra_network_t network,
+		   uint64_t idle,
+		   uint64_t read,
+		   uint64_t write)
+{
+	int flags;
+
+	assert( network );
+
+	network->idle = idle;
+	network->read = read;
+	network->write = write;
+	if (network->reactor) {
+		arm(network->reactor, network, ra_time());
+		return 0;
+	}
+
+	/* a deadline needs would-block I/O to wait on */
+
+	if ((idle || read || write) &&
+	    ((0 > (flags = fcntl(network->fd, F_GETFL))) ||
+	     (0 > fcntl(network->fd, F_SETFL, flags | O_NONBLOCK)))) {
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+void **
+ra_network_user(ra_network_t network)
+{
+	assert( network );
+
+	return &network->user;
+}
+
+int /* BOOL */
+ra_network_is_valid(const char *address)
+{
+	struct in6_addr ipv6;
+	struct in_addr ipv4;
+
+	if ((1 == inet_pton(AF_INET, address, &ipv4)) ||
+	    (1 == inet_pton(AF_INET6, address, &ipv6))) {
+		return 1;
+	}
+	return 0;
+}
+
+#define MESSAGE_MAX 65536
+#define BUCKETS (64 * 16) /* log-linear, 16 per power of two */
+
+struct session {
+	int header; /* read, awaiting the payload */
+	uint32_t len;
+	uint32_t reply;
+	char buf[MESSAGE_MAX];
+};
+
+struct listener {
+	int e;
+	int events;
+	const char *servname;
+};
+
+struct load {
+	volatile int e;
+	uint32_t len; /* request payload */
+	uint32_t reply; /* reply bytes, the payload echoed first */
+	int requests; /* per client */
+	const char *servname;
+	uint64_t counts[BUCKETS]; /* round trips, ns */
+};
+
+static int
+respond(struct ra_network *network, char *buf, uint32_t len, uint32_t reply)
+{
+	if (len < reply) {
+		memset(buf + len, 0, reply - len);
+	}
+	return ra_network_send(network, buf, reply);
+}
+
+/* header { len, reply } in network byte order, then len bytes */
+
+static void
+_serve_(void *ctx, ra_network_t network)
+{
+	uint32_t header[2];
+	char *buf;
+
+	(void)ctx;
+	if (!(buf = malloc(MESSAGE_MAX))) {
+		RA_TRACE("out of memory");
+		return;
+	}
+	while (!ra_network_read(network, header, sizeof (header))) {
+		header[0] = ntohl(header[0]);
+		header[1] = ntohl(header[1]);
+		if ((MESSAGE_MAX < header[0]) ||
+		    (MESSAGE_MAX < header[1]) ||
+		    ra_network_read(network, buf, header[0]) ||
+		    respond(network, buf, header[0], header[1])) {
+			break;
+		}
+	}
+	RA_FREE(buf);
+}
+
+static int
+_session_(void *ctx, ra_network_t network, ra_network_event_t event)
+{
+	struct session *session;
+	uint32_t header[2];
+	void **user;
+
+	(void)ctx;
+	user = ra_network_user(network);
+	if (RA_NETWORK_OPEN == event) {
+		if (!((*user) = malloc(sizeof (struct session)))) {
+			RA_TRACE("out of memory");
+			return -1;
+		}
+		memset((*user), 0, sizeof (struct session));
+		return 0;
+	}
+	if (RA_NETWORK_CLOSE == event) {
+		RA_FREE(*user);
+		return 0;
+	}
+	session = (struct session *)(*user);
+	while (RA_NETWORK_READABLE == event) {
+		if (!session->header) {
+			if (sizeof (header) > ra_network_pending(network)) {
+				break;
+			}
+			ra_network_recv(network, header, sizeof (header));
+			session->len = ntohl(header[0]);
+			session->reply = ntohl(header[1]);
+			if ((MESSAGE_MAX < session->len) ||
+			    (MESSAGE_MAX < session->reply)) {
+				return -1;
+			}
+			session->header = 1;
+		}
+		if (session->len > ra_network_pending(network)) {
+			break;
+		}
+		ra_network_recv(network, session->buf, session->len);
+		session->header = 0;
+		if (respond(network,
+			    session->buf,
+			    session->len,
+			    session->reply)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+_listen_(void *ctx)
+{
+	struct listener *listener;
+
+	listener = (struct listener *)ctx;
+	if (listener->events ?
+	    ra_network_listen_events("localhost",
+				     listener->servname,
+				     _session_,
+				     NULL) :
+	    ra_network_listen("localhost", listener->servname, _serve_, NULL)) {
+		listener->e = -1;
+	}
+}
+
+/*
+ * Starts a threaded and an event-driven server (listeners[0, 1]) and
+ * returns once both accept connections.
+ */
+
+static int
+serve(struct listener *listeners, ra_thread_t *threads)
+{
+	ra_network_t network;
+	int i, j;
+
+	threads[0] = threads[1] = NULL;
+	for (i=0; i<2; ++i) {
+		listeners[i].e = 0;
+		listeners[i].events = i;
+		if (!(threads[i] = ra_thread_open(_listen_, &listeners[i]))) {
+			ra_network_stop();
+			ra_thread_close(threads[0]);
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	for (i=0; i<2; ++i) {
+		network = NULL;
+		for (j=0; !network && (j<100); ++j) {
+			ra_sleep(10000);
+			network = ra_network_connect("localhost",
+						     listeners[i].servname);
+		}
+		if (!network) {
+			ra_network_stop();
+			ra_thread_close(threads[0]);
+			ra_thread_close(threads[1]);
+			RA_TRACE("^");
+			return -1;
+		}
+		ra_network_close(network);
+	}
+	return 0;
+}
+
+#if defined(__linux__)
+static int _refuse_; /* errno of the stand-in sendfile() after one call */
+static int _calls_;
+
+static ssize_t
+_refusing_(int out, int in, off_t *off, size_t len)
+{
+	if (!_calls_++) {
+		return sendfile(out, in, off, RA_MIN(len, 4096));
+	}
+	errno = _refuse_;
+	return -1;
+}
+#endif /* __linux__ */
+
+/*
+ * BURST full-size echo requests written before any reply is read: more
+ * input than the event server buffers at once.
+ */
+
+#define BURST 32
+
+static int
+burst(const char *servname)
+{
+	ra_network_t network;
+	const void *bufs[2];
+	uint32_t header[2];
+	size_t lens[2];
+	char *buf;
+	int i, e;
+
+	if (!(buf = malloc(MESSAGE_MAX))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	if (!(network = ra_network_connect("localhost", servname))) {
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+	e = ra_network_timeout(network, 0, 5000000, 5000000);
+	header[0] = header[1] = htonl(MESSAGE_MAX);
+	bufs[0] = header;
+	bufs[1] = buf;
+	lens[0] = sizeof (header);
+	lens[1] = MESSAGE_MAX;
+	for (i=0; !e && (i<BURST); ++i) {
+		memset(buf, i, MESSAGE_MAX);
+		if (ra_network_writev(network, 2, bufs, lens)) {
+			e = -1;
+		}
+	}
+	if (ra_network_flush(network)) {
+		e = -1;
+	}
+	for (i=0; !e && (i<BURST); ++i) {
+		if (ra_network_read(network, buf, MESSAGE_MAX) ||
+		    ((char)i != buf[0]) ||
+		    ((char)i != buf[MESSAGE_MAX - 1])) {
+			e = -1;
+		}
+	}
+	ra_network_close(network);
+	RA_FREE(buf);
+	return e;
+}
+
+/*
+ * One echo request whose len bytes at off come from the file at pathname
+ * (or from device, if not NULL) after the header, still buffered; the
+ * echo must match expected. A sendfile_ other than NULL stands in for
+ * sendfile().
+ */
+
+static int
+transfer(const char *pathname,
+	 ra_device_t device,
+	 uint64_t off,
+	 uint32_t len,
+	 const char *expected,
+	 sendfile_t sendfile_)
+{
+	ra_network_t network;
+	uint32_t header[2];
+	char *buf;
+	int e;
+
+	if (!(buf = malloc(len))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	if (!(network = ra_network_connect("localhost", "47012"))) {
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+	header[0] = header[1] = htonl(len);
+	if (ra_network_write(network, header, sizeof (header))) {
+		e = -1;
+	}
+	else if (!sendfile_) {
+		e = device ?
+			ra_network_send_device(network, device, off, len) :
+			ra_network_sendfile(network, pathname, off, len);
+	}
+	else {
+		e = device ?
+			device_(network, device, off, len, sendfile_) :
+			file_(network, pathname, off, len, sendfile_);
+	}
+	if (e ||
+	    ra_network_read(network, buf, len) ||
+	    memcmp(buf, expected, len)) {
+		e = -1;
+	}
+	ra_network_close(network);
+	RA_FREE(buf);
+	return e;
+}
+
+/*
+ * Files and devices (on file and in memory) through sendfile() and the
+ * copy fallback, forced on Linux by a stand-in sendfile() that sends one
+ * piece and then fails as an unsupported source would.
+ */
+
+static int
+transfers(void)
+{
+	const uint64_t SIZE = 1024 * 1024;
+	ra_device_t device, memory;
+	const char *pathname;
+	char *buf, *data;
+	uint64_t off;
+	int e;
+#if defined(__linux__)
+	const int ERRNOS[] = { EINVAL, ENOSYS };
+	unsigned i;
+#endif /* __linux__ */
+
+	/* initialize */
+
+	e = 0;
+	device = memory = NULL;
+	if (!(buf = malloc(SIZE + ra_page()))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	data = ra_align(buf, ra_page()); /* O_DIRECT */
+	for (off=0; off<SIZE; ++off) {
+		data[off] = (char)(off * 7 + off / 251);
+	}
+	if (!(pathname = ra_pathname(".dev")) ||
+	    ra_device_create(pathname, SIZE) ||
+	    !(device = ra_device_open(pathname)) ||
+	    ra_device_write(device, data, 0, SIZE) ||
+	    !(memory = ra_device_open_memory(SIZE, 512, 0)) ||
+	    ra_device_write(memory, data, 0, SIZE)) {
+		ra_device_close(device);
+		ra_unlink(pathname);
+		RA_FREE(pathname);
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* zero-copy, and the copy for memory devices */
+
+	off = 8 * ra_device_block(device);
+	if (transfer(pathname, NULL, 1234, 60000, data + 1234, NULL) ||
+	    transfer(NULL, device, off, MESSAGE_MAX, data + off, NULL) ||
+	    transfer(NULL, memory, 4096, MESSAGE_MAX, data + 4096, NULL)) {
+		e = -1;
+	}
+
+	/* unsupported sources: the rest is copied (O_DIRECT, aligned) */
+
+#if defined(__linux__)
+	for (i=0; i<RA_ARRAY_SIZE(ERRNOS); ++i) {
+		_refuse_ = ERRNOS[i];
+		_calls_ = 0;
+		if (transfer(pathname,
+			     NULL,
+			     1234,
+			     60000,
+			     data + 1234,
+			     _refusing_) ||
+		    (2 != _calls_)) {
+			e = -1;
+		}
+		_calls_ = 0;
+		if (transfer(NULL,
+			     device,
+			     off,
+			     MESSAGE_MAX,
+			     data + off,
+			     _refusing_) ||
+		    (2 != _calls_)) {
+			e = -1;
+		}
+	}
+#endif /* __linux__ */
+
+	ra_device_close(memory);
+	ra_device_close(device);
+	ra_unlink(pathname);
+	RA_FREE(pathname);
+	RA_FREE(buf);
+	return e;
+}
+
+/*
+ * unix: peers. A command is a kind and a count n: 'r' takes n descriptors
+ * and returns a length byte and what each reads; 'd' reads the n marker
+ * bytes as data, so that their descriptors pile up, and acknowledges.
+ */
+
+static void
+_fds_(void *ctx, ra_network_t network)
+{
+	unsigned char cmd[2], buf[64];
+	ssize_t n;
+	int i, fd;
+
+	(void)ctx;
+	while (!ra_network_read(network, cmd, sizeof (cmd))) {
+		if ('r' == cmd[0]) {
+			for (i=0; i<cmd[1]; ++i) {
+				if (0 > (fd = ra_network_recv_fd(network))) {
+					RA_TRACE("^");
+					return;
+				}
+				n = read(fd, buf + 1, sizeof (buf) - 1);
+				close(fd);
+				n = RA_MAX(0, n);
+				buf[0] = (unsigned char)n;
+				if (ra_network_write(network, buf, n + 1)) {
+					RA_TRACE("^");
+					return;
+				}
+			}
+		}
+		else if ((sizeof (buf) < cmd[1]) ||
+			 ra_network_read(network, buf, cmd[1]) ||
+			 ra_network_write(network, "k", 1)) {
+			RA_TRACE("^");
+			return;
+		}
+	}
+}
+
+struct local {
+	int e;
+	char address[256];
+};
+
+static void
+_local_(void *ctx)
+{
+	struct local *local;
+
+	local = (struct local *)ctx;
+	if (ra_network_listen(local->address, NULL, _fds_, NULL)) {
+		local->e = -1;
+	}
+}
+
+/* an event server's fnc that never consumes its input */
+
+static int
+_hoard_(void *ctx, ra_network_t network, ra_network_event_t event)
+{
+	(void)ctx;
+	(void)network;
+	(void)event;
+	return 0;
+}
+
+static void
+_listen_hoard_(void *ctx)
+{
+	if (ra_network_listen_events("localhost", "47017", _hoard_, NULL)) {
+		(*((int *)ctx)) = -1;
+	}
+}
+
+/*
+ * A peer sending more than the event server buffers, to an fnc that
+ * consumes nothing, is cut off instead of buffered without bound. Stops
+ * all listeners.
+ */
+
+static int
+hoard(void)
+{
+	ra_network_t network;
+	ra_thread_t thread;
+	char *buf;
+	int i, e, e_;
+
+	/* initialize */
+
+	e = e_ = 0;
+	network = NULL;
+	if (!(buf = malloc(MESSAGE_MAX))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(buf, 0, MESSAGE_MAX);
+	if (!(thread = ra_thread_open(_listen_hoard_, &e_))) {
+		RA_FREE(buf);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (i=0; !network && (i<100); ++i) {
+		ra_sleep(10000);
+		network = ra_network_connect("localhost", "47017");
+	}
+
+	/* 4 MiB: writes fail once the server hangs up, and so does a read */
+
+	if (!network || ra_network_timeout(network, 0, 5000000, 5000000)) {
+		e = -1;
+	}
+	for (i=0; !e && (i<64); ++i) {
+		if (ra_network_write(network, buf, MESSAGE_MAX)) {
+			break;
+		}
+	}
+	if (!e && (!ra_network_read(network, buf, 1) || (ETIMEDOUT == errno))) {
+		e = -1;
+	}
+	ra_network_close(network);
+	ra_network_stop();
+	ra_thread_close(thread);
+	RA_FREE(buf);
+	return (e || e_) ? -1 : 0;
+}
+
+/* leaves a socket file at pathname that nobody listens on */
+
+static int
+abandon(const char *pathname)
+{
+	struct sockaddr_un un;
+	int fd, e;
+
+	memset(&un, 0, sizeof (struct sockaddr_un));
+	if (sizeof (un.sun_path) <= strlen(pathname)) {
+		RA_TRACE("invalid network address");
+		return -1;
+	}
+	un.sun_family = AF_UNIX;
+	memcpy(un.sun_path, pathname, strlen(pathname) + 1);
+	if (0 > (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	e = bind(fd, (const struct sockaddr *)&un, sizeof (struct sockaddr_un));
+	close(fd);
+	if (e) {
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * A unix: fiber server, started over a stale socket file; its address,
+ * and that of a regular file, cannot be taken over. Descriptors to it:
+ * three pipes it reads back, then
+ * FDS + 3 left untaken, of which the last three are closed on arrival
+ * and the rest when the connection ends. Stops all listeners.
+ */
+
+static int
+locals(void)
+{
+	const char *MESSAGES[] = { "first", "second", "third" };
+	int pipes[FDS + 3][2], i, j, n, e;
+	struct local local, taken, file;
+	const char *pathname, *pathname_;
+	ra_thread_t thread, threads[2];
+	ra_network_t network, network_;
+	unsigned char cmd[2];
+	struct stat st;
+	char buf[64];
+	FILE *fp;
+
+	/* initialize */
+
+	e = 0;
+	network = NULL;
+	memset(&local, 0, sizeof (struct local));
+	memset(&file, 0, sizeof (struct local));
+	pathname_ = NULL;
+	if (!(pathname = ra_pathname(".sock")) ||
+	    abandon(pathname) ||
+	    !(pathname_ = ra_pathname(".file")) ||
+	    !(fp = fopen(pathname_, "w")) ||
+	    fclose(fp)) {
+		if (pathname) {
+			unlink(pathname);
+		}
+		RA_FREE(pathname);
+		RA_FREE(pathname_);
+		RA_TRACE("^");
+		return -1;
+	}
+	ra_sprintf(local.address,
+		   sizeof (local.address),
+		   "%s%s",
+		   LOCAL,
+		   pathname);
+	ra_sprintf(file.address,
+		   sizeof (file.address),
+		   "%s%s",
+		   LOCAL,
+		   pathname_);
+	memcpy(&taken, &local, sizeof (struct local));
+	RA_FREE(pathname);
+	if (!(thread = ra_thread_open(_local_, &local))) {
+		ra_unlink(pathname_);
+		RA_FREE(pathname_);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (i=0; !network && (i<100); ++i) {
+		ra_sleep(10000);
+		network = ra_network_connect(local.address, NULL);
+	}
+
+	/* addresses in use: both listeners fail, the server stays reachable */
+
+	threads[0] = ra_thread_open(_local_, &taken);
+	threads[1] = ra_thread_open(_local_, &file);
+	for (i=0; (!taken.e || !file.e) && (i<100); ++i) {
+		ra_sleep(10000);
+	}
+	network_ = ra_network_connect(local.address, NULL);
+	if (!taken.e || !file.e || !network_) {
+		e = -1;
+	}
+	ra_network_close(network_);
+
+	/* three descriptors, read back in order */
+
+	cmd[0] = 'r';
+	cmd[1] = 3;
+	if (!network || ra_network_write(network, cmd, sizeof (cmd))) {
+		e = -1;
+	}
+	for (i=0; !e && (i<3); ++i) {
+		n = (int)strlen(MESSAGES[i]);
+		if (pipe(pipes[i])) {
+			e = -1;
+			break;
+		}
+		if ((n != write(pipes[i][1], MESSAGES[i], n)) ||
+		    ra_network_send_fd(network, pipes[i][0])) {
+			e = -1;
+		}
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+	for (i=0; !e && (i<3); ++i) {
+		n = (int)strlen(MESSAGES[i]);
+		if (ra_network_read(network, buf, 1) ||
+		    (n != buf[0]) ||
+		    ra_network_read(network, buf, n) ||
+		    memcmp(buf, MESSAGES[i], n)) {
+			e = -1;
+		}
+	}
+
+	/* overflow: write ends pile up at the server */
+
+	cmd[0] = 'd';
+	cmd[1] = FDS + 3;
+	if (!e && ra_network_write(network, cmd, sizeof (cmd))) {
+		e = -1;
+	}
+	for (i=0; !e && (i<(FDS + 3)); ++i) {
+		if (pipe(pipes[i])) {
+			e = -1;
+			break;
+		}
+		if ((0 > fcntl(pipes[i][0], F_SETFL, O_NONBLOCK)) ||
+		    ra_network_send_fd(network, pipes[i][1])) {
+			e = -1;
+		}
+		close(pipes[i][1]);
+	}
+	n = i;
+	if (e || ra_network_read(network, buf, 1) || ('k' != buf[0])) {
+		e = -1;
+	}
+	for (i=0; !e && (i<n); ++i) {
+		j = (int)read(pipes[i][0], buf, 1); /* 0: no writer left */
+		if ((FDS > i) ? ((0 <= j) || (EAGAIN != errno)) : j) {
+			e = -1;
+		}
+	}
+	ra_network_close(network);
+	for (i=0; !e && (i<FDS); ++i) {
+		for (j=0; (0 != read(pipes[i][0], buf, 1)) && (j<100); ++j) {
+			ra_sleep(10000);
+		}
+		if (100 == j) {
+			e = -1;
+		}
+	}
+	for (i=0; i<n; ++i) {
+		close(pipes[i][0]);
+	}
+	ra_network_stop();
+	ra_thread_close(thread);
+	ra_thread_close(threads[0]);
+	ra_thread_close(threads[1]);
+	if (lstat(pathname_, &st) || !S_ISREG(st.st_mode)) {
+		e = -1;
+	}
+	ra_unlink(pathname_);
+	RA_FREE(pathname_);
+	return (e || local.e) ? -1 : 0;
+}
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int
+bucket(uint64_t v)
+{
+	int m;
+
+	if (16 > v) {
+		return (int)v;
+	}
+	m = 4;
+	while (v >> (m + 1)) {
+		++m;
+	}
+	return (m - 3) * 16 + (int)((v >> (m - 4)) & 15);
+}
+
+static uint64_t
+percentile(const uint64_t *counts, double q)
+{
+	uint64_t n, k;
+	int i;
+
+	n = 0;
+	for (i=0; i<BUCKETS; ++i) {
+		n += counts[i];
+	}
+	k = 0;
+	for (i=0; i<BUCKETS; ++i) {
+		if ((double)(k += counts[i]) >= (q * (double)n)) {
+			break;
+		}
+	}
+	if (32 > i) {
+		return (uint64_t)i;
+	}
+	return (uint64_t)(16 + (i % 16)) << (i / 16 - 1);
+}
+
+static void
+_load_(void *ctx)
+{
+	uint64_t counts[BUCKETS], t;
+	ra_network_t network;
+	const void *bufs[2];
+	struct load *load;
+	uint32_t header[2];
+	char *req, *rep;
+	size_t lens[2];
+	int i, j;
+
+	load = (struct load *)ctx;
+	memset(counts, 0, sizeof (counts));
+	req = malloc(MESSAGE_MAX);
+	rep = malloc(MESSAGE_MAX);
+	if (!req || !rep ||
+	    !(network = ra_network_connect("localhost", load->servname))) {
+		RA_FREE(req);
+		RA_FREE(rep);
+		load->e = -1;
+		RA_TRACE("^");
+		return;
+	}
+
+	/* closed loop: one request outstanding, payload echoed back */
+
+	header[0] = htonl(load->len);
+	header[1] = htonl(load->reply);
+	bufs[0] = header;
+	bufs[1] = req;
+	lens[0] = sizeof (header);
+	lens[1] = load->len;
+	for (i=0; !load->e && (i<load->requests); ++i) {
+		memset(req, (char)i, load->len);
+		t = nsec();
+		if (ra_network_writev(network, 2, bufs, lens) ||
+		    ra_network_read(network, rep, load->reply)) {
+			load->e = -1;
+			break;
+		}
+		++counts[bucket(nsec() - t)];
+		for (j=0; j<(int)RA_MIN(load->len, load->reply); ++j) {
+			if ((char)i != rep[j]) {
+				load->e = -1;
+			}
+		}
+	}
+	ra_network_close(network);
+	RA_FREE(req);
+	RA_FREE(rep);
+	for (i=0; i<BUCKETS; ++i) {
+		if (counts[i]) {
+			__sync_fetch_and_add(&load->counts[i], counts[i]);
+		}
+	}
+}
+
+/*
+ * clients connections each issue requests round trips; returns round
+ * trips per second, or a negative value on failure.
+ */
+
+static double
+run(struct load *load, int clients)
+{
+	ra_thread_t *threads;
+	uint64_t t;
+	int i, e;
+
+	e = 0;
+	load->e = 0;
+	memset(load->counts, 0, sizeof (load->counts));
+	if (!(threads = malloc(clients * sizeof (ra_thread_t)))) {
+		RA_TRACE("out of memory");
+		return -1.0;
+	}
+	memset(threads, 0, clients * sizeof (ra_thread_t));
+	t = ra_time();
+	for (i=0; i<clients; ++i) {
+		if (!(threads[i] = ra_thread_open(_load_, load))) {
+			e = -1;
+			break;
+		}
+	}
+	for (i=0; i<clients; ++i) {
+		ra_thread_close(threads[i]);
+	}
+	t = RA_MAX(1, ra_time() - t);
+	RA_FREE(threads);
+	if (e || load->e) {
+		RA_TRACE("integrity failure detected");
+		return -1.0;
+	}
+	return 1e6 * clients * load->requests / (double)t;
+}
+
+int
+ra_network_test(void)
+{
+	const uint32_t LENS[] = { 0, 1, 100, 20000, MESSAGE_MAX };
+	struct listener listeners[2];
+	ra_network_pool_t pool;
+	ra_network_t network, network_;
+	ra_thread_t threads[2];
+	struct load load;
+	uint32_t header[2];
+	unsigned i, j;
+	char c;
+	int e;
+
+	/* initialize */
+
+	e = 0;
+	listeners[0].servname = "47012";
+	listeners[1].servname = "47013";
+	if (serve(listeners, threads)) {
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* concurrent echo and request/response, both server kinds */
+
+	memset(&load, 0, sizeof (struct load));
+	for (i=0; i<2; ++i) {
+		load.servname = listeners[i].servname;
+		for (j=0; j<RA_ARRAY_SIZE(LENS); ++j) {
+			load.len = LENS[j];
+			load.reply = LENS[RA_ARRAY_SIZE(LENS) - 1 - j];
+			load.reply = RA_MAX(1, load.reply); /* paces the client */
+			load.requests = 50;
+			if (0.0 > run(&load, 8)) {
+				e = -1;
+			}
+		}
+	}
+
+	/* pooled connections are reused */
+
+	if ((pool = ra_network_pool_open(2, 1000000))) {
+		network = ra_network_checkout(pool, "localhost", "47012");
+		ra_network_checkin(pool, network, 1);
+		network_ = ra_network_checkout(pool, "localhost", "47012");
+		if (!network || (network != network_)) {
+			e = -1;
+		}
+		ra_network_checkin(pool, network_, 0);
+		ra_network_pool_close(pool);
+	}
+	else {
+		e = -1;
+	}
+
+	/* files and devices */
+
+	if (transfers()) {
+		e = -1;
+	}
+
+	/* a burst beyond the event server's read-ahead, replies read after */
+
+	if (burst("47013")) {
+		e = -1;
+	}
+
+	/* a reply that never comes times out */
+
+	if ((network = ra_network_connect("localhost", "47012"))) {
+		header[0] = htonl(10);
+		header[1] = htonl(1);
+		if (ra_network_timeout(network, 0, 50000, 0) ||
+		    ra_network_write(network, header, sizeof (header)) ||
+		    !ra_network_read(network, &c, 1) ||
+		    (ETIMEDOUT != errno)) {
+			e = -1;
+		}
+		ra_network_close(network);
+	}
+	else {
+		e = -1;
+	}
+
+	/* input left unconsumed; descriptors over unix: addresses */
+
+	ra_network_stop();
+	ra_thread_close(threads[0]);
+	ra_thread_close(threads[1]);
+	if (hoard() || locals()) {
+		e = -1;
+	}
+
+	/* a stop with no listener running ends the next one at once */
+
+	ra_network_stop();
+	if (ra_network_listen("localhost", "47018", _serve_, NULL)) {
+		e = -1;
+	}
+	if (e || listeners[0].e || listeners[1].e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+sweep(struct load *load, const char *server, int /* BOOL */ reqrep)
+{
+	const uint32_t SIZES[] = { 64, 4096, MESSAGE_MAX };
+	const int CLIENTS[] = { 1, 16, 64 };
+	const int REQUESTS = 20000; /* per run, over all clients */
+	unsigned i, j;
+	double rate;
+
+	for (i=0; i<RA_ARRAY_SIZE(SIZES); ++i) {
+		for (j=0; j<RA_ARRAY_SIZE(CLIENTS); ++j) {
+			load->len = reqrep ? 32 : SIZES[i];
+			load->reply = SIZES[i];
+			load->requests = REQUESTS / CLIENTS[j];
+			if (0.0 > (rate = run(load, CLIENTS[j]))) {
+				RA_TRACE("^");
+				return -1;
+			}
+			ra_printf(RA_COLOR_GRAY,
+				  "network %-7s %s %5u B %2d clients: "
+				  "%8.0f req/s  p50 %6.1f  p99 %7.1f  "
+				  "p999 %7.1f us\n",
+				  server,
+				  reqrep ? "req/rep" : "echo   ",
+				  (unsigned)SIZES[i],
+				  CLIENTS[j],
+				  rate,
+				  percentile(load->counts, 0.5) / 1e3,
+				  percentile(load->counts, 0.99) / 1e3,
+				  percentile(load->counts, 0.999) / 1e3);
+		}
+	}
+	return 0;
+}
+
+int
+ra_network_bench(void)
+{
+	const char *SERVERS[] = { "threads", "events" };
+	struct listener listeners[2];
+	ra_thread_t threads[2];
+	struct load *load;
+	int i, e;
+
+	/* initialize */
+
+	e = 0;
+	if (!(load = malloc(sizeof (struct load)))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(load, 0, sizeof (struct load));
+	listeners[0].servname = "47014";
+	listeners[1].servname = "47015";
+	if (serve(listeners, threads)) {
+		RA_FREE(load);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* echo (size each way) and request/response (size back) */
+
+	for (i=0; !e && (i<2); ++i) {
+		load->servname = listeners[i].servname;
+		if (sweep(load, SERVERS[i], 0) || sweep(load, SERVERS[i], 1)) {
+			e = -1;
+		}
+	}
+	ra_network_stop();
+	ra_thread_close(threads[0]);
+	ra_thread_close(threads[1]);
+	RA_FREE(load);
+	if (e || listeners[0].e || listeners[1].e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
 	}
 	return 0;
 }
@@ -3,25 +3,167 @@
 #ifndef __RA_NETWORK_H__
 #define __RA_NETWORK_H__
 
-#include "ra_kernel.h"
+#include "ra_device.h"
 
 typedef struct ra_network *ra_network_t;
 
 typedef void (*ra_network_fnc_t)(void *ctx, ra_network_t network);
 
+typedef enum {
+	RA_NETWORK_OPEN,
+	RA_NETWORK_READABLE, /* new bytes are pending */
+	RA_NETWORK_WRITABLE, /* queued output has drained */
+	RA_NETWORK_CLOSE
+} ra_network_event_t;
+
+typedef int (*ra_network_event_fnc_t)(void *ctx,
+				      ra_network_t network,
+				      ra_network_event_t event);
+
 int ra_network_listen(const char *hostname,
 		      const char *servname,
 		      ra_network_fnc_t fnc,
 		      void *ctx);
 
+/**
+ * Event-driven server (Linux): one edge-triggered epoll reactor per core
+ * multiplexes all connections, none of which ever blocks. fnc is called
+ * on the connection's reactor thread; a non-zero return closes it, and
+ * RA_NETWORK_CLOSE is delivered exactly once. Inside fnc, use
+ * ra_network_recv() to consume buffered input and ra_network_send() to
+ * queue output. At most 1 MiB of input is buffered per connection; the
+ * rest is read once fnc consumes some, and a connection whose fnc consumes
+ * none of a full buffer is closed. Like ra_network_listen(), returns on
+ * SIGINT.
+ */
+
+int ra_network_listen_events(const char *hostname,
+			     const char *servname,
+			     ra_network_event_fnc_t fnc,
+			     void *ctx);
+
+/**
+ * Makes every running ra_network_listen*() return, as SIGINT does,
+ * including those still setting up. A stop that finds none running is
+ * held for, and consumed by, the next one to start. Signal handlers
+ * return to SIG_DFL when the last running listener returns.
+ */
+
+void ra_network_stop(void);
+
 ra_network_t ra_network_connect(const char *hostname, const char *servname);
 
 void ra_network_close(ra_network_t network);
 
+typedef struct ra_network_pool *ra_network_pool_t;
+
+/**
+ * Thread-safe client connection pool keyed by host:service. Resolved
+ * addresses are cached for a minute; up to idle_max idle connections per
+ * peer are kept (with TCP keepalive) for at most timeout microseconds.
+ * ra_network_checkout() prefers the most recently returned live
+ * connection and dials otherwise. ra_network_checkin() with reuse
+ * non-zero returns a connection whose exchange completed cleanly;
+ * otherwise, or if it has unread input, it is closed. Connections must
+ * be checked in (or closed) before the pool is closed.
+ */
+
+ra_network_pool_t ra_network_pool_open(int idle_max, uint64_t timeout);
+
+void ra_network_pool_close(ra_network_pool_t pool);
+
+ra_network_t ra_network_checkout(ra_network_pool_t pool,
+				 const char *hostname,
+				 const char *servname);
+
+void ra_network_checkin(ra_network_pool_t pool,
+			ra_network_t network,
+			int /* BOOL */ reuse);
+
+/**
+ * Reads are served from a per-connection read-ahead buffer; writes are
+ * coalesced in a per-connection buffer and go out when it fills, before
+ * a read that has to wait for the peer, on ra_network_flush() and on
+ * close.
+ * ra_network_writev() gathers up to three pieces (e.g., header and
+ * payload) and, when they do not fit the buffer, sends them together
+ * with any pending output in a single writev().
+ * A read that finds the peer gone before its first byte, the orderly
+ * end of a conversation, fails quietly with errno 0.
+ */
+
 int ra_network_read(ra_network_t network, void *buf, size_t len);
 
 int ra_network_write(ra_network_t network, const void *buf, size_t len);
 
+int ra_network_writev(ra_network_t network,
+		      int n,
+		      const void * const *bufs,
+		      const size_t *lens);
+
+int ra_network_flush(ra_network_t network);
+
+/**
+ * Send len bytes at off of a file, or of a device (block-aligned), after
+ * any pending output. The kernel moves the data with sendfile() where it
+ * can; otherwise it is copied in bounded chunks. Not for connections of
+ * ra_network_listen_events().
+ */
+
+int ra_network_sendfile(ra_network_t network,
+			const char *pathname,
+			uint64_t off,
+			uint64_t len);
+
+int ra_network_send_device(ra_network_t network,
+			   ra_device_t device,
+			   uint64_t off,
+			   uint64_t len);
+
+size_t ra_network_recv(ra_network_t network, void *buf, size_t len);
+
+size_t ra_network_pending(ra_network_t network);
+
+int ra_network_send(ra_network_t network, const void *buf, size_t len);
+
+void **ra_network_user(ra_network_t network);
+
+/**
+ * Per-connection deadlines in microseconds (0: none). A read (or write,
+ * flush, sendfile) fails with ETIMEDOUT once it has taken read (write),
+ * or has waited idle for the peer. Under ra_network_listen_events() the
+ * connection is closed instead when it sees no traffic for idle, leaves
+ * input unconsumed for read, or output undrained for write. Servers set
+ * them first thing in fnc (on RA_NETWORK_OPEN) to shed stalled clients.
+ */
+
+int ra_network_timeout(ra_network_t network,
+		       uint64_t idle,
+		       uint64_t read,
+		       uint64_t write);
+
+/**
+ * Local peers (addresses "unix:/path", servname ignored) can pass open
+ * file descriptors, e.g., a memfd holding a large payload. Each
+ * descriptor travels with one byte of the stream, so the receiver calls
+ * ra_network_recv_fd() at the same point in the protocol at which the
+ * sender called ra_network_send_fd(). The receiver owns the descriptor.
+ */
+
+int ra_network_send_fd(ra_network_t network, int fd);
+
+int ra_network_recv_fd(ra_network_t network);
+
 int /* BOOL */ ra_network_is_valid(const char *address);
 
+int ra_network_test(void);
+
+/**
+ * Loopback load: 1 to 64 client threads each keep one request in flight
+ * against the threaded and the event-driven server, echoing or fetching
+ * 64 B to 64 KiB; reports requests/s and p50/p99/p999 round-trip latency.
+ */
+
+int ra_network_bench(void);
+
 #endif /* __RA_NETWORK_H__ */
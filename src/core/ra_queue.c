@@ -0,0 +1,592 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_thread.h"
+#include "ra_queue.h"
+
+#define LINE 64
+#define SPIN 128
+
+struct ra_queue {
+	volatile uint64_t head; /* next pop position */
+	char pad1[LINE - sizeof (uint64_t)];
+	volatile uint64_t tail; /* next push position */
+	char pad2[LINE - sizeof (uint64_t)];
+	int spsc;
+	int spin; /* attempts before blocking, 1 on a single core */
+	uint64_t mask;
+	volatile int pushers; /* blocked in ra_queue_push_wait() */
+	volatile int poppers; /* blocked in ra_queue_pop_wait() */
+	ra_mutex_t mutex;
+	ra_cond_t push;
+	ra_cond_t pop;
+	struct cell {
+		volatile uint64_t seq;
+		void *item;
+	} *cells;
+};
+
+static ra_queue_t
+open_(uint64_t capacity, int spsc)
+{
+	struct ra_queue *queue;
+	uint64_t i, n;
+
+	assert( capacity && (((uint64_t)1 << 62) >= capacity) );
+
+	n = 2;
+	while (n < capacity) {
+		n <<= 1;
+	}
+	if (!(queue = malloc(sizeof (struct ra_queue)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(queue, 0, sizeof (struct ra_queue));
+	queue->spsc = spsc;
+	queue->spin = (1 < ra_cores()) ? SPIN : 1;
+	queue->mask = n - 1;
+	if (!(queue->cells = malloc(n * sizeof (queue->cells[0])))) {
+		ra_queue_close(queue);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	for (i=0; i<n; ++i) {
+		queue->cells[i].seq = i;
+		queue->cells[i].item = NULL;
+	}
+	if (!(queue->mutex = ra_mutex_open()) ||
+	    !(queue->push = ra_cond_open(queue->mutex)) ||
+	    !(queue->pop = ra_cond_open(queue->mutex))) {
+		ra_queue_close(queue);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return queue;
+}
+
+/*
+ * Claims up to n consecutive cells at *index whose sequence numbers show
+ * them ready (position + d), advancing *index past them with one CAS.
+ */
+
+static uint64_t
+claim(struct ra_queue *queue,
+      volatile uint64_t *index,
+      uint64_t d,
+      uint64_t n,
+      uint64_t *pos)
+{
+	uint64_t i, p;
+	int64_t dif;
+
+	p = (*index);
+	for (;;) {
+		dif = 0;
+		for (i=0; i<n; ++i) {
+			dif = (int64_t)queue->cells[(p + i) & queue->mask].seq;
+			dif -= (int64_t)(p + i + d);
+			if (dif) {
+				break;
+			}
+		}
+		if (i) {
+			if (__sync_bool_compare_and_swap(index, p, p + i)) {
+				(*pos) = p;
+				return i;
+			}
+		}
+		else if (0 > dif) {
+			return 0;
+		}
+		p = (*index);
+	}
+}
+
+static uint64_t
+push_(struct ra_queue *queue, void **items, uint64_t n)
+{
+	uint64_t i, p, k;
+
+	if (queue->spsc) {
+		p = queue->tail;
+		k = RA_MIN(n, queue->mask + 1 - (p - queue->head));
+		for (i=0; i<k; ++i) {
+			queue->cells[(p + i) & queue->mask].item = items[i];
+		}
+		__sync_synchronize();
+		queue->tail = p + k;
+		return k;
+	}
+	if ((k = claim(queue, &queue->tail, 0, n, &p))) {
+		for (i=0; i<k; ++i) {
+			queue->cells[(p + i) & queue->mask].item = items[i];
+		}
+		__sync_synchronize();
+		for (i=0; i<k; ++i) {
+			queue->cells[(p + i) & queue->mask].seq = p + i + 1;
+		}
+	}
+	return k;
+}
+
+static uint64_t
+pop_(struct ra_queue *queue, void **items, uint64_t n)
+{
+	uint64_t i, p, k;
+
+	if (queue->spsc) {
+		p = queue->head;
+		k = RA_MIN(n, queue->tail - p);
+		__sync_synchronize();
+		for (i=0; i<k; ++i) {
+			items[i] = queue->cells[(p + i) & queue->mask].item;
+		}
+		__sync_synchronize();
+		queue->head = p + k;
+		return k;
+	}
+	if ((k = claim(queue, &queue->head, 1, n, &p))) {
+		for (i=0; i<k; ++i) {
+			items[i] = queue->cells[(p + i) & queue->mask].item;
+		}
+		__sync_synchronize();
+		for (i=0; i<k; ++i) {
+			queue->cells[(p + i) & queue->mask].seq =
+				p + i + queue->mask + 1;
+		}
+	}
+	return k;
+}
+
+static void
+wake(struct ra_queue *queue, ra_cond_t cond, volatile int *waiters, int n)
+{
+	__sync_synchronize();
+	if (n && (*waiters)) {
+		ra_mutex_lock(queue->mutex);
+		if (1 < n) {
+			ra_cond_broadcast(cond);
+		}
+		else {
+			ra_cond_signal(cond);
+		}
+		ra_mutex_unlock(queue->mutex);
+	}
+}
+
+ra_queue_t
+ra_queue_open(uint64_t capacity)
+{
+	return open_(capacity, 0);
+}
+
+ra_queue_t
+ra_queue_open_spsc(uint64_t capacity)
+{
+	return open_(capacity, 1);
+}
+
+void
+ra_queue_close(ra_queue_t queue)
+{
+	if (queue) {
+		ra_cond_close(queue->pop);
+		ra_cond_close(queue->push);
+		ra_mutex_close(queue->mutex);
+		RA_FREE(queue->cells);
+		memset(queue, 0, sizeof (struct ra_queue));
+		RA_FREE(queue);
+	}
+}
+
+int
+ra_queue_push(ra_queue_t queue, void *item)
+{
+	assert( queue && item );
+
+	if (!push_(queue, &item, 1)) {
+		return -1;
+	}
+	wake(queue, queue->pop, &queue->poppers, 1);
+	return 0;
+}
+
+void *
+ra_queue_pop(ra_queue_t queue)
+{
+	void *item;
+
+	assert( queue );
+
+	if (!pop_(queue, &item, 1)) {
+		return NULL;
+	}
+	wake(queue, queue->push, &queue->pushers, 1);
+	return item;
+}
+
+uint64_t
+ra_queue_push_batch(ra_queue_t queue, void **items, uint64_t n)
+{
+	uint64_t k;
+
+	assert( queue && (items || !n) );
+
+	k = n ? push_(queue, items, n) : 0;
+	wake(queue, queue->pop, &queue->poppers, (int)RA_MIN(k, 2));
+	return k;
+}
+
+uint64_t
+ra_queue_pop_batch(ra_queue_t queue, void **items, uint64_t n)
+{
+	uint64_t k;
+
+	assert( queue && (items || !n) );
+
+	k = n ? pop_(queue, items, n) : 0;
+	wake(queue, queue->push, &queue->pushers, (int)RA_MIN(k, 2));
+	return k;
+}
+
+void
+ra_queue_push_wait(ra_queue_t queue, void *item)
+{
+	int i;
+
+	assert( queue && item );
+
+	for (i=0; i<queue->spin; ++i) {
+		if (push_(queue, &item, 1)) {
+			wake(queue, queue->pop, &queue->poppers, 1);
+			return;
+		}
+	}
+	ra_mutex_lock(queue->mutex);
+	++queue->pushers;
+	__sync_synchronize();
+	while (!push_(queue, &item, 1)) {
+		ra_cond_wait(queue->push);
+	}
+	--queue->pushers;
+	ra_mutex_unlock(queue->mutex);
+	wake(queue, queue->pop, &queue->poppers, 1);
+}
+
+void *
+ra_queue_pop_wait(ra_queue_t queue)
+{
+	void *item;
+	int i;
+
+	assert( queue );
+
+	for (i=0; i<queue->spin; ++i) {
+		if (pop_(queue, &item, 1)) {
+			wake(queue, queue->push, &queue->pushers, 1);
+			return item;
+		}
+	}
+	ra_mutex_lock(queue->mutex);
+	++queue->poppers;
+	__sync_synchronize();
+	while (!pop_(queue, &item, 1)) {
+		ra_cond_wait(queue->pop);
+	}
+	--queue->poppers;
+	ra_mutex_unlock(queue->mutex);
+	wake(queue, queue->push, &queue->pushers, 1);
+	return item;
+}
+
+uint64_t
+ra_queue_capacity(ra_queue_t queue)
+{
+	assert( queue );
+
+	return queue->mask + 1;
+}
+
+/*
+ * Test and benchmark harness: producers push (id << 32 | seq) tokens,
+ * consumers pop until they see the stop token. A mutex/cond ring serves
+ * as the baseline.
+ */
+
+static char stop_;
+
+#define STOP ( (void *)&stop_ )
+
+struct locked {
+	uint64_t head;
+	uint64_t tail;
+	uint64_t size;
+	void **items;
+	ra_mutex_t mutex;
+	ra_cond_t push;
+	ra_cond_t pop;
+};
+
+struct harness {
+	int id;
+	int fail;
+	uint64_t n;
+	uint64_t sum;
+	ra_queue_t queue;
+	struct locked *locked;
+};
+
+static void
+put(struct harness *harness, void *item)
+{
+	struct locked *locked;
+
+	if (harness->queue) {
+		ra_queue_push_wait(harness->queue, item);
+		return;
+	}
+	locked = harness->locked;
+	ra_mutex_lock(locked->mutex);
+	while (locked->size == (locked->tail - locked->head)) {
+		ra_cond_wait(locked->push);
+	}
+	locked->items[locked->tail++ % locked->size] = item;
+	ra_cond_signal(locked->pop);
+	ra_mutex_unlock(locked->mutex);
+}
+
+static void *
+get(struct harness *harness)
+{
+	struct locked *locked;
+	void *item;
+
+	if (harness->queue) {
+		return ra_queue_pop_wait(harness->queue);
+	}
+	locked = harness->locked;
+	ra_mutex_lock(locked->mutex);
+	while (locked->head == locked->tail) {
+		ra_cond_wait(locked->pop);
+	}
+	item = locked->items[locked->head++ % locked->size];
+	ra_cond_signal(locked->push);
+	ra_mutex_unlock(locked->mutex);
+	return item;
+}
+
+static void
+_producer_(void *ctx)
+{
+	struct harness *harness;
+	uint64_t i;
+
+	harness = (struct harness *)ctx;
+	for (i=1; i<=harness->n; ++i) {
+		put(harness, (void *)(size_t)((uint64_t)harness->id << 32 | i));
+	}
+}
+
+static void
+_consumer_(void *ctx)
+{
+	struct harness *harness;
+	uint64_t last[33], token;
+	void *item;
+	int id;
+
+	harness = (struct harness *)ctx;
+	memset(last, 0, sizeof (last));
+	while (STOP != (item = get(harness))) {
+		token = (uint64_t)(size_t)item;
+		id = (int)(token >> 32);
+		if (last[id] >= (token & 0xffffffff)) {
+			harness->fail = 1;
+		}
+		last[id] = token & 0xffffffff;
+		harness->sum += token & 0xffffffff;
+	}
+}
+
+static double
+run(ra_queue_t queue, int producers, int consumers, uint64_t n)
+{
+	struct harness harness[32], control;
+	struct locked locked;
+	ra_thread_t threads[32];
+	uint64_t sum, t;
+	int i, e;
+
+	assert( 16 >= producers );
+	assert( 16 >= consumers );
+
+	e = 0;
+	memset(&locked, 0, sizeof (locked));
+	memset(threads, 0, sizeof (threads));
+	memset(harness, 0, sizeof (harness));
+	memset(&control, 0, sizeof (control));
+	control.queue = queue;
+	control.locked = &locked;
+	locked.size = 1024;
+	if (!queue &&
+	    (!(locked.items = malloc(locked.size * sizeof (void *))) ||
+	     !(locked.mutex = ra_mutex_open()) ||
+	     !(locked.push = ra_cond_open(locked.mutex)) ||
+	     !(locked.pop = ra_cond_open(locked.mutex)))) {
+		e = -1;
+	}
+	for (i=0; i<(producers + consumers); ++i) {
+		harness[i].id = i + 1;
+		harness[i].n = n;
+		harness[i].queue = queue;
+		harness[i].locked = &locked;
+	}
+	t = ra_time();
+	for (i=0; !e && (i<consumers); ++i) {
+		if (!(threads[i] = ra_thread_open(_consumer_, &harness[i]))) {
+			e = -1;
+		}
+	}
+	for (i=consumers; !e && (i<(producers + consumers)); ++i) {
+		if (!(threads[i] = ra_thread_open(_producer_, &harness[i]))) {
+			e = -1;
+		}
+	}
+	for (i=consumers; i<(producers + consumers); ++i) {
+		ra_thread_close(threads[i]);
+	}
+	for (i=0; i<consumers; ++i) {
+		if (threads[i]) {
+			put(&control, STOP);
+		}
+	}
+	sum = 0;
+	for (i=0; i<consumers; ++i) {
+		ra_thread_close(threads[i]);
+		sum += harness[i].sum;
+		e = harness[i].fail ? -1 : e;
+	}
+	t = ra_time() - t;
+	ra_cond_close(locked.pop);
+	ra_cond_close(locked.push);
+	ra_mutex_close(locked.mutex);
+	RA_FREE(locked.items);
+	if (e || ((uint64_t)producers * (n * (n + 1) / 2) != sum)) {
+		return -1.0;
+	}
+	return (double)producers * n / RA_MAX(t, 1);
+}
+
+int
+ra_queue_test(void)
+{
+	ra_queue_t queues[2];
+	void *items[16];
+	uint64_t i;
+	int j, e;
+
+	e = 0;
+	if (!(queues[0] = ra_queue_open(5)) ||
+	    !(queues[1] = ra_queue_open_spsc(5))) {
+		ra_queue_close(queues[0]);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* single thread: capacity, order, batches */
+
+	for (j=0; j<2; ++j) {
+		if (8 != ra_queue_capacity(queues[j])) {
+			e = -1;
+		}
+		for (i=1; i<=8; ++i) {
+			if (ra_queue_push(queues[j], (void *)(size_t)i)) {
+				e = -1;
+			}
+		}
+		if (!ra_queue_push(queues[j], (void *)(size_t)9)) {
+			e = -1;
+		}
+		for (i=1; i<=3; ++i) {
+			if ((void *)(size_t)i != ra_queue_pop(queues[j])) {
+				e = -1;
+			}
+		}
+		for (i=0; i<16; ++i) {
+			items[i] = (void *)(size_t)(i + 9);
+		}
+		if ((3 != ra_queue_push_batch(queues[j], items, 16)) ||
+		    (8 != ra_queue_pop_batch(queues[j], items, 16)) ||
+		    ra_queue_pop(queues[j])) {
+			e = -1;
+		}
+		for (i=0; i<8; ++i) {
+			if ((void *)(size_t)(i + 4) != items[i]) {
+				e = -1;
+			}
+		}
+	}
+	ra_queue_close(queues[0]);
+	ra_queue_close(queues[1]);
+
+	/* concurrent: per-producer order, nothing lost or duplicated */
+
+	if (!e) {
+		queues[0] = ra_queue_open(64);
+		queues[1] = ra_queue_open_spsc(64);
+		if (!queues[0] || !queues[1] ||
+		    (0.0 > run(queues[0], 4, 4, 20000)) ||
+		    (0.0 > run(queues[1], 1, 1, 100000)) ||
+		    (0.0 > run(NULL, 2, 2, 1000))) {
+			e = -1;
+		}
+		ra_queue_close(queues[0]);
+		ra_queue_close(queues[1]);
+	}
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_queue_bench(void)
+{
+	const uint64_t N = 1000000;
+	const int P[] = { 1, 4, 1, 4 };
+	const int C[] = { 1, 4, 4, 1 };
+	double baseline, mpmc, spsc;
+	ra_queue_t queue;
+	unsigned i;
+
+	for (i=0; i<RA_ARRAY_SIZE(P); ++i) {
+		baseline = run(NULL, P[i], C[i], N / P[i]);
+		mpmc = spsc = -1.0;
+		if ((queue = ra_queue_open(1024))) {
+			mpmc = run(queue, P[i], C[i], N / P[i]);
+			ra_queue_close(queue);
+		}
+		if ((1 == P[i]) &&
+		    (1 == C[i]) &&
+		    (queue = ra_queue_open_spsc(1024))) {
+			spsc = run(queue, 1, 1, N);
+			ra_queue_close(queue);
+		}
+		if ((0.0 > baseline) || (0.0 > mpmc)) {
+			RA_TRACE("integrity failure detected");
+			return -1;
+		}
+		ra_printf(RA_COLOR_GRAY,
+			  "queue %dx%d: mutex/cond %6.2f  mpmc %6.2f",
+			  P[i],
+			  C[i],
+			  baseline,
+			  mpmc);
+		if (0.0 < spsc) {
+			ra_printf(RA_COLOR_GRAY, "  spsc %6.2f", spsc);
+		}
+		ra_printf(RA_COLOR_GRAY, " Mops/s\n");
+	}
+	return 0;
+}
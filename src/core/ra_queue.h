@@ -0,0 +1,43 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_QUEUE_H__
+#define __RA_QUEUE_H__
+
+#include "ra_kernel.h"
+
+typedef struct ra_queue *ra_queue_t;
+
+/**
+ * Bounded FIFO of non-NULL pointers; capacity is rounded up to a power of
+ * two. ra_queue_open() is safe for any number of producers and consumers
+ * (lock-free ring with per-slot sequence numbers), ra_queue_open_spsc()
+ * for exactly one of each. ra_queue_push() returns -1 when full and
+ * ra_queue_pop() NULL when empty; the _batch variants move up to n items
+ * and return how many they moved; the _wait variants block instead.
+ */
+
+ra_queue_t ra_queue_open(uint64_t capacity);
+
+ra_queue_t ra_queue_open_spsc(uint64_t capacity);
+
+void ra_queue_close(ra_queue_t queue);
+
+int ra_queue_push(ra_queue_t queue, void *item);
+
+void *ra_queue_pop(ra_queue_t queue);
+
+uint64_t ra_queue_push_batch(ra_queue_t queue, void **items, uint64_t n);
+
+uint64_t ra_queue_pop_batch(ra_queue_t queue, void **items, uint64_t n);
+
+void ra_queue_push_wait(ra_queue_t queue, void *item);
+
+void *ra_queue_pop_wait(ra_queue_t queue);
+
+uint64_t ra_queue_capacity(ra_queue_t queue);
+
+int ra_queue_test(void);
+
+int ra_queue_bench(void);
+
+#endif /* __RA_QUEUE_H__ */
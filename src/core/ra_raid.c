@@ -0,0 +1,1087 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_ec.h"
+#include "ra_bitset.h"
+#include "ra_thread.h"
+#include "ra_raid.h"
+
+#define REPAIRS_MAX 64
+
+struct ra_raid {
+	int k;
+	int n;
+	char *buf;
+	char *tmp;
+	void *buf_;
+	uint64_t chunk;
+	uint64_t block;
+	uint64_t stripes;
+	ra_cond_t cond;
+	ra_mutex_t mutex;
+	ra_bitset_t bitset;
+	struct repair {
+		uint64_t s;
+		uint64_t n;
+	} repairs[REPAIRS_MAX];
+	struct member {
+		int e;
+		int busy;
+		int quit;
+		int write;
+		int failed;
+		int rebuilding;
+		uint64_t watermark; /* rebuilt stripes: [0, watermark) */
+		void *buf;
+		uint64_t off;
+		uint64_t len;
+		ra_mutex_t mutex;
+		ra_cond_t request;
+		ra_cond_t response;
+		ra_thread_t thread;
+		ra_device_t device;
+	} *members;
+};
+
+/**
+ * One I/O thread per member so that the chunks of a stripe move in
+ * parallel: submit() hands a request to a member, complete() waits for
+ * all outstanding requests and marks members whose I/O failed.
+ */
+
+static void
+_member_(void *ctx)
+{
+	struct member *member;
+	int e;
+
+	member = (struct member *)ctx;
+	ra_mutex_lock(member->mutex);
+	for (;;) {
+		while (!member->busy && !member->quit) {
+			ra_cond_wait(member->request);
+		}
+		if (!member->busy) {
+			break;
+		}
+		ra_mutex_unlock(member->mutex);
+		if (member->write) {
+			e = ra_device_write(member->device,
+					    member->buf,
+					    member->off,
+					    member->len);
+		}
+		else {
+			e = ra_device_read(member->device,
+					   member->buf,
+					   member->off,
+					   member->len);
+		}
+		ra_mutex_lock(member->mutex);
+		member->e = e;
+		member->busy = 0;
+		ra_cond_signal(member->response);
+	}
+	ra_mutex_unlock(member->mutex);
+}
+
+static int
+map(const struct ra_raid *raid, uint64_t s, int r)
+{
+	return (int)((r + s) % (uint64_t)raid->n);
+}
+
+static int
+failed(const struct ra_raid *raid, uint64_t s, int r)
+{
+	const struct member *member;
+
+	member = &raid->members[map(raid, s, r)];
+	if (member->failed ||
+	    (member->rebuilding && (s >= member->watermark))) {
+		return 1;
+	}
+	return 0;
+}
+
+static int
+failures(const struct ra_raid *raid)
+{
+	int i, n;
+
+	n = 0;
+	for (i=0; i<raid->n; ++i) {
+		n += raid->members[i].failed ? 1 : 0;
+	}
+	return n;
+}
+
+static int
+broken(const struct ra_raid *raid, uint64_t s)
+{
+	int r, n;
+
+	n = 0;
+	for (r=0; r<raid->n; ++r) {
+		n += failed(raid, s, r);
+	}
+	return n;
+}
+
+static int
+repairing(const struct ra_raid *raid, uint64_t s)
+{
+	int i;
+
+	for (i=0; i<REPAIRS_MAX; ++i) {
+		if (raid->repairs[i].n &&
+		    (s >= raid->repairs[i].s) &&
+		    (s < (raid->repairs[i].s + raid->repairs[i].n))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+submit(struct ra_raid *raid,
+       uint64_t s,
+       int r,
+       int write,
+       void *buf,
+       uint64_t off,
+       uint64_t len)
+{
+	struct member *member;
+
+	/**
+	 * A member being rebuilt keeps receiving writes; it is only read
+	 * below its watermark.
+	 */
+
+	member = &raid->members[map(raid, s, r)];
+	if (!member->failed && len && (write || !failed(raid, s, r))) {
+		ra_mutex_lock(member->mutex);
+		member->e = 0;
+		member->busy = 1;
+		member->write = write;
+		member->buf = buf;
+		member->off = s * raid->chunk + off;
+		member->len = len;
+		ra_cond_signal(member->request);
+		ra_mutex_unlock(member->mutex);
+	}
+}
+
+static int
+complete(struct ra_raid *raid)
+{
+	struct member *member;
+	int i, e;
+
+	e = 0;
+	for (i=0; i<raid->n; ++i) {
+		member = &raid->members[i];
+		ra_mutex_lock(member->mutex);
+		while (member->busy) {
+			ra_cond_wait(member->response);
+		}
+		if (member->e) {
+			member->e = 0;
+			member->failed = 1;
+			member->rebuilding = 0;
+			e = -1;
+			RA_TRACE("member failed");
+		}
+		ra_mutex_unlock(member->mutex);
+	}
+	return e;
+}
+
+static void
+xor(void *z_, const void *a_, uint64_t len)
+{
+	const uint64_t *a = (const uint64_t *)a_;
+	uint64_t *z = (uint64_t *)z_;
+	uint64_t i;
+
+	for (i=0; i<(len/8); ++i) {
+		z[i] ^= a[i];
+	}
+}
+
+/**
+ * Stripe operations work on a column window [lo, hi) of the chunks. The
+ * stripe buffer uses the ra_ec layout with stride w = hi - lo: role r
+ * (data 0..k-1, P k, Q k+1) of the window lives at buf + r * w.
+ */
+
+struct window {
+	int j0;
+	int j1;
+	uint64_t a;
+	uint64_t len;
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t w;
+};
+
+static void
+window(const struct ra_raid *raid,
+       uint64_t a,
+       uint64_t len,
+       struct window *window)
+{
+	window->a = a;
+	window->len = len;
+	window->j0 = (int)(a / raid->chunk);
+	window->j1 = (int)((a + len - 1) / raid->chunk);
+	if (window->j0 == window->j1) {
+		window->lo = a % raid->chunk;
+		window->hi = (a + len - 1) % raid->chunk + 1;
+	}
+	else {
+		window->lo = 0;
+		window->hi = raid->chunk;
+	}
+	window->w = window->hi - window->lo;
+}
+
+static uint64_t
+x0(const struct ra_raid *raid, const struct window *window, int j)
+{
+	return (j == window->j0) ? (window->a % raid->chunk) : 0;
+}
+
+static uint64_t
+x1(const struct ra_raid *raid, const struct window *window, int j)
+{
+	if (j == window->j1) {
+		return (window->a + window->len - 1) % raid->chunk + 1;
+	}
+	return raid->chunk;
+}
+
+static char *
+role(const struct ra_raid *raid, const struct window *window, int r)
+{
+	return raid->buf + r * window->w;
+}
+
+static char *
+data(const struct ra_raid *raid, const struct window *window, int j)
+{
+	return role(raid, window, j) + x0(raid, window, j) - window->lo;
+}
+
+static int
+fill(struct ra_raid *raid, uint64_t s, const struct window *window, int pq)
+{
+	int r;
+
+	for (;;) {
+		if (2 < broken(raid, s)) {
+			RA_TRACE("too many failed members");
+			return -1;
+		}
+		for (r=0; r<(raid->k + (pq ? 2 : 0)); ++r) {
+			submit(raid,
+			       s,
+			       r,
+			       0,
+			       role(raid, window, r),
+			       window->lo,
+			       window->w);
+		}
+		if (!complete(raid)) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static void
+reconstruct(struct ra_raid *raid, char *buf, uint64_t s, int w)
+{
+	int j, x[2], n;
+
+	n = 0;
+	for (j=0; j<raid->k; ++j) {
+		if (failed(raid, s, j)) {
+			x[n++] = j;
+		}
+	}
+	if (1 == n) {
+		if (!failed(raid, s, raid->k)) {
+			ra_ec_encode_dp(buf, raid->k, w, x[0]);
+		}
+		else {
+			ra_ec_encode_dq(buf, raid->k, w, x[0]);
+		}
+	}
+	else if (2 == n) {
+		ra_ec_encode_dd(buf, raid->k, w, x[0], x[1]);
+	}
+}
+
+static int
+lost(const struct ra_raid *raid, uint64_t s)
+{
+	int j;
+
+	for (j=0; j<raid->k; ++j) {
+		if (failed(raid, s, j)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+degraded(const struct ra_raid *raid, uint64_t s, const struct window *window)
+{
+	int j;
+
+	for (j=window->j0; j<=window->j1; ++j) {
+		if (failed(raid, s, j)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+read_stripe(struct ra_raid *raid,
+	    uint64_t s,
+	    uint64_t a,
+	    uint64_t len,
+	    char *buf)
+{
+	struct window window_;
+	int j;
+
+	window(raid, a, len, &window_);
+
+	/* healthy: touched data chunks only */
+
+	if (!degraded(raid, s, &window_)) {
+		for (j=window_.j0; j<=window_.j1; ++j) {
+			submit(raid,
+			       s,
+			       j,
+			       0,
+			       data(raid, &window_, j),
+			       x0(raid, &window_, j),
+			       x1(raid, &window_, j) - x0(raid, &window_, j));
+		}
+		if (complete(raid)) {
+			RA_TRACE("^ (ignored)");
+		}
+	}
+
+	/* degraded: survivors plus reconstruction */
+
+	if (degraded(raid, s, &window_)) {
+		if (fill(raid, s, &window_, 1)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		reconstruct(raid, raid->buf, s, (int)window_.w);
+	}
+	for (j=window_.j0; j<=window_.j1; ++j) {
+		memcpy(buf + j * raid->chunk + x0(raid, &window_, j) - a,
+		       data(raid, &window_, j),
+		       x1(raid, &window_, j) - x0(raid, &window_, j));
+	}
+	return 0;
+}
+
+static int
+write_full(struct ra_raid *raid, uint64_t s, const char *buf)
+{
+	int r;
+
+	memcpy(raid->buf, buf, raid->k * raid->chunk);
+	ra_ec_encode_pq(raid->buf, raid->k, (int)raid->chunk);
+	for (r=0; r<(raid->k + 2); ++r) {
+		submit(raid,
+		       s,
+		       r,
+		       1,
+		       raid->buf + r * raid->chunk,
+		       0,
+		       raid->chunk);
+	}
+	if (complete(raid)) {
+		RA_TRACE("^ (ignored)");
+	}
+	return 0;
+}
+
+static int
+write_delta(struct ra_raid *raid,
+	    uint64_t s,
+	    const struct window *window,
+	    const char *buf)
+{
+	uint64_t o, n;
+	char *d, *p, *q;
+	int j;
+
+	/* old data, P and Q */
+
+	for (j=window->j0; j<=window->j1; ++j) {
+		o = x0(raid, window, j);
+		n = x1(raid, window, j) - o;
+		submit(raid, s, j, 0, data(raid, window, j), o, n);
+	}
+	submit(raid,
+	       s,
+	       raid->k + 0,
+	       0,
+	       role(raid, window, raid->k + 0),
+	       window->lo,
+	       window->w);
+	submit(raid,
+	       s,
+	       raid->k + 1,
+	       0,
+	       role(raid, window, raid->k + 1),
+	       window->lo,
+	       window->w);
+	if (complete(raid)) {
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* P ^= D, Q ^= g^j D | D = old ^ new */
+
+	for (j=window->j0; j<=window->j1; ++j) {
+		o = x0(raid, window, j);
+		n = x1(raid, window, j) - o;
+		d = data(raid, window, j);
+		p = role(raid, window, raid->k + 0) + o - window->lo;
+		q = role(raid, window, raid->k + 1) + o - window->lo;
+		memcpy(raid->tmp, buf + j * raid->chunk + o - window->a, n);
+		xor(d, raid->tmp, n);
+		ra_ec_encode_delta(p, q, d, (int)n, j);
+		memcpy(d, raid->tmp, n);
+	}
+
+	/* new data, P and Q */
+
+	for (j=window->j0; j<=window->j1; ++j) {
+		o = x0(raid, window, j);
+		n = x1(raid, window, j) - o;
+		submit(raid, s, j, 1, data(raid, window, j), o, n);
+	}
+	submit(raid,
+	       s,
+	       raid->k + 0,
+	       1,
+	       role(raid, window, raid->k + 0),
+	       window->lo,
+	       window->w);
+	submit(raid,
+	       s,
+	       raid->k + 1,
+	       1,
+	       role(raid, window, raid->k + 1),
+	       window->lo,
+	       window->w);
+	if (complete(raid)) {
+		RA_TRACE("^ (ignored)");
+	}
+	return 0;
+}
+
+static int
+write_reconstruct(struct ra_raid *raid,
+		  uint64_t s,
+		  const struct window *window,
+		  const char *buf)
+{
+	uint64_t o, n;
+	int j;
+
+	/* survivors (P and Q only when a data chunk is lost) */
+
+	if (fill(raid, s, window, lost(raid, s))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	reconstruct(raid, raid->buf, s, (int)window->w);
+
+	/* overlay new data, re-encode */
+
+	for (j=window->j0; j<=window->j1; ++j) {
+		o = x0(raid, window, j);
+		n = x1(raid, window, j) - o;
+		memcpy(data(raid, window, j),
+		       buf + j * raid->chunk + o - window->a,
+		       n);
+	}
+	ra_ec_encode_pq(raid->buf, raid->k, (int)window->w);
+	for (j=window->j0; j<=window->j1; ++j) {
+		o = x0(raid, window, j);
+		n = x1(raid, window, j) - o;
+		submit(raid, s, j, 1, data(raid, window, j), o, n);
+	}
+	submit(raid,
+	       s,
+	       raid->k + 0,
+	       1,
+	       role(raid, window, raid->k + 0),
+	       window->lo,
+	       window->w);
+	submit(raid,
+	       s,
+	       raid->k + 1,
+	       1,
+	       role(raid, window, raid->k + 1),
+	       window->lo,
+	       window->w);
+	if (complete(raid)) {
+		RA_TRACE("^ (ignored)");
+	}
+	return 0;
+}
+
+static int
+write_stripe(struct ra_raid *raid,
+	     uint64_t s,
+	     uint64_t a,
+	     uint64_t len,
+	     const char *buf)
+{
+	struct window window_;
+
+	if (!a && (ra_raid_stripe(raid) == len)) {
+		if (write_full(raid, s, buf)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		return 0;
+	}
+	window(raid, a, len, &window_);
+	if (!broken(raid, s) &&
+	    ((2 * (window_.j1 - window_.j0 + 1)) <= raid->k) &&
+	    !write_delta(raid, s, &window_, buf)) {
+		return 0;
+	}
+	if (write_reconstruct(raid, s, &window_, buf)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+ra_raid_t
+ra_raid_open(ra_device_t *devices, int n, uint64_t chunk)
+{
+	struct member *member;
+	struct ra_raid *raid;
+	uint64_t size;
+	int i;
+
+	assert( devices );
+	assert( (3 <= n) && ((RA_EC_MAX_K + 2) >= n) );
+	assert( (RA_EC_MIN_N <= chunk) && (RA_EC_MAX_N >= chunk) );
+
+	/* initialize */
+
+	if (!(raid = malloc(sizeof (struct ra_raid)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(raid, 0, sizeof (struct ra_raid));
+	raid->n = n;
+	raid->k = n - 2;
+	raid->chunk = chunk;
+	if (!(raid->members = malloc(n * sizeof (raid->members[0])))) {
+		ra_raid_close(raid);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(raid->members, 0, n * sizeof (raid->members[0]));
+
+	/* geometry */
+
+	size = 0;
+	for (i=0; i<n; ++i) {
+		assert( devices[i] );
+		raid->block = RA_MAX(raid->block, ra_device_block(devices[i]));
+		if (!i || (size > ra_device_size(devices[i]))) {
+			size = ra_device_size(devices[i]);
+		}
+	}
+	if ((chunk % raid->block) || !(raid->stripes = size / chunk)) {
+		ra_raid_close(raid);
+		RA_TRACE("invalid chunk size");
+		return NULL;
+	}
+
+	/* buffers (O_DIRECT needs aligned memory) */
+
+	if (!(raid->mutex = ra_mutex_open()) ||
+	    !(raid->cond = ra_cond_open(raid->mutex)) ||
+	    !(raid->bitset = ra_bitset_open(raid->stripes)) ||
+	    !(raid->buf_ = malloc((n + 1) * chunk + ra_page()))) {
+		ra_raid_close(raid);
+		RA_TRACE("^");
+		return NULL;
+	}
+	raid->buf = ra_align(raid->buf_, ra_page());
+	raid->tmp = raid->buf + n * chunk;
+
+	/* members */
+
+	for (i=0; i<n; ++i) {
+		member = &raid->members[i];
+		member->device = devices[i];
+		if (!(member->mutex = ra_mutex_open()) ||
+		    !(member->request = ra_cond_open(member->mutex)) ||
+		    !(member->response = ra_cond_open(member->mutex)) ||
+		    !(member->thread = ra_thread_open(_member_, member))) {
+			ra_raid_close(raid);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+	return raid;
+}
+
+void
+ra_raid_close(ra_raid_t raid)
+{
+	struct member *member;
+	int i;
+
+	if (raid) {
+		if (raid->members) {
+			for (i=0; i<raid->n; ++i) {
+				member = &raid->members[i];
+				if (member->thread) {
+					ra_mutex_lock(member->mutex);
+					member->quit = 1;
+					ra_cond_signal(member->request);
+					ra_mutex_unlock(member->mutex);
+					ra_thread_close(member->thread);
+				}
+				ra_cond_close(member->request);
+				ra_cond_close(member->response);
+				ra_mutex_close(member->mutex);
+			}
+		}
+		ra_bitset_close(raid->bitset);
+		ra_cond_close(raid->cond);
+		ra_mutex_close(raid->mutex);
+		RA_FREE(raid->members);
+		RA_FREE(raid->buf_);
+		memset(raid, 0, sizeof (struct ra_raid));
+		RA_FREE(raid);
+	}
+}
+
+int
+ra_raid_read(ra_raid_t raid, void *buf_, uint64_t off, uint64_t len)
+{
+	char *buf = (char *)buf_;
+	uint64_t s, a, n;
+
+	assert( raid );
+	assert( !len || buf );
+	assert( 0 == (off % raid->block) );
+	assert( 0 == (len % raid->block) );
+	assert( ra_raid_size(raid) >= (off + len) );
+
+	ra_mutex_lock(raid->mutex);
+	while (len) {
+		s = off / ra_raid_stripe(raid);
+		a = off % ra_raid_stripe(raid);
+		n = RA_MIN(ra_raid_stripe(raid) - a, len);
+		while (repairing(raid, s)) {
+			ra_cond_wait(raid->cond);
+		}
+		if (read_stripe(raid, s, a, n, buf)) {
+			ra_mutex_unlock(raid->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	ra_mutex_unlock(raid->mutex);
+	return 0;
+}
+
+int
+ra_raid_write(ra_raid_t raid,
+	      const void *buf_,
+	      uint64_t off,
+	      uint64_t len)
+{
+	const char *buf = (const char *)buf_;
+	uint64_t s, a, n;
+
+	assert( raid );
+	assert( !len || buf );
+	assert( 0 == (off % raid->block) );
+	assert( 0 == (len % raid->block) );
+	assert( ra_raid_size(raid) >= (off + len) );
+
+	ra_mutex_lock(raid->mutex);
+	while (len) {
+		s = off / ra_raid_stripe(raid);
+		a = off % ra_raid_stripe(raid);
+		n = RA_MIN(ra_raid_stripe(raid) - a, len);
+		while (repairing(raid, s)) {
+			ra_cond_wait(raid->cond);
+		}
+		if (write_stripe(raid, s, a, n, buf)) {
+			ra_mutex_unlock(raid->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	ra_mutex_unlock(raid->mutex);
+	if (2 < ra_raid_failed(raid)) {
+		RA_TRACE("too many failed members");
+		return -1;
+	}
+	return 0;
+}
+
+uint64_t
+ra_raid_reserve(ra_raid_t raid, uint64_t n)
+{
+	uint64_t i;
+
+	assert( raid && n );
+
+	ra_mutex_lock(raid->mutex);
+	i = ra_bitset_reserve(raid->bitset, n);
+	ra_mutex_unlock(raid->mutex);
+	return i;
+}
+
+uint64_t
+ra_raid_release(ra_raid_t raid, uint64_t i)
+{
+	uint64_t n;
+
+	assert( raid && i );
+
+	ra_mutex_lock(raid->mutex);
+	n = ra_bitset_release(raid->bitset, i);
+	ra_mutex_unlock(raid->mutex);
+	return n;
+}
+
+void
+ra_raid_fail(ra_raid_t raid, int i)
+{
+	assert( raid );
+	assert( (0 <= i) && (raid->n > i) );
+
+	ra_mutex_lock(raid->mutex);
+	raid->members[i].failed = 1;
+	raid->members[i].rebuilding = 0;
+	ra_mutex_unlock(raid->mutex);
+}
+
+int
+ra_raid_failed(ra_raid_t raid)
+{
+	int n;
+
+	assert( raid );
+
+	ra_mutex_lock(raid->mutex);
+	n = failures(raid);
+	ra_mutex_unlock(raid->mutex);
+	return n;
+}
+
+int
+ra_raid_replace(ra_raid_t raid,
+		int i,
+		ra_device_t device,
+		uint64_t watermark)
+{
+	struct member *member;
+
+	assert( raid && device );
+	assert( (0 <= i) && (raid->n > i) );
+
+	if ((raid->chunk % ra_device_block(device)) ||
+	    (raid->block < ra_device_block(device)) ||
+	    ((raid->stripes * raid->chunk) > ra_device_size(device))) {
+		RA_TRACE("incompatible device");
+		return -1;
+	}
+	ra_mutex_lock(raid->mutex);
+	member = &raid->members[i];
+	member->device = device;
+	member->failed = 0;
+	member->rebuilding = (watermark < raid->stripes) ? 1 : 0;
+	member->watermark = watermark;
+	ra_mutex_unlock(raid->mutex);
+	return 0;
+}
+
+int
+ra_raid_repair(ra_raid_t raid, int i, uint64_t s, uint64_t n, void *buf_)
+{
+	char *buf = (char *)buf_;
+	struct member *member;
+	char *stripe, *q;
+	uint64_t t;
+	int m, r, e, j;
+
+	assert( raid && n && buf );
+	assert( (0 <= i) && (raid->n > i) );
+	assert( raid->stripes >= (s + n) );
+
+	/* claim [s, s + n) against foreground I/O */
+
+	ra_mutex_lock(raid->mutex);
+	for (;;) {
+		if (!raid->members[i].rebuilding ||
+		    (s < raid->members[i].watermark)) {
+			ra_mutex_unlock(raid->mutex);
+			RA_TRACE("member is not being rebuilt");
+			return -1;
+		}
+		for (j=0; j<REPAIRS_MAX; ++j) {
+			if (!raid->repairs[j].n) {
+				break;
+			}
+		}
+		if (REPAIRS_MAX > j) {
+			break;
+		}
+		ra_cond_wait(raid->cond);
+	}
+	raid->repairs[j].s = s;
+	raid->repairs[j].n = n;
+	ra_mutex_unlock(raid->mutex);
+
+	/**
+	 * Read ahead n consecutive chunks from every survivor (contiguous on
+	 * each member), then reconstruct member i stripe by stripe.
+	 */
+
+	e = 0;
+	stripe = buf + raid->n * n * raid->chunk;
+	for (m=0; !e && (m<raid->n); ++m) {
+		member = &raid->members[m];
+		if ((m != i) && !member->failed) {
+			if (ra_device_read(member->device,
+					   buf + m * n * raid->chunk,
+					   s * raid->chunk,
+					   n * raid->chunk)) {
+				ra_mutex_lock(raid->mutex);
+				member->failed = 1;
+				member->rebuilding = 0;
+				ra_mutex_unlock(raid->mutex);
+				e = -1;
+			}
+		}
+	}
+	for (t=0; !e && (t<n); ++t) {
+		if (2 < broken(raid, s + t)) {
+			RA_TRACE("too many failed members");
+			e = -1;
+			break;
+		}
+		for (r=0; r<raid->n; ++r) {
+			q = buf + (map(raid, s + t, r) * n + t) * raid->chunk;
+			memcpy(stripe + r * raid->chunk, q, raid->chunk);
+		}
+		reconstruct(raid, stripe, s + t, (int)raid->chunk);
+		r = (int)((i + raid->n - (s + t) % raid->n) % raid->n);
+		if (raid->k == r) {
+			ra_ec_encode_p(stripe, raid->k, (int)raid->chunk);
+		}
+		else if ((raid->k + 1) == r) {
+			ra_ec_encode_q(stripe, raid->k, (int)raid->chunk);
+		}
+		memcpy(buf + (i * n + t) * raid->chunk,
+		       stripe + r * raid->chunk,
+		       raid->chunk);
+	}
+	member = &raid->members[i];
+	if (!e && ra_device_write(member->device,
+				  buf + i * n * raid->chunk,
+				  s * raid->chunk,
+				  n * raid->chunk)) {
+		ra_mutex_lock(raid->mutex);
+		member->failed = 1;
+		member->rebuilding = 0;
+		ra_mutex_unlock(raid->mutex);
+		e = -1;
+	}
+
+	/* release */
+
+	ra_mutex_lock(raid->mutex);
+	raid->repairs[j].s = 0;
+	raid->repairs[j].n = 0;
+	ra_cond_broadcast(raid->cond);
+	ra_mutex_unlock(raid->mutex);
+	if (e) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+void
+ra_raid_advance(ra_raid_t raid, int i, uint64_t watermark)
+{
+	struct member *member;
+
+	assert( raid );
+	assert( (0 <= i) && (raid->n > i) );
+
+	ra_mutex_lock(raid->mutex);
+	member = &raid->members[i];
+	if (member->rebuilding) {
+		member->watermark = RA_MAX(member->watermark, watermark);
+		if (member->watermark >= raid->stripes) {
+			member->rebuilding = 0;
+		}
+	}
+	ra_mutex_unlock(raid->mutex);
+}
+
+uint64_t
+ra_raid_repair_size(ra_raid_t raid, uint64_t n)
+{
+	assert( raid );
+
+	return (n + 1) * raid->n * raid->chunk;
+}
+
+uint64_t
+ra_raid_stripes(ra_raid_t raid)
+{
+	assert( raid );
+
+	return raid->stripes;
+}
+
+uint64_t
+ra_raid_size(ra_raid_t raid)
+{
+	assert( raid );
+
+	return raid->stripes * ra_raid_stripe(raid);
+}
+
+uint64_t
+ra_raid_block(ra_raid_t raid)
+{
+	assert( raid );
+
+	return raid->block;
+}
+
+uint64_t
+ra_raid_stripe(ra_raid_t raid)
+{
+	assert( raid );
+
+	return raid->k * raid->chunk;
+}
+
+int
+ra_raid_test(void)
+{
+	const uint64_t SIZE = 2 * 1024 * 1024;
+	const uint64_t CHUNK = 16384;
+	const int N = 6, M = 2000;
+	ra_device_t devices[6];
+	uint64_t off, len;
+	char *ref, *buf;
+	ra_raid_t raid;
+	int i, j, e;
+
+	/* initialize */
+
+	e = 0;
+	ref = buf = NULL;
+	raid = NULL;
+	memset(devices, 0, sizeof (devices));
+	for (i=0; i<N; ++i) {
+		if (!(devices[i] = ra_device_open_memory(SIZE, 512, 0))) {
+			e = -1;
+		}
+	}
+	if (e ||
+	    !(raid = ra_raid_open(devices, N, CHUNK)) ||
+	    !(ref = malloc(ra_raid_size(raid))) ||
+	    !(buf = malloc(ra_raid_size(raid)))) {
+		e = -1;
+	}
+
+	/* random writes, healthy then one and two failed members */
+
+	if (!e) {
+		memset(ref, 0, ra_raid_size(raid));
+		if (ra_raid_write(raid, ref, 0, ra_raid_size(raid))) {
+			e = -1;
+		}
+	}
+	for (i=0; !e && (i<(3 * M)); ++i) {
+		if (M == i) {
+			ra_raid_fail(raid, 1);
+		}
+		if ((2 * M) == i) {
+			ra_raid_fail(raid, 4);
+		}
+		len = (1 + (uint64_t)rand() % (3 * CHUNK / 512)) * 512;
+		off = (uint64_t)rand() % ((ra_raid_size(raid) - len) / 512);
+		off *= 512;
+		for (j=0; j<(int)len; j+=512) {
+			memset(ref + off + j, rand(), 512);
+		}
+		if (ra_raid_write(raid, ref + off, off, len) ||
+		    ra_raid_read(raid, buf, off, len) ||
+		    memcmp(ref + off, buf, len)) {
+			e = -1;
+		}
+	}
+	if (!e &&
+	    ((2 != ra_raid_failed(raid)) ||
+	     ra_raid_read(raid, buf, 0, ra_raid_size(raid)) ||
+	     memcmp(ref, buf, ra_raid_size(raid)))) {
+		e = -1;
+	}
+
+	/* stripe allocation */
+
+	if (!e &&
+	    ((1 != ra_raid_reserve(raid, 2)) ||
+	     (2 != ra_raid_release(raid, 1)))) {
+		e = -1;
+	}
+
+	/* done */
+
+	RA_FREE(ref);
+	RA_FREE(buf);
+	ra_raid_close(raid);
+	for (i=0; i<N; ++i) {
+		ra_device_close(devices[i]);
+	}
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_RAID_H__
+#define __RA_RAID_H__
+
+#include "ra_device.h"
+
+typedef struct ra_raid *ra_raid_t;
+
+/**
+ * RAID-6 volume over n = k + 2 caller-owned devices. Each stripe holds one
+ * chunk per member: k data chunks, P and Q, rotated across members from
+ * stripe to stripe. The logical address space is the concatenation of the
+ * data chunks of all stripes; a stripe is k * chunk bytes.
+ *
+ * ra_raid_reserve()/ra_raid_release() hand out runs of whole stripes so
+ * that callers can lay out data for full-stripe writes.
+ */
+
+ra_raid_t ra_raid_open(ra_device_t *devices, int n, uint64_t chunk);
+
+void ra_raid_close(ra_raid_t raid);
+
+int ra_raid_read(ra_raid_t raid, void *buf, uint64_t off, uint64_t len);
+
+int ra_raid_write(ra_raid_t raid,
+		  const void *buf,
+		  uint64_t off,
+		  uint64_t len);
+
+uint64_t ra_raid_reserve(ra_raid_t raid, uint64_t n);
+
+uint64_t ra_raid_release(ra_raid_t raid, uint64_t i);
+
+void ra_raid_fail(ra_raid_t raid, int i);
+
+int ra_raid_failed(ra_raid_t raid);
+
+/**
+ * Rebuild support (see ra_rebuild): ra_raid_replace() installs a device for
+ * member i whose stripes [0, watermark) are already valid; the rest is read
+ * as lost but still written. ra_raid_repair() reconstructs member i for
+ * stripes [s, s + n) using buf (ra_raid_repair_size() bytes, page-aligned)
+ * and ra_raid_advance() publishes the new watermark.
+ */
+
+int ra_raid_replace(ra_raid_t raid,
+		    int i,
+		    ra_device_t device,
+		    uint64_t watermark);
+
+int ra_raid_repair(ra_raid_t raid, int i, uint64_t s, uint64_t n, void *buf);
+
+void ra_raid_advance(ra_raid_t raid, int i, uint64_t watermark);
+
+uint64_t ra_raid_repair_size(ra_raid_t raid, uint64_t n);
+
+uint64_t ra_raid_stripes(ra_raid_t raid);
+
+uint64_t ra_raid_size(ra_raid_t raid);
+
+uint64_t ra_raid_block(ra_raid_t raid);
+
+uint64_t ra_raid_stripe(ra_raid_t raid);
+
+int ra_raid_test(void);
+
+#endif /* __RA_RAID_H__ */
@@ -0,0 +1,392 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_thread.h"
+#include "ra_rebuild.h"
+
+#define WORKERS 4
+#define BATCH 16
+#define CHECKPOINT 256
+#define IDLE ((uint64_t)-1)
+
+struct ra_rebuild {
+	int e;
+	int i;
+	int stop;
+	int share;
+	uint64_t rate;
+	uint64_t next;
+	uint64_t bytes;
+	uint64_t start;
+	uint64_t stripes;
+	uint64_t watermark;
+	uint64_t checkpoint;
+	void *ctx;
+	ra_raid_t raid;
+	ra_mutex_t mutex;
+	ra_rebuild_fnc_t fnc;
+	struct worker {
+		char *buf;
+		void *buf_;
+		uint64_t s; /* batch in progress or IDLE */
+		ra_thread_t thread;
+		struct ra_rebuild *rebuild;
+	} workers[WORKERS];
+};
+
+static void
+advance(struct ra_rebuild *rebuild)
+{
+	uint64_t watermark;
+	int i;
+
+	watermark = rebuild->next;
+	for (i=0; i<WORKERS; ++i) {
+		watermark = RA_MIN(watermark, rebuild->workers[i].s);
+	}
+	if (watermark > rebuild->watermark) {
+		rebuild->watermark = watermark;
+		ra_raid_advance(rebuild->raid, rebuild->i, watermark);
+		if (((watermark - rebuild->checkpoint) >= CHECKPOINT) ||
+		    (watermark == rebuild->stripes)) {
+			rebuild->checkpoint = watermark;
+			if (rebuild->fnc) {
+				rebuild->fnc(rebuild->ctx, watermark);
+			}
+		}
+	}
+}
+
+static void
+_worker_(void *ctx)
+{
+	struct ra_rebuild *rebuild;
+	struct worker *worker;
+	uint64_t s, n, t, due;
+	int e;
+
+	worker = (struct worker *)ctx;
+	rebuild = worker->rebuild;
+	for (;;) {
+
+		/* claim */
+
+		ra_mutex_lock(rebuild->mutex);
+		if (rebuild->stop ||
+		    rebuild->e ||
+		    (rebuild->next >= rebuild->stripes)) {
+			ra_mutex_unlock(rebuild->mutex);
+			break;
+		}
+		s = rebuild->next;
+		n = RA_MIN(BATCH, rebuild->stripes - s);
+		rebuild->next += n;
+		worker->s = s;
+		ra_mutex_unlock(rebuild->mutex);
+
+		/* repair */
+
+		t = ra_time();
+		e = ra_raid_repair(rebuild->raid,
+				   rebuild->i,
+				   s,
+				   n,
+				   worker->buf);
+
+		/* publish */
+
+		ra_mutex_lock(rebuild->mutex);
+		worker->s = IDLE;
+		if (e) {
+			rebuild->e = -1;
+			ra_mutex_unlock(rebuild->mutex);
+			RA_TRACE("^");
+			break;
+		}
+		rebuild->bytes += n * ra_raid_stripe(rebuild->raid);
+		due = 0;
+		if (rebuild->rate) {
+			due = rebuild->start + (uint64_t)(1e6 *
+							  rebuild->bytes /
+							  rebuild->rate);
+		}
+		advance(rebuild);
+		ra_mutex_unlock(rebuild->mutex);
+
+		/* throttle */
+
+		if (due > ra_time()) {
+			ra_sleep(due - ra_time());
+		}
+		if (100 > rebuild->share) {
+			t = ra_time() - t;
+			ra_sleep(t * (100 - rebuild->share) / rebuild->share);
+		}
+	}
+}
+
+ra_rebuild_t
+ra_rebuild_open(ra_raid_t raid,
+		int i,
+		ra_device_t device,
+		uint64_t watermark,
+		uint64_t rate,
+		int share,
+		ra_rebuild_fnc_t fnc,
+		void *ctx)
+{
+	struct ra_rebuild *rebuild;
+	struct worker *worker;
+	int j;
+
+	assert( raid && device );
+	assert( (0 < share) && (100 >= share) );
+
+	/* initialize */
+
+	if (!(rebuild = malloc(sizeof (struct ra_rebuild)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(rebuild, 0, sizeof (struct ra_rebuild));
+	rebuild->i = i;
+	rebuild->raid = raid;
+	rebuild->rate = rate;
+	rebuild->share = share;
+	rebuild->fnc = fnc;
+	rebuild->ctx = ctx;
+	rebuild->stripes = ra_raid_stripes(raid);
+	rebuild->watermark = RA_MIN(watermark, rebuild->stripes);
+	rebuild->checkpoint = rebuild->watermark;
+	rebuild->next = rebuild->watermark;
+	rebuild->start = ra_time();
+	for (j=0; j<WORKERS; ++j) {
+		worker = &rebuild->workers[j];
+		worker->s = IDLE;
+		worker->rebuild = rebuild;
+		if (!(worker->buf_ = malloc(ra_raid_repair_size(raid, BATCH) +
+					    ra_page()))) {
+			ra_rebuild_close(rebuild);
+			RA_TRACE("out of memory");
+			return NULL;
+		}
+		worker->buf = ra_align(worker->buf_, ra_page());
+	}
+	if (!(rebuild->mutex = ra_mutex_open()) ||
+	    ra_raid_replace(raid, i, device, rebuild->watermark)) {
+		ra_rebuild_close(rebuild);
+		RA_TRACE("^");
+		return NULL;
+	}
+
+	/* start */
+
+	for (j=0; j<WORKERS; ++j) {
+		worker = &rebuild->workers[j];
+		if (!(worker->thread = ra_thread_open(_worker_, worker))) {
+			ra_rebuild_close(rebuild);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+	return rebuild;
+}
+
+void
+ra_rebuild_close(ra_rebuild_t rebuild)
+{
+	int j;
+
+	if (rebuild) {
+		if (rebuild->mutex) {
+			ra_mutex_lock(rebuild->mutex);
+			rebuild->stop = 1;
+			ra_mutex_unlock(rebuild->mutex);
+		}
+		for (j=0; j<WORKERS; ++j) {
+			ra_thread_close(rebuild->workers[j].thread);
+			RA_FREE(rebuild->workers[j].buf_);
+		}
+		if (rebuild->fnc &&
+		    (rebuild->checkpoint != rebuild->watermark)) {
+			rebuild->fnc(rebuild->ctx, rebuild->watermark);
+		}
+		ra_mutex_close(rebuild->mutex);
+		memset(rebuild, 0, sizeof (struct ra_rebuild));
+		RA_FREE(rebuild);
+	}
+}
+
+int
+ra_rebuild_wait(ra_rebuild_t rebuild)
+{
+	int j;
+
+	assert( rebuild );
+
+	for (j=0; j<WORKERS; ++j) {
+		ra_thread_close(rebuild->workers[j].thread);
+		rebuild->workers[j].thread = NULL;
+	}
+	if (rebuild->e || (rebuild->watermark < rebuild->stripes)) {
+		RA_TRACE("rebuild incomplete");
+		return -1;
+	}
+	return 0;
+}
+
+uint64_t
+ra_rebuild_progress(ra_rebuild_t rebuild)
+{
+	uint64_t watermark;
+
+	assert( rebuild );
+
+	ra_mutex_lock(rebuild->mutex);
+	watermark = rebuild->watermark;
+	ra_mutex_unlock(rebuild->mutex);
+	return watermark;
+}
+
+static void
+_checkpoint_(void *ctx, uint64_t watermark)
+{
+	(*((uint64_t *)ctx)) = watermark;
+}
+
+static int
+verify(ra_raid_t raid, const char *ref, char *buf)
+{
+	if (ra_raid_read(raid, buf, 0, ra_raid_size(raid)) ||
+	    memcmp(ref, buf, ra_raid_size(raid))) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_rebuild_test(void)
+{
+	const uint64_t SIZE = 4 * 1024 * 1024;
+	const uint64_t CHUNK = 16384;
+	const int N = 6, M = 300;
+	ra_device_t devices[8];
+	ra_rebuild_t rebuild;
+	uint64_t off, len;
+	uint64_t watermark;
+	char *ref, *buf;
+	ra_raid_t raid;
+	int i, e;
+
+	/* initialize */
+
+	e = 0;
+	ref = buf = NULL;
+	raid = NULL;
+	memset(devices, 0, sizeof (devices));
+	for (i=0; i<(N + 2); ++i) {
+		if (!(devices[i] = ra_device_open_memory(SIZE, 512, 0))) {
+			e = -1;
+		}
+	}
+	if (e ||
+	    !(raid = ra_raid_open(devices, N, CHUNK)) ||
+	    !(ref = malloc(ra_raid_size(raid))) ||
+	    !(buf = malloc(ra_raid_size(raid)))) {
+		e = -1;
+	}
+	for (i=0; !e && (i<(int)ra_raid_size(raid)); i+=512) {
+		memset(ref + i, rand(), 512);
+	}
+	if (!e && ra_raid_write(raid, ref, 0, ra_raid_size(raid))) {
+		e = -1;
+	}
+
+	/* rebuild member 2 under foreground writes */
+
+	if (!e) {
+		ra_raid_fail(raid, 2);
+		if (!(rebuild = ra_rebuild_open(raid,
+						2,
+						devices[N + 0],
+						0,
+						0,
+						100,
+						NULL,
+						NULL))) {
+			e = -1;
+		}
+		for (i=0; !e && (i<M); ++i) {
+			len = (1 + (uint64_t)rand() % (3 * CHUNK / 512)) * 512;
+			off = ra_raid_size(raid) - len;
+			off = (uint64_t)rand() % (off / 512) * 512;
+			memset(ref + off, rand(), len);
+			if (ra_raid_write(raid, ref + off, off, len)) {
+				e = -1;
+			}
+		}
+		if (!rebuild ||
+		    ra_rebuild_wait(rebuild) ||
+		    (ra_raid_stripes(raid) != ra_rebuild_progress(rebuild))) {
+			e = -1;
+		}
+		ra_rebuild_close(rebuild);
+	}
+
+	/* member 2 must now stand in for two failures */
+
+	if (!e) {
+		ra_raid_fail(raid, 0);
+		ra_raid_fail(raid, 5);
+		if (verify(raid, ref, buf)) {
+			e = -1;
+		}
+	}
+
+	/* interrupt, then resume from the checkpoint, rate-limited */
+
+	if (!e) {
+		watermark = 0;
+		if (!(rebuild = ra_rebuild_open(raid,
+						0,
+						devices[N + 1],
+						0,
+						ra_raid_size(raid),
+						50,
+						_checkpoint_,
+						&watermark))) {
+			e = -1;
+		}
+		ra_rebuild_close(rebuild);
+		if (e || !(rebuild = ra_rebuild_open(raid,
+						     0,
+						     devices[N + 1],
+						     watermark,
+						     0,
+						     50,
+						     _checkpoint_,
+						     &watermark)) ||
+		    ra_rebuild_wait(rebuild) ||
+		    (ra_raid_stripes(raid) != watermark)) {
+			e = -1;
+		}
+		ra_rebuild_close(rebuild);
+		ra_raid_fail(raid, 2);
+		if (e || verify(raid, ref, buf)) {
+			e = -1;
+		}
+	}
+
+	/* done */
+
+	RA_FREE(ref);
+	RA_FREE(buf);
+	ra_raid_close(raid);
+	for (i=0; i<(N + 2); ++i) {
+		ra_device_close(devices[i]);
+	}
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
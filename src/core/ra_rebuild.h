@@ -0,0 +1,40 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_REBUILD_H__
+#define __RA_REBUILD_H__
+
+#include "ra_raid.h"
+
+typedef struct ra_rebuild *ra_rebuild_t;
+
+typedef void (*ra_rebuild_fnc_t)(void *ctx, uint64_t watermark);
+
+/**
+ * Background rebuild of member i of a RAID-6 volume onto device, starting
+ * at stripe watermark (0, or a checkpoint of an interrupted rebuild).
+ * Worker threads repair batches of stripes in parallel while foreground
+ * I/O continues. rate caps the bytes read per second from the survivors
+ * (0: unlimited) and share is the percentage of time the workers may keep
+ * the array busy (100: no pause). fnc (optional) is called with the
+ * watermark below which all stripes are rebuilt, periodically and on
+ * ra_rebuild_close(), which stops an unfinished rebuild.
+ */
+
+ra_rebuild_t ra_rebuild_open(ra_raid_t raid,
+			     int i,
+			     ra_device_t device,
+			     uint64_t watermark,
+			     uint64_t rate,
+			     int share,
+			     ra_rebuild_fnc_t fnc,
+			     void *ctx);
+
+void ra_rebuild_close(ra_rebuild_t rebuild);
+
+int ra_rebuild_wait(ra_rebuild_t rebuild);
+
+uint64_t ra_rebuild_progress(ra_rebuild_t rebuild);
+
+int ra_rebuild_test(void);
+
+#endif /* __RA_REBUILD_H__ */
@@ -0,0 +1,561 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include <arpa/inet.h>
+
+#include "ra_thread.h"
+#include "ra_rpc.h"
+
+#define WINDOW 256
+#define FRAME_MAX (64 * 1024 * 1024)
+#define INFLIGHT 65536 /* unanswered request bytes, within socket buffers */
+
+struct frame {
+	uint32_t len; /* payload bytes that follow */
+	uint32_t id;
+	uint32_t method;
+	uint32_t status;
+};
+
+struct ra_rpc {
+	int e;
+	uint32_t next;
+	uint64_t outstanding;
+	size_t inflight;
+	size_t cap;
+	void *buf;
+	ra_network_t network;
+	struct call {
+		uint32_t id;
+		size_t len; /* of the request frame */
+		void *ctx;
+		ra_rpc_done_fnc_t fnc;
+	} calls[WINDOW];
+};
+
+struct server {
+	int n;
+	void *ctx;
+	struct ra_rpc_method *methods;
+};
+
+static void
+encode(struct frame *frame,
+       size_t len,
+       uint32_t id,
+       uint32_t method,
+       uint32_t status)
+{
+	frame->len = htonl((uint32_t)len);
+	frame->id = htonl(id);
+	frame->method = htonl(method);
+	frame->status = htonl(status);
+}
+
+static void
+decode(struct frame *frame)
+{
+	frame->len = ntohl(frame->len);
+	frame->id = ntohl(frame->id);
+	frame->method = ntohl(frame->method);
+	frame->status = ntohl(frame->status);
+}
+
+static int
+receive(ra_network_t network, struct frame *frame, void **buf, size_t *cap)
+{
+	void *buf_;
+
+	if (ra_network_read(network, frame, sizeof (struct frame))) {
+		if (errno) {
+			RA_TRACE("^");
+		}
+		return -1;
+	}
+	decode(frame);
+	if (FRAME_MAX < frame->len) {
+		RA_TRACE("invalid frame");
+		return -1;
+	}
+	if ((*cap) < frame->len) {
+		if (!(buf_ = realloc((*buf), frame->len))) {
+			RA_TRACE("out of memory");
+			return -1;
+		}
+		(*buf) = buf_;
+		(*cap) = frame->len;
+	}
+	if (ra_network_read(network, (*buf), frame->len)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+_compare_(const void *a, const void *b)
+{
+	const struct ra_rpc_method *a_ = (const struct ra_rpc_method *)a;
+	const struct ra_rpc_method *b_ = (const struct ra_rpc_method *)b;
+
+	return (a_->id > b_->id) - (a_->id < b_->id);
+}
+
+static void
+_serve_(void *ctx, ra_network_t network)
+{
+	struct ra_rpc_method *method, key;
+	const void *bufs[2];
+	struct server *server;
+	struct frame frame;
+	size_t cap, lens[2];
+	void *buf, *rep;
+	uint32_t status;
+
+	server = (struct server *)ctx;
+	buf = NULL;
+	cap = 0;
+	while (!receive(network, &frame, &buf, &cap)) {
+		rep = NULL;
+		lens[1] = 0;
+		status = 0;
+		key.id = frame.method;
+		if (!(method = bsearch(&key,
+				       server->methods,
+				       server->n,
+				       sizeof (struct ra_rpc_method),
+				       _compare_)) ||
+		    method->fnc(server->ctx, buf, frame.len, &rep, &lens[1])) {
+			RA_FREE(rep);
+			lens[1] = 0;
+			status = 1;
+		}
+
+		/* replies coalesce until a read has to wait */
+
+		encode(&frame, lens[1], frame.id, frame.method, status);
+		bufs[0] = &frame;
+		bufs[1] = rep;
+		lens[0] = sizeof (struct frame);
+		if (ra_network_writev(network, 2, bufs, lens)) {
+			RA_FREE(rep);
+			RA_TRACE("^");
+			break;
+		}
+		RA_FREE(rep);
+	}
+	RA_FREE(buf);
+}
+
+int
+ra_rpc_listen(const char *hostname,
+	      const char *servname,
+	      const struct ra_rpc_method *methods,
+	      int n,
+	      void *ctx)
+{
+	struct server server;
+
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+	assert( methods && (0 < n) );
+
+	memset(&server, 0, sizeof (struct server));
+	server.n = n;
+	server.ctx = ctx;
+	if (!(server.methods = malloc(n * sizeof (struct ra_rpc_method)))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memcpy(server.methods, methods, n * sizeof (struct ra_rpc_method));
+	qsort(server.methods, n, sizeof (struct ra_rpc_method), _compare_);
+	if (ra_network_listen(hostname, servname, _serve_, &server)) {
+		RA_FREE(server.methods);
+		RA_TRACE("^");
+		return -1;
+	}
+	RA_FREE(server.methods);
+	return 0;
+}
+
+ra_rpc_t
+ra_rpc_connect(const char *hostname, const char *servname)
+{
+	struct ra_rpc *rpc;
+
+	assert( hostname && (*hostname) );
+	assert( !servname || (*servname) );
+
+	if (!(rpc = malloc(sizeof (struct ra_rpc)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(rpc, 0, sizeof (struct ra_rpc));
+	if (!(rpc->network = ra_network_connect(hostname, servname))) {
+		ra_rpc_close(rpc);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return rpc;
+}
+
+void
+ra_rpc_close(ra_rpc_t rpc)
+{
+	if (rpc) {
+		ra_network_close(rpc->network);
+		RA_FREE(rpc->buf);
+		memset(rpc, 0, sizeof (struct ra_rpc));
+		RA_FREE(rpc);
+	}
+}
+
+static int
+complete(struct ra_rpc *rpc)
+{
+	ra_rpc_done_fnc_t fnc;
+	struct frame frame;
+	struct call *call;
+
+	if (receive(rpc->network, &frame, &rpc->buf, &rpc->cap)) {
+		rpc->e = -1;
+		RA_TRACE("^");
+		return -1;
+	}
+	call = &rpc->calls[frame.id % WINDOW];
+	if (!call->fnc || (call->id != frame.id)) {
+		rpc->e = -1;
+		RA_TRACE("invalid frame");
+		return -1;
+	}
+	fnc = call->fnc;
+	call->fnc = NULL;
+	--rpc->outstanding;
+	rpc->inflight -= call->len;
+	fnc(call->ctx, frame.status ? -1 : 0, rpc->buf, frame.len);
+	return 0;
+}
+
+int
+ra_rpc_call(ra_rpc_t rpc,
+	    uint32_t method,
+	    const void *req,
+	    size_t len,
+	    ra_rpc_done_fnc_t fnc,
+	    void *ctx)
+{
+	const void *bufs[2];
+	struct frame frame;
+	struct call *call;
+	size_t lens[2];
+	size_t size;
+
+	assert( rpc && fnc );
+	assert( !len || req );
+	assert( FRAME_MAX >= len );
+
+	if (rpc->e) {
+		RA_TRACE("rpc connection failed");
+		return -1;
+	}
+
+	/*
+	 * Window full, or too many request bytes unanswered: the server may
+	 * be stuck writing replies that nobody reads while our write waits on
+	 * it, so retire replies first. A request larger than INFLIGHT goes
+	 * out alone.
+	 */
+
+	call = &rpc->calls[rpc->next % WINDOW];
+	size = sizeof (struct frame) + len;
+	while (call->fnc ||
+	       (rpc->outstanding && (INFLIGHT < (rpc->inflight + size)))) {
+		if (ra_network_flush(rpc->network) || complete(rpc)) {
+			rpc->e = -1;
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	call->id = rpc->next++;
+	call->len = size;
+	call->ctx = ctx;
+	call->fnc = fnc;
+	++rpc->outstanding;
+	rpc->inflight += size;
+	encode(&frame, len, call->id, method, 0);
+	bufs[0] = &frame;
+	bufs[1] = req;
+	lens[0] = sizeof (struct frame);
+	lens[1] = len;
+	if (ra_network_writev(rpc->network, 2, bufs, lens)) {
+		rpc->e = -1;
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_rpc_wait(ra_rpc_t rpc)
+{
+	assert( rpc );
+
+	if (rpc->e || ra_network_flush(rpc->network)) {
+		rpc->e = -1;
+		RA_TRACE("rpc connection failed");
+		return -1;
+	}
+	while (rpc->outstanding) {
+		if (complete(rpc)) {
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+_echo_(void *ctx, const void *req, size_t len, void **rep, size_t *replen)
+{
+	(void)ctx;
+	if (len) {
+		if (!((*rep) = malloc(len))) {
+			return -1;
+		}
+		memcpy((*rep), req, len);
+	}
+	(*replen) = len;
+	return 0;
+}
+
+static int
+_fail_(void *ctx, const void *req, size_t len, void **rep, size_t *replen)
+{
+	(void)ctx;
+	(void)req;
+	(void)len;
+	(void)rep;
+	(void)replen;
+	return -1;
+}
+
+struct check {
+	int n;
+	int e;
+	int expected; /* status */
+	char byte;
+	size_t len;
+};
+
+static void
+_done_(void *ctx, int status, const void *rep, size_t len)
+{
+	struct check *check;
+	size_t i;
+
+	check = (struct check *)ctx;
+	check->n++;
+	if ((status != check->expected) || (len != check->len)) {
+		check->e = -1;
+	}
+	for (i=0; i<len; ++i) {
+		if (((const char *)rep)[i] != check->byte) {
+			check->e = -1;
+		}
+	}
+}
+
+/* replies to REVERSE requests of one int each, last first */
+
+#define REVERSE 16
+
+static void
+_reverse_(void *ctx, ra_network_t network)
+{
+	struct frame frames[REVERSE], frame;
+	int reqs[REVERSE], i;
+	const void *bufs[2];
+	size_t cap, lens[2];
+	void *buf;
+
+	buf = NULL;
+	cap = 0;
+	for (i=0; i<REVERSE; ++i) {
+		if (receive(network, &frames[i], &buf, &cap) ||
+		    (sizeof (int) != frames[i].len)) {
+			(*((int *)ctx)) = -1;
+			RA_FREE(buf);
+			return;
+		}
+		memcpy(&reqs[i], buf, sizeof (int));
+	}
+	RA_FREE(buf);
+	for (i=REVERSE-1; 0<=i; --i) {
+		encode(&frame, sizeof (int), frames[i].id, frames[i].method, 0);
+		bufs[0] = &frame;
+		bufs[1] = &reqs[i];
+		lens[0] = sizeof (struct frame);
+		lens[1] = sizeof (int);
+		if (ra_network_writev(network, 2, bufs, lens)) {
+			(*((int *)ctx)) = -1;
+			return;
+		}
+	}
+}
+
+struct order {
+	int n;
+	int reqs[REVERSE];
+};
+
+static void
+_order_(void *ctx, int status, const void *rep, size_t len)
+{
+	struct order *order;
+
+	order = (struct order *)ctx;
+	if (status || (sizeof (int) != len) || (REVERSE <= order->n)) {
+		order->n = REVERSE + 1;
+		return;
+	}
+	memcpy(&order->reqs[order->n++], rep, sizeof (int));
+}
+
+static void
+_listen_reverse_(void *ctx)
+{
+	if (ra_network_listen("localhost", "47016", _reverse_, ctx)) {
+		(*((int *)ctx)) = -1;
+	}
+}
+
+static void
+_listen_(void *ctx)
+{
+	const struct ra_rpc_method METHODS[] = {
+		{ 7, _echo_ },
+		{ 3, _fail_ }
+	};
+
+	if (ra_rpc_listen("localhost", "47011", METHODS, 2, NULL)) {
+		(*((int *)ctx)) = -1;
+	}
+}
+
+int
+ra_rpc_test(void)
+{
+	const int N = 2000;
+	const int LARGE_N = 128;
+	const size_t LARGE = 1024 * 1024;
+	ra_thread_t thread, thread_;
+	struct check *checks;
+	struct order order;
+	char buf[1000], *large;
+	uint32_t method;
+	ra_rpc_t rpc;
+	size_t len;
+	int i, e, e_;
+
+	/* initialize */
+
+	e = e_ = 0;
+	rpc = NULL;
+	large = NULL;
+	thread_ = NULL;
+	if (!(checks = malloc(N * sizeof (struct check))) ||
+	    !(large = malloc(LARGE))) {
+		RA_FREE(checks);
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(checks, 0, N * sizeof (struct check));
+	if (!(thread = ra_thread_open(_listen_, &e_)) ||
+	    !(thread_ = ra_thread_open(_listen_reverse_, &e_))) {
+		ra_network_stop();
+		ra_thread_close(thread);
+		RA_FREE(checks);
+		RA_FREE(large);
+		RA_TRACE("^");
+		return -1;
+	}
+	for (i=0; !rpc && (i<100); ++i) {
+		ra_sleep(10000);
+		rpc = ra_rpc_connect("localhost", "47011");
+	}
+
+	/* pipelined calls, several windows deep, with failures mixed in */
+
+	for (i=0; rpc && !e && (i<N); ++i) {
+		method = (i % 17) ? ((i % 101) ? 7 : 9) : 3;
+		len = (size_t)i % sizeof (buf);
+		memset(buf, (char)i, len);
+		checks[i].byte = (char)i;
+		checks[i].len = (7 == method) ? len : 0;
+		checks[i].expected = (7 == method) ? 0 : -1;
+		if (ra_rpc_call(rpc, method, buf, len, _done_, &checks[i])) {
+			e = -1;
+		}
+	}
+	if (!rpc || e || ra_rpc_wait(rpc)) {
+		e = -1;
+	}
+	for (i=0; i<N; ++i) {
+		if ((1 != checks[i].n) || checks[i].e) {
+			e = -1;
+		}
+	}
+
+	/* pipelined payloads far beyond the socket buffers */
+
+	memset(checks, 0, LARGE_N * sizeof (struct check));
+	for (i=0; rpc && !e && (i<LARGE_N); ++i) {
+		memset(large, 'a' + i, LARGE);
+		checks[i].byte = (char)('a' + i);
+		checks[i].len = LARGE;
+		if (ra_rpc_call(rpc, 7, large, LARGE, _done_, &checks[i])) {
+			e = -1;
+		}
+	}
+	if (!rpc || e || ra_rpc_wait(rpc)) {
+		e = -1;
+	}
+	for (i=0; i<LARGE_N; ++i) {
+		if ((1 != checks[i].n) || checks[i].e) {
+			e = -1;
+		}
+	}
+	ra_rpc_close(rpc);
+
+	/* replies completing out of order */
+
+	rpc = NULL;
+	for (i=0; !rpc && (i<100); ++i) {
+		ra_sleep(10000);
+		rpc = ra_rpc_connect("localhost", "47016");
+	}
+	memset(&order, 0, sizeof (struct order));
+	for (i=0; rpc && !e && (i<REVERSE); ++i) {
+		if (ra_rpc_call(rpc, 7, &i, sizeof (int), _order_, &order)) {
+			e = -1;
+		}
+	}
+	if (!rpc || e || ra_rpc_wait(rpc) || (REVERSE != order.n)) {
+		e = -1;
+	}
+	for (i=0; i<REVERSE; ++i) {
+		if (order.reqs[i] != (REVERSE - 1 - i)) {
+			e = -1;
+		}
+	}
+	ra_rpc_close(rpc);
+	ra_network_stop();
+	ra_thread_close(thread);
+	ra_thread_close(thread_);
+	RA_FREE(checks);
+	RA_FREE(large);
+	if (e || e_) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_RPC_H__
+#define __RA_RPC_H__
+
+#include "ra_network.h"
+
+typedef struct ra_rpc *ra_rpc_t;
+
+/**
+ * Server-side handler: on success returns 0 with a malloc'd reply in
+ * (*rep, *replen) (NULL, 0 for none). A connection's requests are handled
+ * one at a time, in order; connections are served concurrently on the
+ * server's fibers.
+ */
+
+typedef int (*ra_rpc_fnc_t)(void *ctx,
+			    const void *req,
+			    size_t len,
+			    void **rep,
+			    size_t *replen);
+
+/**
+ * Client-side completion: status is 0 on success, non-zero when the
+ * method is unknown or its handler failed; rep is valid only during the
+ * call.
+ */
+
+typedef void (*ra_rpc_done_fnc_t)(void *ctx,
+				  int status,
+				  const void *rep,
+				  size_t len);
+
+struct ra_rpc_method {
+	uint32_t id;
+	ra_rpc_fnc_t fnc;
+};
+
+/**
+ * Length-prefixed, ID-tagged frames over ra_network. ra_rpc_listen()
+ * dispatches on the method ID and, like ra_network_listen(), returns on
+ * SIGINT or ra_network_stop(). ra_rpc_call() queues a request without
+ * waiting for its reply; up to 256 calls, and 64 KiB of requests (or one
+ * larger request), are in flight per connection. Replies complete in
+ * whatever order they arrive, inside ra_rpc_call() (when either limit is
+ * reached) or ra_rpc_wait(). A client handle is used by one thread at a
+ * time.
+ */
+
+int ra_rpc_listen(const char *hostname,
+		  const char *servname,
+		  const struct ra_rpc_method *methods,
+		  int n,
+		  void *ctx);
+
+ra_rpc_t ra_rpc_connect(const char *hostname, const char *servname);
+
+void ra_rpc_close(ra_rpc_t rpc);
+
+int ra_rpc_call(ra_rpc_t rpc,
+		uint32_t method,
+		const void *req,
+		size_t len,
+		ra_rpc_done_fnc_t fnc,
+		void *ctx);
+
+int ra_rpc_wait(ra_rpc_t rpc);
+
+int ra_rpc_test(void);
+
+#endif /* __RA_RPC_H__ */
@@ -9,6 +9,38 @@
 
 void ra_sha3(const void *buf, size_t len, void *out);
 
+/**
+ * Incremental ra_sha3(): any split of the same byte stream over
+ * ra_sha3_update() calls yields the ra_sha3() of the whole. The state is
+ * the caller's; at most one partial block is buffered.
+ */
+
+struct ra_sha3_state {
+	uint64_t w[25];
+	size_t n; /* bytes in block */
+	uint8_t block[136];
+};
+
+void ra_sha3_init(struct ra_sha3_state *state);
+
+void ra_sha3_update(struct ra_sha3_state *state, const void *buf, size_t len);
+
+void ra_sha3_final(struct ra_sha3_state *state, void *out);
+
+/**
+ * ra_sha3() of n independent messages into out (n * RA_SHA3_LEN bytes).
+ * Four at a time share one interleaved Keccak state, in AVX2 registers
+ * where the CPU has them, for as many blocks as all four have; equal
+ * lengths (e.g., fixed-size blocks) keep them in lockstep throughout.
+ */
+
+void ra_sha3_batch(const void * const *bufs,
+		   const size_t *lens,
+		   void *out,
+		   size_t n);
+
 int ra_sha3_test(void);
 
+int ra_sha3_bench(void);
+
 #endif /* __RA_SHA3_H__ */
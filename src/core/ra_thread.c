@@ -1,10 +1,26 @@
 /* Copyright (c) Tony Givargis, 2024-2026 */
 
+#define _GNU_SOURCE
+
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
 #include "ra_thread.h"
 
+#define LINE 64
+#define DEQUE 1024 /* power of two */
+#define INJECT 4096
+#define CHUNKS 64
+#define SPIN 100
+#define SPIN_MAX 1000
+#define BACKOFF 1024
+#define SLOTS 32
+#define WRITER 0x40000000
+#define CPUS_MAX 4096
+#define NODES_MAX 64
+#define SYSFS "/sys/devices/system"
+
 struct ra_thread {
 	int good;
 	void *ctx;
@@ -13,6 +29,7 @@ struct ra_thread {
 };
 
 struct ra_mutex {
+	int spin; /* adaptive: running estimate of useful spins, else -1 */
 	pthread_mutex_t mutex;
 };
 
@@ -21,6 +38,120 @@ struct ra_cond {
 	pthread_cond_t cond;
 };
 
+/* where lock waiters park: bump epoch, then wake sleepers */
+
+struct gate {
+	volatile int32_t epoch;
+	volatile int sleepers;
+	ra_mutex_t mutex;
+	ra_cond_t cond;
+};
+
+struct ra_rwlock {
+	volatile int32_t state; /* reader count, or WRITER */
+	volatile int32_t writers; /* waiting */
+	int spin;
+	struct gate gate;
+};
+
+struct ra_brlock {
+	struct {
+		volatile int32_t readers;
+		char pad[LINE - sizeof (int32_t)];
+	} slots[SLOTS];
+	volatile int32_t writer;
+	int spin;
+	ra_mutex_t mutex; /* serializes writers */
+	struct gate gate;
+};
+
+struct ra_spin {
+	volatile int lock;
+};
+
+struct task {
+	void *ctx;
+	ra_thread_fnc_t fnc;
+	struct ra_group *group;
+};
+
+struct ra_pool {
+	int n;
+	int key_;
+	int stop;
+	volatile int waiters;
+	volatile int sleepers;
+	volatile int64_t pending; /* queued, not yet taken */
+	pthread_key_t key;
+	ra_mutex_t mutex;
+	ra_cond_t work;
+	ra_cond_t done;
+	struct worker {
+		volatile int64_t top;
+		char pad1[LINE - sizeof (int64_t)];
+		volatile int64_t bottom;
+		char pad2[LINE - sizeof (int64_t)];
+		int cpu; /* pinned, or -1 */
+		uint64_t seed;
+		ra_thread_t thread;
+		struct ra_pool *pool;
+		struct task tasks[DEQUE];
+	} *workers;
+	void *workers_;
+	struct {
+		volatile uint64_t head;
+		volatile uint64_t tail;
+		struct task tasks[INJECT];
+	} inject; /* under mutex */
+};
+
+struct ra_group {
+	struct ra_pool *pool;
+	volatile int64_t count;
+};
+
+struct chunk {
+	void *r;
+	void *ctx;
+	uint64_t begin;
+	uint64_t end;
+	ra_parallel_fnc_t fnc;
+	ra_partial_fnc_t partial;
+};
+
+static ra_pool_t default_;
+static pthread_once_t once_ = PTHREAD_ONCE_INIT;
+
+static struct ra_cpu *cpus_;
+static int cpus_n_;
+static pthread_once_t topology_ = PTHREAD_ONCE_INIT;
+
+static void
+relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__ ("pause");
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ("yield");
+#endif
+}
+
+static void
+backoff(int *delay)
+{
+	int i;
+
+	for (i=0; i<(*delay); ++i) {
+		relax();
+	}
+	if (BACKOFF > (*delay)) {
+		(*delay) <<= 1;
+	}
+	else {
+		sched_yield();
+	}
+}
+
 static void *
 _thread_(void *ctx)
 {
@@ -72,6 +203,211 @@ ra_thread_good(ra_thread_t thread)
 	return thread && thread->good;
 }
 
+static int
+sysfs(char *buf, size_t len, const char *format, ...)
+{
+	char pathname[256];
+	va_list ap;
+	FILE *file;
+
+	va_start(ap, format);
+	vsprintf(pathname, format, ap);
+	va_end(ap);
+	if (!(file = fopen(pathname, "r"))) {
+		return -1;
+	}
+	if (!fgets(buf, (int)len, file)) {
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	return 0;
+}
+
+/*
+ * Parses a sysfs CPU list ("0-3,8,10-11"): returns how many of its CPUs
+ * are below cpu and sets *member if cpu itself is listed.
+ */
+
+static int
+cpulist(const char *s, int cpu, int *member)
+{
+	long a, b;
+	char *end;
+	int n;
+
+	n = 0;
+	(*member) = 0;
+	while (isdigit((unsigned char)(*s))) {
+		a = b = strtol(s, &end, 10);
+		if ('-' == (*end)) {
+			b = strtol(end + 1, &end, 10);
+		}
+		if ((a <= cpu) && (cpu <= b)) {
+			(*member) = 1;
+		}
+		n += (int)(RA_MIN(b + 1, cpu) - RA_MIN(a, cpu));
+		s = (',' == (*end)) ? (end + 1) : end;
+	}
+	return n;
+}
+
+static void
+_topology_(void)
+{
+	int i, j, n, m, level, member, *raw;
+	char online[1024], buf[1024];
+
+	if (sysfs(online, sizeof (online), SYSFS "/cpu/online") ||
+	    !(cpus_ = malloc(CPUS_MAX * sizeof (cpus_[0]))) ||
+	    !(raw = malloc(CPUS_MAX * sizeof (raw[0])))) {
+		RA_FREE(cpus_);
+		cpus_n_ = ra_cores();
+		if ((cpus_ = malloc(cpus_n_ * sizeof (cpus_[0])))) {
+			memset(cpus_, 0, cpus_n_ * sizeof (cpus_[0]));
+			for (i=0; i<cpus_n_; ++i) {
+				cpus_[i].id = cpus_[i].core = cpus_[i].llc = i;
+			}
+		}
+		return;
+	}
+	n = 0;
+	for (i=0; i<CPUS_MAX; ++i) {
+		cpulist(online, i, &member);
+		if (!member) {
+			continue;
+		}
+		memset(&cpus_[n], 0, sizeof (cpus_[n]));
+		cpus_[n].id = i;
+		cpus_[n].llc = i;
+		raw[n] = i;
+		if (!sysfs(buf, sizeof (buf),
+			   SYSFS "/cpu/cpu%d/topology/physical_package_id",
+			   i)) {
+			cpus_[n].package = atoi(buf);
+		}
+		if (!sysfs(buf, sizeof (buf),
+			   SYSFS "/cpu/cpu%d/topology/core_id",
+			   i)) {
+			raw[n] = atoi(buf);
+		}
+		if (!sysfs(buf, sizeof (buf),
+			   SYSFS "/cpu/cpu%d/topology/thread_siblings_list",
+			   i)) {
+			cpus_[n].smt = cpulist(buf, i, &member);
+		}
+		for (j=0, m=0; j<16; ++j) {
+			if (sysfs(buf, sizeof (buf),
+				  SYSFS "/cpu/cpu%d/cache/index%d/level",
+				  i,
+				  j)) {
+				break;
+			}
+			if (m <= (level = atoi(buf)) &&
+			    !sysfs(buf, sizeof (buf),
+				   SYSFS "/cpu/cpu%d/cache/index%d/"
+				   "shared_cpu_list",
+				   i,
+				   j)) {
+				m = level;
+				cpus_[n].llc = atoi(buf);
+			}
+		}
+		for (j=0; j<NODES_MAX; ++j) {
+			if (!sysfs(buf, sizeof (buf),
+				   SYSFS "/node/node%d/cpulist",
+				   j)) {
+				cpulist(buf, i, &member);
+				if (member) {
+					cpus_[n].node = j;
+					break;
+				}
+			}
+		}
+		++n;
+	}
+
+	/* number cores densely within each package */
+
+	for (i=0; i<n; ++i) {
+		cpus_[i].core = 0;
+		for (j=0; j<n; ++j) {
+			if ((cpus_[i].package == cpus_[j].package) &&
+			    (raw[j] < raw[i]) &&
+			    !cpus_[j].smt) {
+				++cpus_[i].core;
+			}
+		}
+	}
+	cpus_n_ = n;
+	RA_FREE(raw);
+}
+
+const struct ra_cpu *
+ra_topology(int *n)
+{
+	assert( n );
+
+	pthread_once(&topology_, _topology_);
+	(*n) = cpus_ ? cpus_n_ : 0;
+	return cpus_;
+}
+
+static int
+affinity(ra_thread_t thread, int cpu, int node)
+{
+#if defined(__linux__)
+	const struct ra_cpu *cpus;
+	cpu_set_t set;
+	int i, n, k;
+
+	k = 0;
+	CPU_ZERO(&set);
+	cpus = ra_topology(&n);
+	for (i=0; i<n; ++i) {
+		if ((0 <= cpu) ? (cpu == cpus[i].id) : (node == cpus[i].node)) {
+			CPU_SET(cpus[i].id, &set);
+			++k;
+		}
+	}
+	if (!k) {
+		RA_TRACE("no such cpu or node");
+		return -1;
+	}
+	if (pthread_setaffinity_np(thread ? thread->pthread : pthread_self(),
+				   sizeof (set),
+				   &set)) {
+		RA_TRACE("system failure detected");
+		return -1;
+	}
+	return 0;
+#else
+	(void)thread;
+	(void)cpu;
+	(void)node;
+	RA_TRACE("thread affinity not supported");
+	return -1;
+#endif /* __linux__ */
+}
+
+int
+ra_thread_affinity(ra_thread_t thread, int cpu)
+{
+	assert( !thread || thread->good );
+	assert( 0 <= cpu );
+
+	return affinity(thread, cpu, -1);
+}
+
+int
+ra_thread_affinity_node(ra_thread_t thread, int node)
+{
+	assert( !thread || thread->good );
+	assert( 0 <= node );
+
+	return affinity(thread, -1, node);
+}
+
 ra_mutex_t
 ra_mutex_open(void)
 {
@@ -82,6 +418,7 @@ ra_mutex_open(void)
 		return NULL;
 	}
 	memset(mutex, 0, sizeof (struct ra_mutex));
+	mutex->spin = -1;
 	if (pthread_mutex_init(&mutex->mutex, NULL)) {
 		ra_mutex_close(mutex);
 		RA_TRACE("system failure detected");
@@ -90,6 +427,17 @@ ra_mutex_open(void)
 	return mutex;
 }
 
+ra_mutex_t
+ra_mutex_open_adaptive(void)
+{
+	struct ra_mutex *mutex;
+
+	if ((mutex = ra_mutex_open()) && (1 < ra_cores())) {
+		mutex->spin = SPIN;
+	}
+	return mutex;
+}
+
 void
 ra_mutex_close(ra_mutex_t mutex)
 {
@@ -103,8 +451,20 @@ ra_mutex_close(ra_mutex_t mutex)
 void
 ra_mutex_lock(ra_mutex_t mutex)
 {
+	int i, n;
+
 	assert( mutex );
 
+	if (0 <= mutex->spin) {
+		n = RA_MIN(SPIN_MAX, 2 * mutex->spin + 10);
+		for (i=0; i<n; ++i) {
+			if (!pthread_mutex_trylock(&mutex->mutex)) {
+				mutex->spin += (i - mutex->spin) / 8;
+				return;
+			}
+			relax();
+		}
+	}
 	if (pthread_mutex_lock(&mutex->mutex)) {
 		RA_TRACE("system failure detected (abort)");
 		abort();
@@ -164,6 +524,17 @@ ra_cond_signal(ra_cond_t cond)
 	}
 }
 
+void
+ra_cond_broadcast(ra_cond_t cond)
+{
+	assert( cond );
+
+	if (pthread_cond_broadcast(&cond->cond)) {
+		RA_TRACE("system failure detected (abort)");
+		abort();
+	}
+}
+
 void
 ra_cond_wait(ra_cond_t cond)
 {
@@ -174,3 +545,1451 @@ ra_cond_wait(ra_cond_t cond)
 		abort();
 	}
 }
+
+int
+ra_cond_timedwait(ra_cond_t cond, uint64_t us)
+{
+	struct timespec ts;
+	int e;
+
+	assert( cond );
+
+	if (clock_gettime(CLOCK_REALTIME, &ts)) {
+		RA_TRACE("system failure detected (abort)");
+		abort();
+	}
+	us += (uint64_t)ts.tv_nsec / 1000;
+	ts.tv_sec += (time_t)(us / 1000000);
+	ts.tv_nsec = (long)(us % 1000000) * 1000;
+	e = pthread_cond_timedwait(&cond->cond, &cond->mutex->mutex, &ts);
+	if (e) {
+		if (ETIMEDOUT == e) {
+			return -1;
+		}
+		RA_TRACE("system failure detected (abort)");
+		abort();
+	}
+	return 0;
+}
+
+static int
+gate_open(struct gate *gate)
+{
+	if (!(gate->mutex = ra_mutex_open()) ||
+	    !(gate->cond = ra_cond_open(gate->mutex))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+gate_close(struct gate *gate)
+{
+	ra_cond_close(gate->cond);
+	ra_mutex_close(gate->mutex);
+}
+
+static void
+gate_park(struct gate *gate, int32_t epoch)
+{
+	ra_mutex_lock(gate->mutex);
+	++gate->sleepers;
+	__sync_synchronize();
+	if (epoch == gate->epoch) {
+		ra_cond_wait(gate->cond);
+	}
+	--gate->sleepers;
+	ra_mutex_unlock(gate->mutex);
+}
+
+static void
+gate_release(struct gate *gate)
+{
+	__sync_fetch_and_add(&gate->epoch, 1);
+	if (gate->sleepers) {
+		ra_mutex_lock(gate->mutex);
+		ra_cond_broadcast(gate->cond);
+		ra_mutex_unlock(gate->mutex);
+	}
+}
+
+ra_rwlock_t
+ra_rwlock_open(void)
+{
+	struct ra_rwlock *rwlock;
+
+	if (!(rwlock = malloc(sizeof (struct ra_rwlock)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(rwlock, 0, sizeof (struct ra_rwlock));
+	rwlock->spin = (1 < ra_cores()) ? SPIN : 0;
+	if (gate_open(&rwlock->gate)) {
+		ra_rwlock_close(rwlock);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return rwlock;
+}
+
+void
+ra_rwlock_close(ra_rwlock_t rwlock)
+{
+	if (rwlock) {
+		gate_close(&rwlock->gate);
+		memset(rwlock, 0, sizeof (struct ra_rwlock));
+		RA_FREE(rwlock);
+	}
+}
+
+void
+ra_rwlock_read_lock(ra_rwlock_t rwlock)
+{
+	int32_t s, epoch;
+	int i;
+
+	assert( rwlock );
+
+	for (i=0;; ++i) {
+		s = rwlock->state;
+		if (!(WRITER & s) && !rwlock->writers) {
+			if (__sync_bool_compare_and_swap(&rwlock->state,
+							 s,
+							 s + 1)) {
+				return;
+			}
+			continue;
+		}
+		if (i < rwlock->spin) {
+			relax();
+			continue;
+		}
+		epoch = rwlock->gate.epoch;
+		__sync_synchronize();
+		if ((WRITER & rwlock->state) || rwlock->writers) {
+			gate_park(&rwlock->gate, epoch);
+		}
+	}
+}
+
+void
+ra_rwlock_read_unlock(ra_rwlock_t rwlock)
+{
+	assert( rwlock && (0 < rwlock->state) && (WRITER > rwlock->state) );
+
+	if (!__sync_sub_and_fetch(&rwlock->state, 1)) {
+		gate_release(&rwlock->gate);
+	}
+}
+
+void
+ra_rwlock_write_lock(ra_rwlock_t rwlock)
+{
+	int32_t epoch;
+	int i;
+
+	assert( rwlock );
+
+	__sync_fetch_and_add(&rwlock->writers, 1);
+	for (i=0;; ++i) {
+		if (!rwlock->state &&
+		    __sync_bool_compare_and_swap(&rwlock->state, 0, WRITER)) {
+			break;
+		}
+		if (i < rwlock->spin) {
+			relax();
+			continue;
+		}
+		epoch = rwlock->gate.epoch;
+		__sync_synchronize();
+		if (rwlock->state) {
+			gate_park(&rwlock->gate, epoch);
+		}
+	}
+	__sync_fetch_and_sub(&rwlock->writers, 1);
+}
+
+void
+ra_rwlock_write_unlock(ra_rwlock_t rwlock)
+{
+	assert( rwlock && (WRITER == rwlock->state) );
+
+	__sync_fetch_and_sub(&rwlock->state, WRITER);
+	gate_release(&rwlock->gate);
+}
+
+ra_brlock_t
+ra_brlock_open(void)
+{
+	struct ra_brlock *brlock;
+
+	if (!(brlock = malloc(sizeof (struct ra_brlock)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(brlock, 0, sizeof (struct ra_brlock));
+	brlock->spin = (1 < ra_cores()) ? SPIN : 0;
+	if (!(brlock->mutex = ra_mutex_open()) || gate_open(&brlock->gate)) {
+		ra_brlock_close(brlock);
+		RA_TRACE("^");
+		return NULL;
+	}
+	return brlock;
+}
+
+void
+ra_brlock_close(ra_brlock_t brlock)
+{
+	if (brlock) {
+		gate_close(&brlock->gate);
+		ra_mutex_close(brlock->mutex);
+		memset(brlock, 0, sizeof (struct ra_brlock));
+		RA_FREE(brlock);
+	}
+}
+
+int
+ra_brlock_read_lock(ra_brlock_t brlock)
+{
+	int32_t epoch;
+	int slot, i;
+
+	assert( brlock );
+
+	/* threads run on distinct stacks: hash one of its addresses */
+
+	slot = (int)((((uint64_t)(size_t)&slot >> 12) *
+		      0x9e3779b97f4a7c15) >> 59) % SLOTS;
+	for (;;) {
+		__sync_fetch_and_add(&brlock->slots[slot].readers, 1);
+		if (!brlock->writer) {
+			return slot;
+		}
+		__sync_fetch_and_sub(&brlock->slots[slot].readers, 1);
+		for (i=0; brlock->writer; ++i) {
+			if (i < brlock->spin) {
+				relax();
+				continue;
+			}
+			epoch = brlock->gate.epoch;
+			__sync_synchronize();
+			if (brlock->writer) {
+				gate_park(&brlock->gate, epoch);
+			}
+		}
+	}
+}
+
+void
+ra_brlock_read_unlock(ra_brlock_t brlock, int slot)
+{
+	assert( brlock && (0 <= slot) && (SLOTS > slot) );
+
+	__sync_fetch_and_sub(&brlock->slots[slot].readers, 1);
+}
+
+void
+ra_brlock_write_lock(ra_brlock_t brlock)
+{
+	int i, delay;
+
+	assert( brlock );
+
+	ra_mutex_lock(brlock->mutex);
+	brlock->writer = 1;
+	__sync_synchronize();
+	for (i=0; i<SLOTS; ++i) {
+		delay = 1;
+		while (brlock->slots[i].readers) {
+			backoff(&delay);
+		}
+	}
+}
+
+void
+ra_brlock_write_unlock(ra_brlock_t brlock)
+{
+	assert( brlock && brlock->writer );
+
+	__sync_synchronize();
+	brlock->writer = 0;
+	gate_release(&brlock->gate);
+	ra_mutex_unlock(brlock->mutex);
+}
+
+ra_spin_t
+ra_spin_open(void)
+{
+	struct ra_spin *spin;
+
+	if (!(spin = malloc(sizeof (struct ra_spin)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(spin, 0, sizeof (struct ra_spin));
+	return spin;
+}
+
+void
+ra_spin_close(ra_spin_t spin)
+{
+	if (spin) {
+		memset(spin, 0, sizeof (struct ra_spin));
+		RA_FREE(spin);
+	}
+}
+
+void
+ra_spin_lock(ra_spin_t spin)
+{
+	int delay;
+
+	assert( spin );
+
+	delay = 1;
+	while (__sync_lock_test_and_set(&spin->lock, 1)) {
+		while (spin->lock) {
+			backoff(&delay);
+		}
+	}
+}
+
+void
+ra_spin_unlock(ra_spin_t spin)
+{
+	assert( spin && spin->lock );
+
+	__sync_lock_release(&spin->lock);
+}
+
+/*
+ * Chase-Lev deque: the owner pushes and pops at the bottom, thieves take
+ * from the top. Only the last task is contended, settled by a CAS on top.
+ */
+
+static int
+push(struct worker *worker, const struct task *task)
+{
+	int64_t b, t;
+
+	b = worker->bottom;
+	t = worker->top;
+	if (DEQUE <= (b - t)) {
+		return -1;
+	}
+	worker->tasks[b & (DEQUE - 1)] = (*task);
+	__sync_synchronize();
+	worker->bottom = b + 1;
+	return 0;
+}
+
+static int
+pop(struct worker *worker, struct task *task)
+{
+	int64_t b, t;
+	int e;
+
+	b = worker->bottom - 1;
+	worker->bottom = b;
+	__sync_synchronize();
+	t = worker->top;
+	if (t > b) {
+		worker->bottom = b + 1;
+		return -1;
+	}
+	e = 0;
+	(*task) = worker->tasks[b & (DEQUE - 1)];
+	if (t == b) {
+		if (!__sync_bool_compare_and_swap(&worker->top, t, t + 1)) {
+			e = -1;
+		}
+		worker->bottom = b + 1;
+	}
+	return e;
+}
+
+static int
+steal(struct worker *worker, struct task *task)
+{
+	int64_t b, t;
+
+	t = worker->top;
+	__sync_synchronize();
+	b = worker->bottom;
+	if (t >= b) {
+		return -1;
+	}
+	__sync_synchronize();
+	(*task) = worker->tasks[t & (DEQUE - 1)];
+	if (!__sync_bool_compare_and_swap(&worker->top, t, t + 1)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int
+take_(struct ra_pool *pool, struct worker *self, struct task *task)
+{
+	uint64_t j;
+	int i;
+
+	if (self && !pop(self, task)) {
+		return 0;
+	}
+	if (pool->inject.head != pool->inject.tail) {
+		ra_mutex_lock(pool->mutex);
+		if (pool->inject.head != pool->inject.tail) {
+			j = pool->inject.head++ % INJECT;
+			(*task) = pool->inject.tasks[j];
+			ra_mutex_unlock(pool->mutex);
+			return 0;
+		}
+		ra_mutex_unlock(pool->mutex);
+	}
+	j = 0;
+	if (self) {
+		self->seed ^= self->seed << 13;
+		self->seed ^= self->seed >> 7;
+		self->seed ^= self->seed << 17;
+		j = self->seed;
+	}
+	for (i=0; i<pool->n; ++i) {
+		self = &pool->workers[(j + (uint64_t)i) % (uint64_t)pool->n];
+		if (!steal(self, task)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int
+take(struct ra_pool *pool, struct worker *self, struct task *task)
+{
+	if (take_(pool, self, task)) {
+		return -1;
+	}
+	__sync_fetch_and_sub(&pool->pending, 1);
+	return 0;
+}
+
+static void
+run(struct ra_pool *pool, const struct task *task)
+{
+	struct ra_group *group;
+
+	group = task->group;
+	task->fnc(task->ctx);
+	if (!__sync_sub_and_fetch(&group->count, 1) && pool->waiters) {
+		ra_mutex_lock(pool->mutex);
+		ra_cond_broadcast(pool->done);
+		ra_mutex_unlock(pool->mutex);
+	}
+}
+
+static void
+_worker_(void *ctx)
+{
+	struct worker *worker;
+	struct ra_pool *pool;
+	struct task task;
+
+	worker = (struct worker *)ctx;
+	pool = worker->pool;
+	pthread_setspecific(pool->key, worker);
+	if ((0 <= worker->cpu) && ra_thread_affinity(NULL, worker->cpu)) {
+		worker->cpu = -1;
+	}
+	for (;;) {
+		if (!take(pool, worker, &task)) {
+			run(pool, &task);
+			continue;
+		}
+		ra_mutex_lock(pool->mutex);
+		++pool->sleepers;
+		__sync_synchronize();
+		if (!pool->stop && (0 >= pool->pending)) {
+			ra_cond_wait(pool->work);
+		}
+		--pool->sleepers;
+		if (pool->stop) {
+			ra_mutex_unlock(pool->mutex);
+			break;
+		}
+		ra_mutex_unlock(pool->mutex);
+	}
+}
+
+static int
+_spread_(const void *a_, const void *b_)
+{
+	const struct ra_cpu *a = (const struct ra_cpu *)a_;
+	const struct ra_cpu *b = (const struct ra_cpu *)b_;
+
+	if (a->smt != b->smt) {
+		return a->smt - b->smt;
+	}
+	if (a->core != b->core) {
+		return a->core - b->core;
+	}
+	if (a->package != b->package) {
+		return a->package - b->package;
+	}
+	return a->id - b->id;
+}
+
+static int
+_pack_(const void *a_, const void *b_)
+{
+	const struct ra_cpu *a = (const struct ra_cpu *)a_;
+	const struct ra_cpu *b = (const struct ra_cpu *)b_;
+
+	if (a->package != b->package) {
+		return a->package - b->package;
+	}
+	if (a->core != b->core) {
+		return a->core - b->core;
+	}
+	if (a->smt != b->smt) {
+		return a->smt - b->smt;
+	}
+	return a->id - b->id;
+}
+
+ra_pool_t
+ra_pool_open(int n)
+{
+	return ra_pool_open_placed(n, RA_PLACE_NONE);
+}
+
+ra_pool_t
+ra_pool_open_placed(int n, ra_place_t place)
+{
+	const struct ra_cpu *cpus;
+	struct ra_cpu *order;
+	struct ra_pool *pool;
+	struct worker *worker;
+	int i, m;
+
+	assert( 0 <= n );
+
+	/* initialize */
+
+	if (!(pool = malloc(sizeof (struct ra_pool)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(pool, 0, sizeof (struct ra_pool));
+	pool->n = n ? n : ra_cores();
+	if (!(pool->workers_ = malloc(pool->n * sizeof (struct worker) +
+				      LINE))) {
+		ra_pool_close(pool);
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	pool->workers = ra_align(pool->workers_, LINE);
+	memset(pool->workers, 0, pool->n * sizeof (struct worker));
+	if (pthread_key_create(&pool->key, NULL)) {
+		ra_pool_close(pool);
+		RA_TRACE("system failure detected");
+		return NULL;
+	}
+	pool->key_ = 1;
+	if (!(pool->mutex = ra_mutex_open()) ||
+	    !(pool->work = ra_cond_open(pool->mutex)) ||
+	    !(pool->done = ra_cond_open(pool->mutex))) {
+		ra_pool_close(pool);
+		RA_TRACE("^");
+		return NULL;
+	}
+
+	/* placement */
+
+	for (i=0; i<pool->n; ++i) {
+		pool->workers[i].cpu = -1;
+	}
+	cpus = ra_topology(&m);
+	if ((RA_PLACE_NONE != place) &&
+	    m &&
+	    (order = malloc(m * sizeof (order[0])))) {
+		memcpy(order, cpus, m * sizeof (order[0]));
+		qsort(order,
+		      m,
+		      sizeof (order[0]),
+		      (RA_PLACE_SPREAD == place) ? _spread_ : _pack_);
+		for (i=0; i<pool->n; ++i) {
+			pool->workers[i].cpu = order[i % m].id;
+		}
+		RA_FREE(order);
+	}
+
+	/* start */
+
+	for (i=0; i<pool->n; ++i) {
+		worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->seed = 0x9e3779b97f4a7c15 * (uint64_t)(i + 1);
+		if (!(worker->thread = ra_thread_open(_worker_, worker))) {
+			ra_pool_close(pool);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void
+ra_pool_close(ra_pool_t pool)
+{
+	int i;
+
+	if (pool) {
+		if (pool->mutex && pool->work) {
+			ra_mutex_lock(pool->mutex);
+			pool->stop = 1;
+			ra_cond_broadcast(pool->work);
+			ra_mutex_unlock(pool->mutex);
+		}
+		for (i=0; pool->workers && (i<pool->n); ++i) {
+			ra_thread_close(pool->workers[i].thread);
+		}
+		ra_cond_close(pool->done);
+		ra_cond_close(pool->work);
+		ra_mutex_close(pool->mutex);
+		if (pool->key_) {
+			pthread_key_delete(pool->key);
+		}
+		RA_FREE(pool->workers_);
+		memset(pool, 0, sizeof (struct ra_pool));
+		RA_FREE(pool);
+	}
+}
+
+int
+ra_pool_size(ra_pool_t pool)
+{
+	assert( pool );
+
+	return pool->n;
+}
+
+ra_group_t
+ra_group_open(ra_pool_t pool)
+{
+	struct ra_group *group;
+
+	assert( pool );
+
+	if (!(group = malloc(sizeof (struct ra_group)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(group, 0, sizeof (struct ra_group));
+	group->pool = pool;
+	return group;
+}
+
+void
+ra_group_close(ra_group_t group)
+{
+	if (group) {
+		assert( !group->count );
+		memset(group, 0, sizeof (struct ra_group));
+		RA_FREE(group);
+	}
+}
+
+void
+ra_group_submit(ra_group_t group, ra_thread_fnc_t fnc, void *ctx)
+{
+	struct worker *self;
+	struct ra_pool *pool;
+	struct task task;
+	int e;
+
+	assert( group && fnc );
+
+	pool = group->pool;
+	task.ctx = ctx;
+	task.fnc = fnc;
+	task.group = group;
+	__sync_fetch_and_add(&group->count, 1);
+	__sync_fetch_and_add(&pool->pending, 1);
+	if ((self = pthread_getspecific(pool->key))) {
+		e = push(self, &task);
+	}
+	else {
+		e = -1;
+		ra_mutex_lock(pool->mutex);
+		if (INJECT > (pool->inject.tail - pool->inject.head)) {
+			pool->inject.tasks[pool->inject.tail % INJECT] = task;
+			++pool->inject.tail;
+			e = 0;
+		}
+		ra_mutex_unlock(pool->mutex);
+	}
+	if (e) {
+		__sync_fetch_and_sub(&pool->pending, 1);
+		run(pool, &task);
+		return;
+	}
+	__sync_synchronize();
+	if (pool->sleepers) {
+		ra_mutex_lock(pool->mutex);
+		ra_cond_signal(pool->work);
+		ra_mutex_unlock(pool->mutex);
+	}
+}
+
+void
+ra_group_wait(ra_group_t group)
+{
+	struct worker *self;
+	struct ra_pool *pool;
+	struct task task;
+
+	assert( group );
+
+	pool = group->pool;
+	self = pthread_getspecific(pool->key);
+	while (group->count) {
+		if (!take(pool, self, &task)) {
+			run(pool, &task);
+			continue;
+		}
+		ra_mutex_lock(pool->mutex);
+		++pool->waiters;
+		__sync_synchronize();
+		if (group->count && (0 >= pool->pending)) {
+			ra_cond_wait(pool->done);
+		}
+		--pool->waiters;
+		ra_mutex_unlock(pool->mutex);
+	}
+}
+
+static void
+_default_(void)
+{
+	default_ = ra_pool_open(0);
+}
+
+ra_pool_t
+ra_pool_default(void)
+{
+	pthread_once(&once_, _default_);
+	return default_;
+}
+
+static void
+_chunk_(void *ctx)
+{
+	struct chunk *chunk;
+
+	chunk = (struct chunk *)ctx;
+	if (chunk->partial) {
+		chunk->partial(chunk->ctx, chunk->begin, chunk->end, chunk->r);
+	}
+	else {
+		chunk->fnc(chunk->ctx, chunk->begin, chunk->end);
+	}
+}
+
+static int
+partition(struct chunk *chunks,
+	  ra_pool_t pool,
+	  uint64_t begin,
+	  uint64_t end,
+	  uint64_t grain)
+{
+	uint64_t n, q, r, i;
+
+	n = 1;
+	if (pool && (1 < pool->n)) {
+		n = RA_MAX(1, (end - begin) / RA_MAX(1, grain));
+		n = RA_MIN(n, RA_MIN(4 * (uint64_t)pool->n, CHUNKS));
+	}
+	q = (end - begin) / n;
+	r = (end - begin) % n;
+	memset(chunks, 0, n * sizeof (chunks[0]));
+	for (i=0; i<n; ++i) {
+		chunks[i].begin = begin + i * q + RA_MIN(i, r);
+		chunks[i].end = chunks[i].begin + q + (i < r);
+	}
+	return (int)n;
+}
+
+static void
+parallel(ra_pool_t pool, struct chunk *chunks, int n)
+{
+	ra_group_t group;
+	int i;
+
+	if ((1 < n) && (group = ra_group_open(pool))) {
+		for (i=1; i<n; ++i) {
+			ra_group_submit(group, _chunk_, &chunks[i]);
+		}
+		_chunk_(&chunks[0]);
+		ra_group_wait(group);
+		ra_group_close(group);
+		return;
+	}
+	for (i=0; i<n; ++i) {
+		_chunk_(&chunks[i]);
+	}
+}
+
+static void
+parallel_for(ra_pool_t pool,
+	     uint64_t begin,
+	     uint64_t end,
+	     uint64_t grain,
+	     ra_parallel_fnc_t fnc,
+	     void *ctx)
+{
+	struct chunk chunks[CHUNKS];
+	int i, n;
+
+	if (begin < end) {
+		n = partition(chunks, pool, begin, end, grain);
+		for (i=0; i<n; ++i) {
+			chunks[i].ctx = ctx;
+			chunks[i].fnc = fnc;
+		}
+		parallel(pool, chunks, n);
+	}
+}
+
+static void
+parallel_reduce(ra_pool_t pool,
+		uint64_t begin,
+		uint64_t end,
+		uint64_t grain,
+		ra_partial_fnc_t fnc,
+		ra_reduce_fnc_t join,
+		void *ctx,
+		void *r,
+		size_t size)
+{
+	struct chunk chunks[CHUNKS];
+	char *buf;
+	int i, n;
+
+	if (begin < end) {
+		n = partition(chunks, pool, begin, end, grain);
+		if ((1 == n) || !(buf = malloc(n * size))) {
+			fnc(ctx, begin, end, r);
+			return;
+		}
+		for (i=0; i<n; ++i) {
+			chunks[i].r = buf + i * size;
+			chunks[i].ctx = ctx;
+			chunks[i].partial = fnc;
+			memcpy(chunks[i].r, r, size);
+		}
+		parallel(pool, chunks, n);
+		for (i=0; i<n; ++i) {
+			join(ctx, r, chunks[i].r);
+		}
+		RA_FREE(buf);
+	}
+}
+
+void
+ra_parallel_for(uint64_t begin,
+		uint64_t end,
+		uint64_t grain,
+		ra_parallel_fnc_t fnc,
+		void *ctx)
+{
+	assert( fnc );
+
+	parallel_for(ra_pool_default(), begin, end, grain, fnc, ctx);
+}
+
+void
+ra_parallel_reduce(uint64_t begin,
+		   uint64_t end,
+		   uint64_t grain,
+		   ra_partial_fnc_t fnc,
+		   ra_reduce_fnc_t join,
+		   void *ctx,
+		   void *r,
+		   size_t size)
+{
+	assert( fnc && join && r && size );
+
+	parallel_reduce(ra_pool_default(),
+			begin,
+			end,
+			grain,
+			fnc,
+			join,
+			ctx,
+			r,
+			size);
+}
+
+struct fib {
+	int n;
+	uint64_t r;
+	ra_pool_t pool;
+};
+
+static void
+_fib_(void *ctx)
+{
+	struct fib *fib, a, b;
+	ra_group_t group;
+
+	fib = (struct fib *)ctx;
+	if (2 > fib->n) {
+		fib->r = (uint64_t)fib->n;
+		return;
+	}
+	a.n = fib->n - 1;
+	b.n = fib->n - 2;
+	a.pool = b.pool = fib->pool;
+	if ((group = ra_group_open(fib->pool))) {
+		ra_group_submit(group, _fib_, &a);
+		ra_group_submit(group, _fib_, &b);
+		ra_group_wait(group);
+		ra_group_close(group);
+	}
+	else {
+		_fib_(&a);
+		_fib_(&b);
+	}
+	fib->r = a.r + b.r;
+}
+
+static void
+_count_(void *ctx)
+{
+	__sync_fetch_and_add((uint64_t *)ctx, 1);
+}
+
+static void
+_square_(void *ctx, uint64_t begin, uint64_t end)
+{
+	uint64_t i;
+
+	for (i=begin; i<end; ++i) {
+		((uint64_t *)ctx)[i] = i * i;
+	}
+}
+
+static void
+_sum_(void *ctx, uint64_t begin, uint64_t end, void *r)
+{
+	uint64_t i;
+
+	for (i=begin; i<end; ++i) {
+		(*((uint64_t *)r)) += ((const uint64_t *)ctx)[i];
+	}
+}
+
+static void
+_join_(void *ctx, void *r, const void *r_)
+{
+	(void)ctx;
+	(*((uint64_t *)r)) += (*((const uint64_t *)r_));
+}
+
+static int
+parallel_test(ra_pool_t pool, uint64_t *a, int n)
+{
+	uint64_t sum, i;
+
+	memset(a, 0, n * sizeof (a[0]));
+	parallel_for(pool, 0, (uint64_t)n, 100, _square_, a);
+	for (i=0; i<(uint64_t)n; ++i) {
+		if ((i * i) != a[i]) {
+			return -1;
+		}
+	}
+	sum = 0;
+	parallel_reduce(pool, 0, (uint64_t)n, 100, _sum_, _join_, a, &sum, 8);
+	i = (uint64_t)n;
+	if (((i - 1) * i * (2 * i - 1) / 6) != sum) {
+		return -1;
+	}
+	return 0;
+}
+
+static int
+partition_test(ra_pool_t pool)
+{
+	const uint64_t LENS[] = { 0, 3, 4, 7, 10, 99, 1000, 1000003 };
+	const uint64_t GRAINS[] = { 1, 4, 8, 100 };
+	struct chunk chunks[CHUNKS];
+	uint64_t i, j, next;
+	int k, n;
+
+	/* chunks tile the range and none is below grain unless all are */
+
+	for (i=0; i<RA_ARRAY_SIZE(LENS); ++i) {
+		for (j=0; j<RA_ARRAY_SIZE(GRAINS); ++j) {
+			n = partition(chunks, pool, 5, 5 + LENS[i], GRAINS[j]);
+			next = 5;
+			for (k=0; k<n; ++k) {
+				if ((next != chunks[k].begin) ||
+				    ((1 < n) &&
+				     (GRAINS[j] > (chunks[k].end -
+						   chunks[k].begin)))) {
+					return -1;
+				}
+				next = chunks[k].end;
+			}
+			if ((5 + LENS[i]) != next) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static const char *LOCKS[] = {
+	"mutex", "adaptive", "spin", "rwlock", "brlock"
+};
+
+struct contend {
+	int fail;
+	int kind;
+	int writes; /* percent */
+	uint64_t ops;
+	uint64_t seed;
+	uint64_t wrote;
+	struct shared {
+		ra_mutex_t mutex;
+		ra_spin_t spin;
+		ra_rwlock_t rwlock;
+		ra_brlock_t brlock;
+		volatile uint64_t data[8];
+	} *shared;
+};
+
+static int
+acquire(struct shared *shared, int kind, int write)
+{
+	switch (kind) {
+	case 0:
+	case 1:
+		ra_mutex_lock(shared->mutex);
+		break;
+	case 2:
+		ra_spin_lock(shared->spin);
+		break;
+	case 3:
+		if (write) {
+			ra_rwlock_write_lock(shared->rwlock);
+		}
+		else {
+			ra_rwlock_read_lock(shared->rwlock);
+		}
+		break;
+	default:
+		if (!write) {
+			return ra_brlock_read_lock(shared->brlock);
+		}
+		ra_brlock_write_lock(shared->brlock);
+		break;
+	}
+	return 0;
+}
+
+static void
+release(struct shared *shared, int kind, int write, int slot)
+{
+	switch (kind) {
+	case 0:
+	case 1:
+		ra_mutex_unlock(shared->mutex);
+		break;
+	case 2:
+		ra_spin_unlock(shared->spin);
+		break;
+	case 3:
+		if (write) {
+			ra_rwlock_write_unlock(shared->rwlock);
+		}
+		else {
+			ra_rwlock_read_unlock(shared->rwlock);
+		}
+		break;
+	default:
+		if (write) {
+			ra_brlock_write_unlock(shared->brlock);
+		}
+		else {
+			ra_brlock_read_unlock(shared->brlock, slot);
+		}
+		break;
+	}
+}
+
+static void
+_contend_(void *ctx)
+{
+	struct contend *contend;
+	struct shared *shared;
+	int j, slot, write;
+	uint64_t i;
+
+	contend = (struct contend *)ctx;
+	shared = contend->shared;
+	for (i=0; i<contend->ops; ++i) {
+		contend->seed ^= contend->seed << 13;
+		contend->seed ^= contend->seed >> 7;
+		contend->seed ^= contend->seed << 17;
+		write = (int)(contend->seed % 100) < contend->writes;
+		slot = acquire(shared, contend->kind, write);
+		if (write) {
+			for (j=0; j<8; ++j) {
+				++shared->data[j];
+			}
+			++contend->wrote;
+		}
+		else {
+			for (j=1; j<8; ++j) {
+				if (shared->data[0] != shared->data[j]) {
+					contend->fail = 1;
+				}
+			}
+		}
+		release(shared, contend->kind, write, slot);
+	}
+}
+
+/*
+ * Returns Mops/s of threads hammering one lock of the given kind with
+ * writes percent exclusive sections, or a negative value on failure.
+ */
+
+static double
+contend(int kind, int threads, int writes, uint64_t ops)
+{
+	struct contend contends[16];
+	ra_thread_t handles[16];
+	struct shared shared;
+	uint64_t wrote, t;
+	int i, e;
+
+	assert( 16 >= threads );
+
+	e = 0;
+	memset(&shared, 0, sizeof (shared));
+	memset(handles, 0, sizeof (handles));
+	memset(contends, 0, sizeof (contends));
+	switch (kind) {
+	case 0:
+		e = !(shared.mutex = ra_mutex_open());
+		break;
+	case 1:
+		e = !(shared.mutex = ra_mutex_open_adaptive());
+		break;
+	case 2:
+		e = !(shared.spin = ra_spin_open());
+		break;
+	case 3:
+		e = !(shared.rwlock = ra_rwlock_open());
+		break;
+	default:
+		e = !(shared.brlock = ra_brlock_open());
+		break;
+	}
+	t = ra_time();
+	for (i=0; !e && (i<threads); ++i) {
+		contends[i].kind = kind;
+		contends[i].writes = writes;
+		contends[i].ops = ops;
+		contends[i].seed = 0x9e3779b97f4a7c15 * (uint64_t)(i + 1);
+		contends[i].shared = &shared;
+		if (!(handles[i] = ra_thread_open(_contend_, &contends[i]))) {
+			e = -1;
+		}
+	}
+	wrote = 0;
+	for (i=0; i<threads; ++i) {
+		ra_thread_close(handles[i]);
+		wrote += contends[i].wrote;
+		e = contends[i].fail ? -1 : e;
+	}
+	t = ra_time() - t;
+	e = (wrote != shared.data[0]) ? -1 : e;
+	ra_mutex_close(shared.mutex);
+	ra_spin_close(shared.spin);
+	ra_rwlock_close(shared.rwlock);
+	ra_brlock_close(shared.brlock);
+	if (e) {
+		return -1.0;
+	}
+	return (double)threads * ops / RA_MAX(t, 1);
+}
+
+#if defined(__linux__)
+
+struct where {
+	volatile int go;
+	volatile int cpu;
+	volatile int e;
+	volatile int n;
+	struct ra_pool *pool;
+};
+
+static void
+_where_(void *ctx)
+{
+	struct where *where;
+
+	where = (struct where *)ctx;
+	while (!where->go) {
+		sched_yield();
+	}
+	where->cpu = sched_getcpu();
+}
+
+/* a pool task: is its worker on the CPU it was placed on? */
+
+static void
+_placed_(void *ctx)
+{
+	struct worker *worker;
+	struct where *where;
+
+	where = (struct where *)ctx;
+	ra_sleep(1000);
+	if ((worker = pthread_getspecific(where->pool->key))) {
+		if ((0 <= worker->cpu) && (sched_getcpu() != worker->cpu)) {
+			where->e = -1;
+		}
+		__sync_fetch_and_add(&where->n, 1);
+	}
+}
+
+#endif /* __linux__ */
+
+/*
+ * A thread pinned to a node runs there, and so do the workers of a placed
+ * pool; the calling thread's own affinity is left alone.
+ */
+
+static int
+placement_test(const struct ra_cpu *cpus, int n)
+{
+#if defined(__linux__)
+	struct where where;
+	ra_thread_t thread;
+	ra_group_t group;
+	ra_pool_t pool;
+	int i, e;
+
+	e = 0;
+	memset(&where, 0, sizeof (struct where));
+	where.cpu = -1;
+	if (!(thread = ra_thread_open(_where_, &where))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	if (ra_thread_affinity_node(thread, cpus[0].node)) {
+		e = -1;
+	}
+	where.go = 1;
+	ra_thread_close(thread);
+	for (i=0; i<n; ++i) {
+		if (cpus[i].id == where.cpu) {
+			break;
+		}
+	}
+	if ((i == n) || (cpus[i].node != cpus[0].node)) {
+		e = -1;
+	}
+
+	/* placed workers */
+
+	memset(&where, 0, sizeof (struct where));
+	if (!(pool = ra_pool_open_placed(2, RA_PLACE_SPREAD))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	where.pool = pool;
+	if ((group = ra_group_open(pool))) {
+		for (i=0; i<64; ++i) {
+			ra_group_submit(group, _placed_, &where);
+		}
+		ra_group_wait(group);
+		ra_group_close(group);
+	}
+	if (!group || where.e || !where.n) {
+		e = -1;
+	}
+	ra_pool_close(pool);
+	return e;
+#else
+	(void)cpus;
+	(void)n;
+	return 0;
+#endif /* __linux__ */
+}
+
+int
+ra_thread_test(void)
+{
+	const struct ra_cpu *cpus;
+	const int N = 100000;
+	ra_pool_t pool, placed;
+	ra_group_t group;
+	ra_mutex_t mutex;
+	ra_cond_t cond;
+	struct fib fib;
+	uint64_t count, t;
+	uint64_t *a;
+	int i, n, e;
+
+	e = 0;
+	cond = NULL;
+	if (!(a = malloc(N * sizeof (a[0])))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+
+	/* single worker, nested groups */
+
+	if (!(pool = ra_pool_open(1))) {
+		RA_FREE(a);
+		RA_TRACE("^");
+		return -1;
+	}
+	fib.n = 15;
+	fib.pool = pool;
+	_fib_(&fib);
+	if (610 != fib.r) {
+		e = -1;
+	}
+	ra_pool_close(pool);
+
+	/* several workers, nested groups and external submit */
+
+	if (!(pool = ra_pool_open(4))) {
+		RA_FREE(a);
+		RA_TRACE("^");
+		return -1;
+	}
+	fib.n = 22;
+	fib.pool = pool;
+	_fib_(&fib);
+	if (17711 != fib.r) {
+		e = -1;
+	}
+	count = 0;
+	if ((group = ra_group_open(pool))) {
+		for (i=0; i<N; ++i) {
+			ra_group_submit(group, _count_, &count);
+		}
+		ra_group_wait(group);
+		ra_group_close(group);
+	}
+	if ((uint64_t)N != count) {
+		e = -1;
+	}
+
+	/* topology and placement */
+
+	if (!(cpus = ra_topology(&n)) || (1 > n)) {
+		e = -1;
+	}
+	for (i=0; !e && (i<n); ++i) {
+		if ((0 > cpus[i].core) ||
+		    (0 > cpus[i].package) ||
+		    (0 > cpus[i].node) ||
+		    (0 > cpus[i].smt) ||
+		    (i && (cpus[i - 1].id >= cpus[i].id))) {
+			e = -1;
+		}
+	}
+	if (!e && placement_test(cpus, n)) {
+		e = -1;
+	}
+	if ((placed = ra_pool_open_placed(2, RA_PLACE_SPREAD))) {
+		fib.n = 15;
+		fib.pool = placed;
+		_fib_(&fib);
+		if (610 != fib.r) {
+			e = -1;
+		}
+		ra_pool_close(placed);
+	}
+
+	/* locks: exclusion under mixed readers and writers */
+
+	for (i=0; i<(int)RA_ARRAY_SIZE(LOCKS); ++i) {
+		if (0.0 > contend(i, 4, 20, 20000)) {
+			e = -1;
+		}
+	}
+
+	/* timed wait */
+
+	if ((mutex = ra_mutex_open()) && (cond = ra_cond_open(mutex))) {
+		ra_mutex_lock(mutex);
+		t = ra_time();
+		if (!ra_cond_timedwait(cond, 2000) ||
+		    (1500 > (ra_time() - t))) {
+			e = -1;
+		}
+		ra_mutex_unlock(mutex);
+	}
+	ra_cond_close(cond);
+	ra_mutex_close(mutex);
+
+	/* parallel for/reduce, inline and on the pool */
+
+	if (parallel_test(NULL, a, N) ||
+	    parallel_test(pool, a, N) ||
+	    partition_test(pool) ||
+	    parallel_test(pool, a, 7)) {
+		e = -1;
+	}
+	ra_pool_close(pool);
+	RA_FREE(a);
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
+
+int
+ra_thread_bench(void)
+{
+	const int THREADS[] = { 1, 2, 4, 8 };
+	const int WRITES[] = { 0, 10, 100 };
+	unsigned i, j, k;
+	double mops;
+
+	for (i=0; i<RA_ARRAY_SIZE(THREADS); ++i) {
+		for (j=0; j<RA_ARRAY_SIZE(WRITES); ++j) {
+			ra_printf(RA_COLOR_GRAY,
+				  "locks %d threads %3d%% writes:",
+				  THREADS[i],
+				  WRITES[j]);
+			for (k=0; k<RA_ARRAY_SIZE(LOCKS); ++k) {
+				mops = contend((int)k,
+					       THREADS[i],
+					       WRITES[j],
+					       100000);
+				if (0.0 > mops) {
+					ra_printf(RA_COLOR_GRAY, "\n");
+					RA_TRACE("integrity failure detected");
+					return -1;
+				}
+				ra_printf(RA_COLOR_GRAY,
+					  " %s %6.2f",
+					  LOCKS[k],
+					  mops);
+			}
+			ra_printf(RA_COLOR_GRAY, " Mops/s\n");
+		}
+	}
+	return 0;
+}
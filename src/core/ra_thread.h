@@ -8,17 +8,70 @@
 typedef struct ra_thread *ra_thread_t;
 typedef struct ra_mutex *ra_mutex_t;
 typedef struct ra_cond *ra_cond_t;
+typedef struct ra_rwlock *ra_rwlock_t;
+typedef struct ra_brlock *ra_brlock_t;
+typedef struct ra_spin *ra_spin_t;
+typedef struct ra_pool *ra_pool_t;
+typedef struct ra_group *ra_group_t;
 
 typedef void (*ra_thread_fnc_t)(void *ctx);
 
+typedef enum {
+	RA_PLACE_NONE,
+	RA_PLACE_SPREAD, /* one worker per package, then core, then sibling */
+	RA_PLACE_PACK /* fill siblings, then cores, then packages */
+} ra_place_t;
+
+struct ra_cpu {
+	int id; /* logical CPU */
+	int core; /* physical core, numbered from 0 within its package */
+	int package; /* socket */
+	int node; /* NUMA node */
+	int smt; /* position among the hardware threads of its core */
+	int llc; /* lowest CPU sharing its last-level cache */
+};
+
+typedef void (*ra_parallel_fnc_t)(void *ctx, uint64_t begin, uint64_t end);
+
+typedef void (*ra_partial_fnc_t)(void *ctx,
+				 uint64_t begin,
+				 uint64_t end,
+				 void *r);
+
+typedef void (*ra_reduce_fnc_t)(void *ctx, void *r, const void *r_);
+
 ra_thread_t ra_thread_open(ra_thread_fnc_t fnc, void *ctx);
 
 void ra_thread_close(ra_thread_t thread);
 
 int ra_thread_good(ra_thread_t thread);
 
+/**
+ * Online CPUs as read from sysfs, once; without sysfs, ra_cores() CPUs
+ * with no sharing. The array is static, *n receives its length.
+ */
+
+const struct ra_cpu *ra_topology(int *n);
+
+/**
+ * Pins thread (NULL: the calling thread) to one CPU, or to the CPUs of one
+ * NUMA node, so that its first-touch allocations stay node-local. Linux
+ * only, -1 elsewhere.
+ */
+
+int ra_thread_affinity(ra_thread_t thread, int cpu);
+
+int ra_thread_affinity_node(ra_thread_t thread, int node);
+
 ra_mutex_t ra_mutex_open(void);
 
+/**
+ * Spins on a contended lock for about as long as recent acquisitions took
+ * before parking in the kernel (plain ra_mutex_open() on a single core).
+ */
+
+ra_mutex_t ra_mutex_open_adaptive(void);
+
 void ra_mutex_close(ra_mutex_t mutex);
 
 void ra_mutex_lock(ra_mutex_t mutex);
@@ -31,6 +84,133 @@ void ra_cond_close(ra_cond_t cond);
 
 void ra_cond_signal(ra_cond_t cond);
 
+void ra_cond_broadcast(ra_cond_t cond);
+
 void ra_cond_wait(ra_cond_t cond);
 
+/**
+ * Waits at most us microseconds: 0 if woken (possibly spuriously), -1 on
+ * timeout.
+ */
+
+int ra_cond_timedwait(ra_cond_t cond, uint64_t us);
+
+/**
+ * Writer-preferring reader-writer lock: readers share it through one
+ * atomic word, a waiting writer holds off new readers. Waiters spin
+ * briefly, then park.
+ */
+
+ra_rwlock_t ra_rwlock_open(void);
+
+void ra_rwlock_close(ra_rwlock_t rwlock);
+
+void ra_rwlock_read_lock(ra_rwlock_t rwlock);
+
+void ra_rwlock_read_unlock(ra_rwlock_t rwlock);
+
+void ra_rwlock_write_lock(ra_rwlock_t rwlock);
+
+void ra_rwlock_write_unlock(ra_rwlock_t rwlock);
+
+/**
+ * Reader-biased lock: readers only touch one of several per-cache-line
+ * counters (chosen per thread, returned by read_lock and passed back to
+ * read_unlock), so they do not contend with each other; writers flag the
+ * lock and wait for every counter to drain, which makes writes expensive.
+ */
+
+ra_brlock_t ra_brlock_open(void);
+
+void ra_brlock_close(ra_brlock_t brlock);
+
+int ra_brlock_read_lock(ra_brlock_t brlock);
+
+void ra_brlock_read_unlock(ra_brlock_t brlock, int slot);
+
+void ra_brlock_write_lock(ra_brlock_t brlock);
+
+void ra_brlock_write_unlock(ra_brlock_t brlock);
+
+/**
+ * Test-and-test-and-set spinlock with exponential backoff, yielding the
+ * core once the backoff saturates. For very short critical sections.
+ */
+
+ra_spin_t ra_spin_open(void);
+
+void ra_spin_close(ra_spin_t spin);
+
+void ra_spin_lock(ra_spin_t spin);
+
+void ra_spin_unlock(ra_spin_t spin);
+
+/**
+ * Persistent pool of n worker threads (0: ra_cores()), each with its own
+ * work-stealing deque. Tasks submitted from a worker go to its deque, all
+ * others to a shared queue; idle workers steal. Every task belongs to a
+ * group and ra_group_wait() runs queued tasks until the group is done, so
+ * tasks may submit and wait on nested groups. A full queue runs the task
+ * inline. All groups must be waited on before ra_pool_close().
+ */
+
+ra_pool_t ra_pool_open(int n);
+
+/**
+ * As ra_pool_open(), with worker i pinned to the i-th CPU of the topology
+ * ordered by place.
+ */
+
+ra_pool_t ra_pool_open_placed(int n, ra_place_t place);
+
+void ra_pool_close(ra_pool_t pool);
+
+int ra_pool_size(ra_pool_t pool);
+
+ra_group_t ra_group_open(ra_pool_t pool);
+
+void ra_group_close(ra_group_t group);
+
+void ra_group_submit(ra_group_t group, ra_thread_fnc_t fnc, void *ctx);
+
+void ra_group_wait(ra_group_t group);
+
+/**
+ * Process-wide pool of ra_cores() workers, created on first use (NULL if
+ * that fails, in which case the helpers below run inline).
+ */
+
+ra_pool_t ra_pool_default(void);
+
+/**
+ * Splits [begin, end) into chunks of at least grain iterations and runs
+ * fnc on them in parallel on the default pool; ranges of up to grain
+ * iterations, or a single-core pool, run inline on the caller.
+ */
+
+void ra_parallel_for(uint64_t begin,
+		     uint64_t end,
+		     uint64_t grain,
+		     ra_parallel_fnc_t fnc,
+		     void *ctx);
+
+/**
+ * As ra_parallel_for(), but each chunk accumulates into a private copy of
+ * the size-byte value r, which must hold the identity on entry. The copies
+ * are then folded into r with join, in range order.
+ */
+
+void ra_parallel_reduce(uint64_t begin,
+			uint64_t end,
+			uint64_t grain,
+			ra_partial_fnc_t fnc,
+			ra_reduce_fnc_t join,
+			void *ctx,
+			void *r,
+			size_t size);
+
+int ra_thread_test(void);
+
+int ra_thread_bench(void);
+
 #endif /* __RA_THREAD_H__ */
@@ -0,0 +1,348 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_timer.h"
+
+#define LEVELS 4
+#define BITS 8
+#define SLOTS (1 << BITS)
+#define MASK (SLOTS - 1)
+#define HORIZON (((uint64_t)1 << (LEVELS * BITS)) - 1)
+
+struct ra_timer {
+	uint64_t tick; /* microseconds */
+	uint64_t now; /* ticks, every slot up to here has fired */
+	uint64_t pending;
+	uint64_t counts[LEVELS];
+	struct ra_timeout *slots[LEVELS][SLOTS];
+};
+
+static int
+level_(struct ra_timer *timer, struct ra_timeout *timeout)
+{
+	return (int)((timeout->list - &timer->slots[0][0]) / SLOTS);
+}
+
+static void
+unlink_(struct ra_timer *timer, struct ra_timeout *timeout)
+{
+	--timer->counts[level_(timer, timeout)];
+	if (timeout->prev) {
+		timeout->prev->next = timeout->next;
+	}
+	else {
+		(*timeout->list) = timeout->next;
+	}
+	if (timeout->next) {
+		timeout->next->prev = timeout->prev;
+	}
+	timeout->prev = NULL;
+	timeout->next = NULL;
+	timeout->list = NULL;
+}
+
+/*
+ * A timeout expires on the first tick at or after its deadline and lives
+ * in the lowest level whose span covers the distance to it; farther than
+ * the wheel reaches, it parks at the horizon and is placed again there.
+ * Level 0 thus only ever holds timeouts due on their slot's tick. The
+ * earliest is now + 1 when scheduling, now when cascading (its slot has
+ * yet to fire).
+ */
+
+static void
+place(struct ra_timer *timer, struct ra_timeout *timeout, uint64_t earliest)
+{
+	uint64_t expiry, delta;
+	int level;
+
+	expiry = (timeout->deadline + timer->tick - 1) / timer->tick;
+	expiry = RA_MAX(expiry, earliest);
+	delta = RA_MIN(expiry - timer->now, HORIZON);
+	expiry = timer->now + delta;
+	level = 0;
+	while (((uint64_t)1 << ((level + 1) * BITS)) <= delta) {
+		++level;
+	}
+	++timer->counts[level];
+	timeout->list = &timer->slots[level][(expiry >> (level * BITS)) & MASK];
+	timeout->prev = NULL;
+	if ((timeout->next = (*timeout->list))) {
+		timeout->next->prev = timeout;
+	}
+	(*timeout->list) = timeout;
+}
+
+static void
+cascade(struct ra_timer *timer, int level)
+{
+	struct ra_timeout **list, *timeout;
+
+	list = &timer->slots[level][(timer->now >> (level * BITS)) & MASK];
+	while ((timeout = (*list))) {
+		unlink_(timer, timeout);
+		place(timer, timeout, timer->now);
+	}
+}
+
+static void
+expire(struct ra_timer *timer)
+{
+	struct ra_timeout **list, *timeout;
+
+	/* fnc may cancel or reschedule what is still on list */
+
+	list = &timer->slots[0][timer->now & MASK];
+	while ((timeout = (*list))) {
+		unlink_(timer, timeout);
+		--timer->pending;
+		timeout->fnc(timeout->ctx);
+	}
+}
+
+ra_timer_t
+ra_timer_open(uint64_t tick)
+{
+	struct ra_timer *timer;
+
+	assert( tick );
+
+	if (!(timer = malloc(sizeof (struct ra_timer)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(timer, 0, sizeof (struct ra_timer));
+	timer->tick = tick;
+	timer->now = ra_time() / tick;
+	return timer;
+}
+
+void
+ra_timer_close(ra_timer_t timer)
+{
+	if (timer) {
+		memset(timer, 0, sizeof (struct ra_timer));
+		RA_FREE(timer);
+	}
+}
+
+void
+ra_timer_schedule(ra_timer_t timer,
+		  struct ra_timeout *timeout,
+		  uint64_t deadline,
+		  ra_timer_fnc_t fnc,
+		  void *ctx)
+{
+	assert( timer && timeout && fnc );
+
+	ra_timer_cancel(timer, timeout);
+	timeout->deadline = deadline;
+	timeout->fnc = fnc;
+	timeout->ctx = ctx;
+	place(timer, timeout, timer->now + 1);
+	++timer->pending;
+}
+
+void
+ra_timer_cancel(ra_timer_t timer, struct ra_timeout *timeout)
+{
+	assert( timer && timeout );
+
+	if (timeout->list) {
+		unlink_(timer, timeout);
+		--timer->pending;
+	}
+}
+
+void
+ra_timer_advance(ra_timer_t timer, uint64_t now)
+{
+	uint64_t mask;
+	int level;
+
+	assert( timer );
+
+	now /= timer->tick;
+	while (timer->pending && (timer->now < now)) {
+
+		/* leap to the next boundary of the lowest occupied level */
+
+		for (level=0; !timer->counts[level]; ++level);
+		if (level) {
+			mask = ((uint64_t)1 << (level * BITS)) - 1;
+			timer->now |= mask;
+			if (timer->now >= now) {
+				break;
+			}
+		}
+		++timer->now;
+		for (level=1; level<LEVELS; ++level) {
+			mask = ((uint64_t)1 << (level * BITS)) - 1;
+			if (timer->now & mask) {
+				break;
+			}
+		}
+		while (1 < level--) {
+			cascade(timer, level);
+		}
+		expire(timer);
+	}
+	timer->now = RA_MAX(timer->now, now);
+}
+
+uint64_t
+ra_timer_next(ra_timer_t timer)
+{
+	uint64_t t, mask;
+	int level;
+
+	assert( timer );
+
+	if (!timer->pending) {
+		return 0;
+	}
+
+	/* first occupied slot, or the first cascade, whichever is sooner */
+
+	for (level=0; !timer->counts[level]; ++level);
+	if (level) {
+		mask = ((uint64_t)1 << (level * BITS)) - 1;
+		return ((timer->now | mask) + 1) * timer->tick;
+	}
+	t = timer->now + 1;
+	while ((t & MASK) && !timer->slots[0][t & MASK]) {
+		++t;
+	}
+	return t * timer->tick;
+}
+
+uint64_t
+ra_timer_pending(ra_timer_t timer)
+{
+	assert( timer );
+
+	return timer->pending;
+}
+
+struct check {
+	int n;
+	int e;
+	uint64_t deadline;
+	struct ra_timeout timeout;
+};
+
+static uint64_t clock_, prev_, fired_;
+
+static uint64_t
+random_(void)
+{
+	return ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+}
+
+static void
+_fire_(void *ctx)
+{
+	struct check *check;
+	uint64_t due;
+
+	/* due on this advance and not on the previous one */
+
+	check = (struct check *)ctx;
+	check->n++;
+	fired_++;
+	due = (check->deadline + 1000 - 1) / 1000;
+	if ((clock_ / 1000 < due) || (prev_ && (prev_ / 1000 >= due))) {
+		check->e = -1;
+	}
+}
+
+int
+ra_timer_test(void)
+{
+	const uint64_t TICK = 1000;
+	const int N = 20000;
+	struct check *checks, edge;
+	ra_timer_t timer;
+	uint64_t base, next, fired;
+	int i, e;
+
+	/* initialize */
+
+	e = 0;
+	if (!(checks = malloc(N * sizeof (struct check)))) {
+		RA_TRACE("out of memory");
+		return -1;
+	}
+	memset(checks, 0, N * sizeof (struct check));
+	if (!(timer = ra_timer_open(TICK))) {
+		RA_FREE(checks);
+		RA_TRACE("^");
+		return -1;
+	}
+	base = ra_time();
+	srand(10);
+
+	/* deadlines from the past to beyond the wheel, every tenth canceled */
+
+	for (i=0; i<N; ++i) {
+		checks[i].deadline = base + TICK;
+		checks[i].deadline += random_() % (TICK << (i % 36));
+		if (!(i % 1000)) {
+			checks[i].deadline = base - TICK;
+		}
+		ra_timer_schedule(timer,
+				  &checks[i].timeout,
+				  checks[i].deadline,
+				  _fire_,
+				  &checks[i]);
+	}
+	for (i=0; i<N; i+=10) {
+		ra_timer_cancel(timer, &checks[i + 1].timeout);
+	}
+	if ((uint64_t)(N - N / 10) != ra_timer_pending(timer)) {
+		e = -1;
+	}
+
+	/* uneven strides, including leaps over whole levels */
+
+	clock_ = base;
+	prev_ = 0;
+	while (ra_timer_pending(timer)) {
+		clock_ += TICK;
+		clock_ += (rand() % 3) ? TICK * (random_() % 300) :
+			TICK * (random_() % (1 << 24));
+		next = ra_timer_next(timer);
+		fired = fired_;
+		ra_timer_advance(timer, clock_);
+		if ((clock_ < next) && (fired != fired_)) {
+			e = -1;
+		}
+		prev_ = clock_;
+	}
+
+	/* due on a level 1 boundary, reached on exactly that tick */
+
+	memset(&edge, 0, sizeof (struct check));
+	edge.deadline = ((clock_ / TICK >> BITS) + 2) << BITS;
+	edge.deadline *= TICK;
+	ra_timer_schedule(timer, &edge.timeout, edge.deadline, _fire_, &edge);
+	clock_ = edge.deadline - TICK;
+	ra_timer_advance(timer, clock_);
+	prev_ = clock_;
+	clock_ = edge.deadline;
+	ra_timer_advance(timer, clock_);
+	if ((1 != edge.n) || edge.e) {
+		e = -1;
+	}
+	for (i=0; i<N; ++i) {
+		if (((1 != i % 10) != checks[i].n) || checks[i].e) {
+			e = -1;
+		}
+	}
+	ra_timer_close(timer);
+	RA_FREE(checks);
+	if (e) {
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	return 0;
+}
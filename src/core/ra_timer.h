@@ -0,0 +1,59 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_TIMER_H__
+#define __RA_TIMER_H__
+
+#include "ra_kernel.h"
+
+typedef struct ra_timer *ra_timer_t;
+
+typedef void (*ra_timer_fnc_t)(void *ctx);
+
+/**
+ * Caller-owned timer entry; embed it in the object it times and zero it
+ * before first use.
+ */
+
+struct ra_timeout {
+	uint64_t deadline; /* ra_time() microseconds */
+	void *ctx;
+	ra_timer_fnc_t fnc;
+	struct ra_timeout *prev;
+	struct ra_timeout *next;
+	struct ra_timeout **list;
+};
+
+/**
+ * Hierarchical timing wheel (four levels of 256 slots) with a resolution
+ * of tick microseconds. Scheduling and canceling are O(1);
+ * ra_timer_advance() fires, in no particular order, every timeout whose
+ * deadline is at most now, never early and at most one tick late. fnc may
+ * schedule or cancel any timeout. Not thread-safe.
+ */
+
+ra_timer_t ra_timer_open(uint64_t tick);
+
+void ra_timer_close(ra_timer_t timer);
+
+void ra_timer_schedule(ra_timer_t timer,
+		       struct ra_timeout *timeout,
+		       uint64_t deadline,
+		       ra_timer_fnc_t fnc,
+		       void *ctx);
+
+void ra_timer_cancel(ra_timer_t timer, struct ra_timeout *timeout);
+
+void ra_timer_advance(ra_timer_t timer, uint64_t now);
+
+/**
+ * Earliest time at which ra_timer_advance() may fire a timeout (a bound
+ * for sleeping, never past a pending deadline), or 0 if none is pending.
+ */
+
+uint64_t ra_timer_next(ra_timer_t timer);
+
+uint64_t ra_timer_pending(ra_timer_t timer);
+
+int ra_timer_test(void);
+
+#endif /* __RA_TIMER_H__ */
@@ -0,0 +1,519 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#include "ra_hash.h"
+#include "ra_thread.h"
+#include "ra_wal.h"
+
+#define MAGIC 0x7261776c6f670001 /* "rawlog" | version */
+#define WINDOW (1024 * 1024)
+
+#define FLOOR(wal, x) ( (x) - (x) % (wal)->block )
+#define CEIL(wal, x) ( RA_DUP((x), (wal)->block) * (wal)->block )
+
+struct ra_wal {
+	int e;
+	int flushing;
+	char *buf; /* [base, head) not yet fully durable, zero beyond */
+	char *io;
+	void *memory_;
+	uint64_t off;
+	uint64_t size;
+	uint64_t block;
+	uint64_t window;
+	uint64_t epoch;
+	uint64_t base;
+	uint64_t head;
+	uint64_t durable;
+	uint64_t flushes;
+	ra_cond_t cond;
+	ra_mutex_t mutex;
+	ra_device_t device;
+};
+
+struct super {
+	uint64_t hash;
+	uint64_t magic;
+	uint64_t epoch;
+};
+
+struct record {
+	uint64_t hash; /* epoch, lsn, len, payload */
+	uint64_t epoch;
+	uint64_t lsn;
+	uint64_t len;
+};
+
+static uint64_t
+checksum(const struct record *record)
+{
+	return ra_hash(&record->epoch,
+		       sizeof (struct record) -
+		       sizeof (record->hash) +
+		       record->len);
+}
+
+static uint64_t
+span(uint64_t len)
+{
+	return sizeof (struct record) + RA_DUP(len, 8) * 8;
+}
+
+static int
+stamp(struct ra_wal *wal)
+{
+	struct super *super;
+
+	memset(wal->io, 0, wal->block);
+	super = (struct super *)wal->io;
+	super->magic = MAGIC;
+	super->epoch = wal->epoch;
+	super->hash = ra_hash(&super->magic, 2 * sizeof (uint64_t));
+	if (ra_device_write(wal->device, wal->io, wal->off, wal->block) ||
+	    ra_device_sync(wal->device)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+load(struct ra_wal *wal, uint64_t lsn, uint64_t *start, uint64_t *n)
+{
+	(*start) = FLOOR(wal, lsn);
+	(*n) = RA_MIN(wal->window, wal->size - (*start));
+	if (ra_device_read(wal->device,
+			   wal->io,
+			   wal->off + wal->block + (*start),
+			   (*n))) {
+		RA_TRACE("^");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+scan(struct ra_wal *wal, ra_wal_fnc_t fnc, void *ctx, uint64_t *end)
+{
+	const struct record *record;
+	uint64_t lsn, start, n;
+
+	if (load(wal, 0, &start, &n)) {
+		RA_TRACE("^");
+		return -1;
+	}
+	lsn = 0;
+	while ((lsn + sizeof (struct record)) <= wal->size) {
+		if ((lsn + sizeof (struct record)) > (start + n)) {
+			if (load(wal, lsn, &start, &n)) {
+				RA_TRACE("^");
+				return -1;
+			}
+		}
+		record = (const struct record *)(wal->io + (lsn - start));
+		if ((wal->epoch != record->epoch) ||
+		    (lsn != record->lsn) ||
+		    ((wal->window - wal->block) < span(record->len)) ||
+		    (wal->size < (lsn + span(record->len)))) {
+			break;
+		}
+		if ((lsn + span(record->len)) > (start + n)) {
+			if (load(wal, lsn, &start, &n)) {
+				RA_TRACE("^");
+				return -1;
+			}
+			record = (const struct record *)(wal->io +
+							 (lsn - start));
+		}
+		if (record->hash != checksum(record)) {
+			break;
+		}
+		if (fnc && fnc(ctx, record + 1, record->len)) {
+			RA_TRACE("^");
+			return -1;
+		}
+		lsn += span(record->len);
+	}
+	(*end) = lsn;
+	return 0;
+}
+
+/**
+ * Group commit: the first appender to find no flush in progress writes
+ * everything appended so far, [floor(durable), ceil(head)), in one device
+ * write from a snapshot and syncs the device, while later appenders keep
+ * filling the buffer and wait for the next round.
+ */
+
+static int
+lead(struct ra_wal *wal)
+{
+	uint64_t target, from, to, b;
+	int e;
+
+	wal->flushing = 1;
+	target = wal->head;
+	from = FLOOR(wal, wal->durable);
+	to = CEIL(wal, target);
+	memcpy(wal->io, wal->buf + (from - wal->base), to - from);
+	ra_mutex_unlock(wal->mutex);
+	e = (ra_device_write(wal->device,
+			     wal->io,
+			     wal->off + wal->block + from,
+			     to - from) ||
+	     ra_device_sync(wal->device)) ? -1 : 0;
+	ra_mutex_lock(wal->mutex);
+	wal->flushing = 0;
+	++wal->flushes;
+	if (e) {
+		wal->e = -1;
+		ra_cond_broadcast(wal->cond);
+		RA_TRACE("^");
+		return -1;
+	}
+	wal->durable = target;
+	if ((b = FLOOR(wal, target)) > wal->base) {
+		memmove(wal->buf, wal->buf + (b - wal->base), wal->head - b);
+		memset(wal->buf + (wal->head - b),
+		       0,
+		       wal->window - (wal->head - b));
+		wal->base = b;
+	}
+	ra_cond_broadcast(wal->cond);
+	return 0;
+}
+
+ra_wal_t
+ra_wal_open(ra_device_t device, uint64_t off, uint64_t len)
+{
+	const struct super *super;
+	struct ra_wal *wal;
+
+	assert( device );
+	assert( 0 == (off % ra_device_block(device)) );
+	assert( 0 == (len % ra_device_block(device)) );
+	assert( (4 * ra_device_block(device)) <= len );
+	assert( ra_device_size(device) >= (off + len) );
+
+	/* initialize */
+
+	if (!(wal = malloc(sizeof (struct ra_wal)))) {
+		RA_TRACE("out of memory");
+		return NULL;
+	}
+	memset(wal, 0, sizeof (struct ra_wal));
+	wal->device = device;
+	wal->off = off;
+	wal->block = ra_device_block(device);
+	wal->size = len - wal->block;
+	wal->window = RA_MAX(FLOOR(wal, RA_MIN(WINDOW, wal->size)),
+			     2 * wal->block);
+	if (!(wal->mutex = ra_mutex_open()) ||
+	    !(wal->cond = ra_cond_open(wal->mutex)) ||
+	    !(wal->memory_ = malloc(2 * wal->window + ra_page()))) {
+		ra_wal_close(wal);
+		RA_TRACE("^");
+		return NULL;
+	}
+	wal->buf = ra_align(wal->memory_, ra_page());
+	wal->io = wal->buf + wal->window;
+	memset(wal->buf, 0, wal->window);
+
+	/* epoch */
+
+	if (ra_device_read(wal->device, wal->io, wal->off, wal->block)) {
+		ra_wal_close(wal);
+		RA_TRACE("^");
+		return NULL;
+	}
+	super = (const struct super *)wal->io;
+	if ((MAGIC == super->magic) &&
+	    (super->hash == ra_hash(&super->magic, 2 * sizeof (uint64_t)))) {
+		wal->epoch = super->epoch;
+	}
+	else {
+		wal->epoch = 1;
+		if (stamp(wal)) {
+			ra_wal_close(wal);
+			RA_TRACE("^");
+			return NULL;
+		}
+	}
+
+	/* tail */
+
+	if (scan(wal, NULL, NULL, &wal->head)) {
+		ra_wal_close(wal);
+		RA_TRACE("^");
+		return NULL;
+	}
+	wal->durable = wal->head;
+	wal->base = FLOOR(wal, wal->head);
+	if (wal->head > wal->base) {
+		if (ra_device_read(wal->device,
+				   wal->buf,
+				   wal->off + wal->block + wal->base,
+				   wal->block)) {
+			ra_wal_close(wal);
+			RA_TRACE("^");
+			return NULL;
+		}
+		memset(wal->buf + (wal->head - wal->base),
+		       0,
+		       wal->block - (wal->head - wal->base));
+	}
+	return wal;
+}
+
+void
+ra_wal_close(ra_wal_t wal)
+{
+	if (wal) {
+		ra_cond_close(wal->cond);
+		ra_mutex_close(wal->mutex);
+		RA_FREE(wal->memory_);
+		memset(wal, 0, sizeof (struct ra_wal));
+		RA_FREE(wal);
+	}
+}
+
+int
+ra_wal_append(ra_wal_t wal, const void *buf, uint64_t len)
+{
+	struct record *record;
+	uint64_t n, lsn;
+
+	assert( wal );
+	assert( !len || buf );
+
+	n = span(len);
+	if ((wal->window - wal->block) < n) {
+		RA_TRACE("record too large");
+		return -1;
+	}
+	ra_mutex_lock(wal->mutex);
+
+	/* room */
+
+	for (;;) {
+		if (wal->e) {
+			ra_mutex_unlock(wal->mutex);
+			RA_TRACE("log failure detected");
+			return -1;
+		}
+		if (wal->size < (wal->head + n)) {
+			ra_mutex_unlock(wal->mutex);
+			RA_TRACE("log full");
+			return -1;
+		}
+		if ((wal->head + n) <= (wal->base + wal->window)) {
+			break;
+		}
+		if (wal->flushing) {
+			ra_cond_wait(wal->cond);
+		}
+		else if (lead(wal)) {
+			ra_mutex_unlock(wal->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+
+	/* append */
+
+	record = (struct record *)(wal->buf + (wal->head - wal->base));
+	record->epoch = wal->epoch;
+	record->lsn = wal->head;
+	record->len = len;
+	memcpy(record + 1, buf, len);
+	record->hash = checksum(record);
+	wal->head += n;
+	lsn = wal->head;
+
+	/* commit */
+
+	while (wal->durable < lsn) {
+		if (wal->e) {
+			ra_mutex_unlock(wal->mutex);
+			RA_TRACE("log failure detected");
+			return -1;
+		}
+		if (wal->flushing) {
+			ra_cond_wait(wal->cond);
+		}
+		else if (lead(wal)) {
+			ra_mutex_unlock(wal->mutex);
+			RA_TRACE("^");
+			return -1;
+		}
+	}
+	ra_mutex_unlock(wal->mutex);
+	return 0;
+}
+
+int
+ra_wal_recover(ra_wal_t wal, ra_wal_fnc_t fnc, void *ctx)
+{
+	uint64_t end;
+
+	assert( wal && fnc );
+
+	ra_mutex_lock(wal->mutex);
+	while (wal->flushing) {
+		ra_cond_wait(wal->cond);
+	}
+	if (scan(wal, fnc, ctx, &end)) {
+		ra_mutex_unlock(wal->mutex);
+		RA_TRACE("^");
+		return -1;
+	}
+	ra_mutex_unlock(wal->mutex);
+	return 0;
+}
+
+int
+ra_wal_reset(ra_wal_t wal)
+{
+	assert( wal );
+
+	ra_mutex_lock(wal->mutex);
+	while (wal->flushing) {
+		ra_cond_wait(wal->cond);
+	}
+	++wal->epoch;
+	if (stamp(wal)) {
+		wal->e = -1;
+		ra_mutex_unlock(wal->mutex);
+		RA_TRACE("^");
+		return -1;
+	}
+	wal->e = 0;
+	wal->base = wal->head = wal->durable = 0;
+	memset(wal->buf, 0, wal->window);
+	ra_mutex_unlock(wal->mutex);
+	return 0;
+}
+
+struct test {
+	int id;
+	int e;
+	ra_wal_t wal;
+	int seqs[8];
+	int records;
+};
+
+static void
+_test_(void *ctx)
+{
+	const int M = 200;
+	struct test *test;
+	uint8_t buf[256];
+	int i, len;
+
+	test = (struct test *)ctx;
+	for (i=0; i<M; ++i) {
+		len = 8 + (test->id * 7 + i * 13) % 200;
+		memset(buf, test->id * 31 + i, len);
+		memcpy(buf, &test->id, sizeof (int));
+		memcpy(buf + sizeof (int), &i, sizeof (int));
+		if (ra_wal_append(test->wal, buf, len)) {
+			test->e = -1;
+			return;
+		}
+	}
+}
+
+static int
+_recover_(void *ctx, const void *buf_, uint64_t len)
+{
+	const uint8_t *buf = (const uint8_t *)buf_;
+	struct test *test;
+	uint64_t j;
+	int id, i;
+
+	test = (struct test *)ctx;
+	memcpy(&id, buf, sizeof (int));
+	memcpy(&i, buf + sizeof (int), sizeof (int));
+	if ((0 > id) || (8 <= id) || (test->seqs[id]++ != i) ||
+	    (len != (uint64_t)(8 + (id * 7 + i * 13) % 200))) {
+		return -1;
+	}
+	for (j=8; j<len; ++j) {
+		if ((uint8_t)(id * 31 + i) != buf[j]) {
+			return -1;
+		}
+	}
+	++test->records;
+	return 0;
+}
+
+int
+ra_wal_test(void)
+{
+	const uint64_t SIZE = 4 * 1024 * 1024;
+	ra_thread_t threads[8];
+	struct test tests[8];
+	struct test test;
+	ra_device_t device;
+	ra_wal_t wal;
+	int i, e;
+
+	/* initialize */
+
+	if (!(device = ra_device_open_memory(SIZE, 512, 100)) ||
+	    !(wal = ra_wal_open(device, 512, SIZE - 512))) {
+		ra_device_close(device);
+		RA_TRACE("^");
+		return -1;
+	}
+
+	/* concurrent appends */
+
+	e = 0;
+	memset(tests, 0, sizeof (tests));
+	for (i=0; i<8; ++i) {
+		tests[i].id = i;
+		tests[i].wal = wal;
+		if (!(threads[i] = ra_thread_open(_test_, &tests[i]))) {
+			e = -1;
+		}
+	}
+	for (i=0; i<8; ++i) {
+		ra_thread_close(threads[i]);
+		e = tests[i].e ? -1 : e;
+	}
+
+	/* appenders waiting out a flush share the next one */
+
+	if ((8 * 200 / 2) < wal->flushes) {
+		e = -1;
+	}
+	ra_wal_close(wal);
+
+	/* recover */
+
+	memset(&test, 0, sizeof (test));
+	if (e ||
+	    !(wal = ra_wal_open(device, 512, SIZE - 512)) ||
+	    ra_wal_recover(wal, _recover_, &test) ||
+	    (8 * 200 != test.records)) {
+		ra_wal_close(wal);
+		ra_device_close(device);
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+
+	/* reset */
+
+	memset(&test, 0, sizeof (test));
+	if (ra_wal_reset(wal) ||
+	    ra_wal_recover(wal, _recover_, &test) ||
+	    test.records) {
+		ra_wal_close(wal);
+		ra_device_close(device);
+		RA_TRACE("integrity failure detected");
+		return -1;
+	}
+	ra_wal_close(wal);
+	ra_device_close(device);
+	return 0;
+}
@@ -0,0 +1,33 @@
+/* Copyright (c) Tony Givargis, 2024-2026 */
+
+#ifndef __RA_WAL_H__
+#define __RA_WAL_H__
+
+#include "ra_device.h"
+
+typedef struct ra_wal *ra_wal_t;
+
+typedef int (*ra_wal_fnc_t)(void *ctx, const void *buf, uint64_t len);
+
+/**
+ * Write-ahead log in the region [off, off + len) of a device. The first
+ * block holds the log epoch, records follow back to back, each checksummed
+ * with ra_hash. ra_wal_append() returns once its record is written and
+ * the device synced (ra_device_sync); concurrent appenders share a single
+ * device write and sync (group commit).
+ * ra_wal_reset() discards all records, e.g., after a checkpoint.
+ */
+
+ra_wal_t ra_wal_open(ra_device_t device, uint64_t off, uint64_t len);
+
+void ra_wal_close(ra_wal_t wal);
+
+int ra_wal_append(ra_wal_t wal, const void *buf, uint64_t len);
+
+int ra_wal_recover(ra_wal_t wal, ra_wal_fnc_t fnc, void *ctx);
+
+int ra_wal_reset(ra_wal_t wal);
+
+int ra_wal_test(void);
+
+#endif /* __RA_WAL_H__ */
@@ -14,15 +14,17 @@ greetings(void)
 int
 main(int argc, char *argv[])
 {
-	(void)argc;
-	(void)argv;
-
 	ra_color_enabled = 1;
 	ra_trace_enabled = 1;
 
 	greetings();
 	ra_core_init();
-	ra_core_test();
+	if ((2 == argc) && !strcmp(argv[1], "bench")) {
+		ra_core_bench();
+	}
+	else {
+		ra_core_test();
+	}
 
 	return 0;
 }